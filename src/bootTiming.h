@@ -0,0 +1,31 @@
+#ifndef MY_BOOTTIMING_H
+#define MY_BOOTTIMING_H
+
+#include <Arduino.h>
+
+// ==================================
+// === Boot Milestones ==============
+// ==================================
+// millis() since reset at each step of bring-up, 0 until reached. The
+// safety side is up once pulse capture runs and the valve relay holds its
+// restored state; everything after it happens in the background. Written
+// once each (from either task), read by the comms task for the one-off
+// "boot" diagnostics message.
+
+struct BootTiming {
+    volatile uint32_t safetyMs;        // pulse capture + restored valve state live
+    volatile uint32_t firstSampleMs;   // first flow tick processed
+    volatile uint32_t wifiMs;          // WiFi associated
+    volatile uint32_t timeMs;          // NTP synced
+    volatile uint32_t mqttMs;          // broker accepted the connection
+    volatile uint32_t firstPublishMs;  // first telemetry handed to the link
+    bool reported;
+};
+
+BootTiming bootTiming = {0, 0, 0, 0, 0, 0, false};
+
+inline void markBoot(volatile uint32_t &milestone) {
+    if (milestone == 0) milestone = max(1UL, (unsigned long)millis());
+}
+
+#endif
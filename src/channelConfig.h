@@ -0,0 +1,51 @@
+#ifndef MY_CHANNELCONFIG_H
+#define MY_CHANNELCONFIG_H
+
+#include <Arduino.h>
+#include "mySecrets.h"
+
+// ==================================
+// === Flow Channels ================
+// ==================================
+// One entry per meter/valve pair on this board. Each channel publishes under
+// <topicBase><name>/ (flowData, simpleFlowData, cmdSend, Ack, history) and keeps its
+// own state journal in NVS. The board itself (MQTT connection, status/LWT,
+// backlog, diagnostics) stays under TOPIC_BASE_STR + MQTT_CLIENT_ID.
+// Channel 0 keeps the single-meter topics and NVS namespace, and is the one
+// the buttons and NeoPixels act on.
+//
+// To run more meters, raise FLOW_CHANNEL_COUNT (e.g. build_flags =
+// -DFLOW_CHANNEL_COUNT=2) and fill in an entry per channel below.
+
+#ifndef FLOW_CHANNEL_COUNT
+#define FLOW_CHANNEL_COUNT 1
+#endif
+#define FLOW_CHANNEL_MAX 4   // PCNT units and free pins bound this
+
+// === Pins (channel 0 / board) ===
+#define FLOW_SENSOR_PIN    25
+#define VALVE_RELAY        4
+#define BUTTON_MODE_PIN    32
+#define BUTTON_VALVE_PIN   33
+
+struct FlowChannelConfig {
+    const char *name;          // topic segment, e.g. "domesticSupplyFlow"
+    const char *topicBase;     // e.g. "6556/controller/water/domestic/"
+    const char *label;         // used in warning text, e.g. "Domestic"
+    uint8_t sensorPin;
+    uint8_t valvePin;
+    const char *nvsNamespace;  // state journal namespace (<= 15 chars)
+};
+
+constexpr FlowChannelConfig flowChannelConfigs[FLOW_CHANNEL_COUNT] = {
+    // name,          topic base,     label,      sensor pin,      valve pin,   NVS namespace
+    {MQTT_CLIENT_ID, TOPIC_BASE_STR, "Domestic", FLOW_SENSOR_PIN, VALVE_RELAY, "flowstate"},
+    // {"irrigationBypassFlow", "6556/controller/water/irrigation/", "Irrigation", 26, 27, "flowstate1"},
+};
+
+static_assert(FLOW_CHANNEL_COUNT >= 1 && FLOW_CHANNEL_COUNT <= FLOW_CHANNEL_MAX,
+              "FLOW_CHANNEL_COUNT must be 1..FLOW_CHANNEL_MAX");
+static_assert(flowChannelConfigs[FLOW_CHANNEL_COUNT - 1].name != nullptr,
+              "flowChannelConfigs needs an entry for every channel");
+
+#endif
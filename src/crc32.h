@@ -0,0 +1,23 @@
+#ifndef MY_CRC32_H
+#define MY_CRC32_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// ==========================
+// === CRC-32 (IEEE) ========
+// ==========================
+// Bitwise, table-free: small code, fine for the short records we frame.
+inline uint32_t crc32Update(uint32_t crc, const void *data, size_t len) {
+  const uint8_t *p = (const uint8_t *)data;
+  crc = ~crc;
+  while (len--) {
+    crc ^= *p++;
+    for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (0xEDB88320UL & (0UL - (crc & 1)));
+  }
+  return ~crc;
+}
+
+inline uint32_t crc32(const void *data, size_t len) { return crc32Update(0, data, len); }
+
+#endif
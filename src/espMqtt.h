@@ -2,48 +2,110 @@
 #define MY_ESPMQTT_H
 
 #include <WiFi.h>
-#include <PubSubClient.h>
-#include <ArduinoJson.h>
+#include "jsonArena.h"   // before anything else pulls in ArduinoJson.h
 #include <Preferences.h>
 #include "esp_task_wdt.h"
 #include "mySecrets.h"
+#include "channelConfig.h"
+#include "taskQueues.h"
+#include "payloadLog.h"
+#include "flowHistory.h"
+#include "memHealth.h"
+#include "mqttLink.h"
+#include "bootTiming.h"
+#include "rtcShadow.h"
+#include "warningQueue.h"
+#if defined(ARDUINO_ARCH_ESP32)
+#include <LittleFS.h>
+#endif
 
 // === Globals ===
 WiFiClient espClient;
-PubSubClient mqttClient(espClient);
+MqttLink mqttLink(espClient);
 Preferences preferences;
+PayloadLog payloadLog(PAYLOAD_LOG_DIR);
+typedef FlowHistory<FLOW_SAMPLING> ChannelHistory;
+ChannelHistory flowHistory[FLOW_CHANNEL_COUNT] = {
+    {PAYLOAD_LOG_DIR, 0},
+#if FLOW_CHANNEL_COUNT > 1
+    {PAYLOAD_LOG_DIR, 1},
+#endif
+#if FLOW_CHANNEL_COUNT > 2
+    {PAYLOAD_LOG_DIR, 2},
+#endif
+#if FLOW_CHANNEL_COUNT > 3
+    {PAYLOAD_LOG_DIR, 3},
+#endif
+};
+
+// Fixed JSON pools: nothing on the MQTT in/out path touches the heap.
+// Rx backs inbound command/ACK parsing, Tx backs every outbound document.
+// Each is one variant pool plus a string budget (text bytes, string count):
+// Rx - a command or ACK, incl. a 64-char wID and parser growth slack;
+// Tx - the hourly report's keys and time stamps, or a warning's text.
+#define JSON_RX_ARENA_BYTES JSON_ARENA_BYTES(384, 8)
+#define JSON_TX_ARENA_BYTES JSON_ARENA_BYTES(512, 24)
+JsonArena<JSON_RX_ARENA_BYTES> jsonRxArena;
+JsonArena<JSON_TX_ARENA_BYTES> jsonTxArena;
 
 // === Config Constants ===
-#define RETRY_INTERVAL 120000UL
-#define BUFFER_SIZE 24
+#define RETRY_INTERVAL 120000UL        // slowest backlog drain interval (full backoff)
+#define DRAIN_INTERVAL_MIN_MS 250UL    // fastest backlog drain interval while the broker accepts
+#define MQTT_BUFFER_SIZE 2048          // bounds one array-framed backlog publish
+#define BUFFER_SIZE 24   // legacy NVS ring size, only used for migration
 #define CUSTOM_MQTT_KEEPALIVE 60
 const unsigned long mqttReconnectIntervalMS = 60000UL;
-const unsigned long mqttPublishRetryDelayMS = 30000UL;
+
+// Delivery tags (mqttLink.h): reported back by onMqttDelivered() on PUBACK
+#define MQTT_TAG_BACKLOG 1
+#define MQTT_TAG_HISTORY 2
 
 unsigned long lastMQTTConnectAttempt = 0;
-unsigned long lastMQTTPublishFail = 0;
-unsigned long lastRetryTime = 0;
-unsigned long lastSend = 0;
-bool isCyclingValve = false;
 
 const char *mqtt_server = MQTT_SERVER;
 const char *mqtt_lwt_message = "offline";
 const char *mqtt_online_message = "online";
 
 // === Topic Setup ===
+// Board topics (one MQTT connection per board)
 String topicBaseStr        = String(TOPIC_BASE_STR);
 String mqttClientBase      = String(MQTT_CLIENT_ID);
-String topic_fullflow_str  = topicBaseStr + mqttClientBase + "/flowData";
-String topic_simpleflow_str= topicBaseStr + mqttClientBase + "/simpleFlowData";
+String topic_backlog_str   = topicBaseStr + mqttClientBase + "/flowDataBacklog";
 String topic_lwt_str       = topicBaseStr + mqttClientBase + "/status";
-String topic_command_str   = topicBaseStr + mqttClientBase + "/cmdSend";
-String topic_ack_str       = topicBaseStr + mqttClientBase + "/Ack";
+String topic_diag_str      = topicBaseStr + mqttClientBase + "/diagnostics";
 
-const char *mqtt_fullflow_topic  = topic_fullflow_str.c_str();
-const char *mqtt_simpleflow_topic = topic_simpleflow_str.c_str();
+const char *mqtt_backlog_topic   = topic_backlog_str.c_str();
 const char *mqtt_lwt_topic       = topic_lwt_str.c_str();
-const char *mqtt_command_topic   = topic_command_str.c_str();
-const char *mqtt_ack_topic       = topic_ack_str.c_str();
+const char *mqtt_diag_topic      = topic_diag_str.c_str();
+
+// Per flow channel topics under <topicBase><name>/
+struct ChannelTopics {
+    String fullflow, simpleflow, fullflowMp, simpleflowMp, command, ack, history;
+};
+ChannelTopics channelTopics[FLOW_CHANNEL_COUNT];
+
+bool buildChannelTopics() {
+    for (uint8_t i = 0; i < FLOW_CHANNEL_COUNT; i++) {
+        String base = String(flowChannelConfigs[i].topicBase) + flowChannelConfigs[i].name;
+        ChannelTopics &t = channelTopics[i];
+        t.fullflow     = base + "/flowData";
+        t.simpleflow   = base + "/simpleFlowData";
+        t.fullflowMp   = t.fullflow + "/mp";
+        t.simpleflowMp = t.simpleflow + "/mp";
+        t.command      = base + "/cmdSend";
+        t.ack          = base + "/Ack";
+        t.history      = base + "/history";
+    }
+    return true;
+}
+const bool channelTopicsBuilt = buildChannelTopics();   // at static init, like the Strings above
+
+// Channel whose command topic this is, or -1
+int channelForCommandTopic(const char *topic) {
+    for (uint8_t i = 0; i < FLOW_CHANNEL_COUNT; i++)
+        if (strcmp(topic, channelTopics[i].command.c_str()) == 0) return i;
+    return -1;
+}
 
 // === Warning Topics ===
 String topic_warning_str      = "6556/warnings";
@@ -52,32 +114,27 @@ const char *mqtt_warning_topic     = topic_warning_str.c_str();
 const char *mqtt_warning_ack_topic = topic_warning_ack_str.c_str();
 
 // === Warning ACK State ===
-String pendingWarnID = "";
-String pendingWarnPayload = "";
-unsigned long pendingWarnSentAt = 0;
-int pendingWarnRetries = 0;
+// Every warning waits in warningQueue (warningQueue.h) until its ACK comes
+// back. The queue is mirrored in RTC memory (rtcShadow.h) whenever it
+// changes, so a warm restart resends the same wIDs instead of dropping
+// them. Only touched by the comms task.
+#define WARN_PAYLOAD_LEN 384
+WarningQueue warningQueue;
 
-const unsigned long WARN_ACK_TIMEOUT_MS = 15000UL; // 15s
-const int WARN_MAX_RETRIES = 3;
+typedef RtcShadow<WarningQueueState, 2> WarningShadow;
+RTC_NOINIT_ATTR WarningShadow::Slots warningShadowMem;
+WarningShadow warningShadow(warningShadowMem);
 
 // === Forward Decls ===
-bool sendWarning(const char *wLevel, const char *wMessage, const char *wTitle);
+bool queueWarning(const WarningMsg &w, uint8_t channel);
 void processWarningAckTick();
-void handleWarningAck(const String &msg);
+void handleWarningAck(const byte *payload, unsigned int length);
+void startHistoryStream(uint8_t channel, JsonDocument &req);
+void restorePendingWarnings();
+void sendSimpleData(uint8_t channel, const SimpleFlowSnapshot &snap);
+void noteFirstPublish();
 
 
-// === Externs ===
-extern String max1MinTime, max10SecTime, max10MinTime, max30MinTime;
-extern float flow10s, flowAvgValue,max1Min, max10Sec, max10Min, max30Min, volumeAll;
-extern bool valveClosed;
-extern unsigned long waterRunDurSec;
-extern int statusMonitor;
-extern void closeValve(), openValve(), cycleValve(), setValveMode(int), saveVolumeToPrefs();
-
-// === Function Declarations ===
-int getIndex(const char *key);
-void setIndex(const char *key, int value);
-
 // === MQTT Adaptive Backoff ===
 unsigned long bootMillis = 0;
 
@@ -93,35 +150,70 @@ static unsigned long jitter(unsigned long base, uint8_t pct);
 
 
 // === Acknowledgement Send ===
-void sendAck(const char *cmd, const char *status) {
-    StaticJsonDocument<128> ack;
+void sendAck(uint8_t channel, const char *cmd, const char *status) {
+    char ts[20];
+    formatTimeNow(ts, sizeof(ts));
+
+    jsonTxArena.reset();
+    JsonDocument ack(&jsonTxArena);
     ack["cmd"] = cmd;
     ack["status"] = status;
-    ack["timeStamp"] = getTimeString("DateTimeMin");
+    ack["timeStamp"] = ts;
 
     char response[128];
-    serializeJson(ack, response);
-    mqttClient.publish(mqtt_ack_topic, response, true);
-    Serial.printf("Acknowledgment sent: %s\n", response);
+    if (serializeJson(ack, response, sizeof(response)) == 0) {
+        Serial.println("Acknowledgment serialization failed.");
+        return;
+    }
+    if (!mqttLink.publish(channelTopics[channel].ack.c_str(), response, true, 1)) {
+        Serial.println("Acknowledgment dropped: MQTT outbox full.");
+        return;
+    }
+    Serial.printf("Acknowledgment queued: %s\n", response);
+}
+
+// === Command Table ===
+// Valve commands run on the safety side; its result acks
+// (already_running, completed, ...) come back through commsQueue.
+struct CommandEntry {
+    const char *name;
+    ValveCmdType type;
+    uint32_t arg;       // fixed arg; timed_close reads "sec" from the payload
+};
+
+static const CommandEntry commandTable[] = {
+    {"close_valve", VALVE_CMD_CLOSE,       0},
+    {"open_valve",  VALVE_CMD_OPEN,        0},
+    {"cycle_valve", VALVE_CMD_CYCLE,       0},
+    {"timed_close", VALVE_CMD_TIMED_CLOSE, 0},
+    {"Status0",     VALVE_CMD_MODE,        0},
+    {"Status1",     VALVE_CMD_MODE,        1},
+    {"Status2",     VALVE_CMD_MODE,        2},
+};
+
+static const CommandEntry *findCommand(const char *cmd) {
+    for (size_t i = 0; i < sizeof(commandTable) / sizeof(commandTable[0]); i++)
+        if (strcmp(cmd, commandTable[i].name) == 0) return &commandTable[i];
+    return NULL;
 }
 
 // === Command Callback Handler ===
+// Parses straight from the link's receive buffer into the rx arena; no String copies.
 void mqttCallback(char *topic, byte *payload, unsigned int length) {
-    String msg;
-    for (unsigned int i = 0; i < length; i++) msg += (char)payload[i];
-    Serial.printf("Message received on topic %s: %s\n", topic, msg.c_str());
+    Serial.printf("Message received on topic %s: %.*s\n", topic, (int)length, (const char *)payload);
 
     // Handle warning ACKs
-    if (String(topic) == mqtt_warning_ack_topic) {
-        handleWarningAck(msg);
+    if (strcmp(topic, mqtt_warning_ack_topic) == 0) {
+        handleWarningAck(payload, length);
         return;
     }
 
+    int channel = channelForCommandTopic(topic);
+    if (channel < 0) return;
 
-    if (String(topic) != mqtt_command_topic) return;
-
-    StaticJsonDocument<128> doc;
-    if (deserializeJson(doc, msg)) {
+    jsonRxArena.reset();
+    JsonDocument doc(&jsonRxArena);
+    if (deserializeJson(doc, payload, length)) {
         Serial.println("Failed to parse JSON command.");
         return;
     }
@@ -129,33 +221,42 @@ void mqttCallback(char *topic, byte *payload, unsigned int length) {
     const char *cmd = doc["cmd"];
     if (!cmd) return;
 
-    if (strcmp(cmd, "close_valve") == 0)         closeValve();
-    else if (strcmp(cmd, "open_valve") == 0)     openValve();
-    else if (strcmp(cmd, "cycle_valve") == 0) {
-        if (isCyclingValve) {
-            sendAck("cycle_valve", "already_running");
-            return;
-        }
-        isCyclingValve = true;
-        cycleValve();
-        isCyclingValve = false;
-    }
-    else if (strcmp(cmd, "Status0") == 0)         setValveMode(0);
-    else if (strcmp(cmd, "Status1") == 0)         setValveMode(1);
-    else if (strcmp(cmd, "Status2") == 0)         setValveMode(2);
-    else {
+    // Answered from flash by the comms task; nothing for the safety side
+    if (strcmp(cmd, "get_history") == 0) {
+        startHistoryStream(channel, doc);
+        return;
+    }
+
+    const CommandEntry *entry = findCommand(cmd);
+    if (!entry) {
         Serial.printf("Unknown command: %s\n", cmd);
-        sendAck(cmd, "unknown");
+        sendAck(channel, cmd, "unknown");
         return;
     }
 
-    sendAck(cmd, "received");
+    ValveCmdMsg vc = {entry->type, (uint8_t)channel, entry->arg};
+    if (entry->type == VALVE_CMD_TIMED_CLOSE) vc.arg = doc["sec"] | 0UL;
+
+    // sendAck() reuses the tx arena only, so cmd stays valid here
+    if (!valveCmdQueue.push(vc)) {
+        sendAck(channel, cmd, "busy");
+        return;
+    }
+    sendAck(channel, cmd, "received");
 }
 
+// Latest simpleFlowData snapshot per channel that found the link down. The
+// safety side only reports on change, so it goes out on the next connect
+// and the retained value is current right after a boot or an outage.
+SimpleFlowSnapshot simpleLatest[FLOW_CHANNEL_COUNT];
+bool simpleUnsent[FLOW_CHANNEL_COUNT] = {false};
+
 // === MQTT Connect ===
+// Starts an attempt and returns; the link reports the outcome through
+// onMqttEvent(). Only the TCP open waits (MQTT_TCP_CONNECT_TIMEOUT_MS).
 void connectToMQTT() {
     if (!isWifiReady()) { Serial.println("MQTT skipped: WiFi not ready"); return; }
-    if (mqttClient.connected()) { Serial.println("MQTT already connected."); return; }
+    if (mqttLink.state() != MQTT_LINK_DOWN) return;
 
     unsigned long now = millis();
     if (bootMillis == 0) bootMillis = now;
@@ -164,33 +265,61 @@ void connectToMQTT() {
                               ? mqttBackoffMs
                               : max(mqttBackoffMs, mqttReconnectIntervalMS);
 
-    if (now - lastMQTTConnectAttempt < interval) {
+    // The first attempt after boot is never throttled
+    if (lastMQTTConnectAttempt != 0 && now - lastMQTTConnectAttempt < interval) {
         Serial.println("MQTT reconnect throttled.");
         return;
     }
 
-    Serial.print("Connecting to MQTT...");
+    Serial.println("Connecting to MQTT...");
     lastMQTTConnectAttempt = now;
-    mqttClient.setBufferSize(512);
-
-    if (mqttClient.connect(MQTT_CLIENT_ID, MQTT_USER, MQTT_PASS, mqtt_lwt_topic, 1, true, mqtt_lwt_message)) {
-        mqttBackoffMs = MQTT_BACKOFF_MIN_MS;
-        mqttConsecutiveFails = 0;
-        mqttClient.publish(mqtt_lwt_topic, mqtt_online_message, true);
-        mqttClient.setCallback(mqttCallback);
-        mqttClient.subscribe(mqtt_command_topic);
-        mqttClient.subscribe(mqtt_warning_ack_topic);
-        Serial.println(" connected.");
-    } else {
-        mqttConsecutiveFails++;
-        unsigned long next = min(mqttBackoffMs * 2UL, MQTT_BACKOFF_MAX_MS);
-        mqttBackoffMs = jitter(next, 10); // ±10% jitter
-        Serial.print(" failed, rc="); Serial.print(mqttClient.state());
-        Serial.print(" ; next retry ~"); Serial.print(mqttBackoffMs); Serial.println(" ms");
-        delay(250);
+    mqttLink.beginConnect();
+    recordNetStall(now);
+}
+
+void onMqttEvent(MqttLinkEvent event) {
+    switch (event) {
+        case MQTT_EVENT_CONNECTED:
+            mqttBackoffMs = MQTT_BACKOFF_MIN_MS;
+            mqttConsecutiveFails = 0;
+            markBoot(bootTiming.mqttMs);
+            mqttLink.publish(mqtt_lwt_topic, mqtt_online_message, true, 1);
+            Serial.printf("MQTT connected (%u queued).\n", mqttLink.queued());
+            for (uint8_t i = 0; i < FLOW_CHANNEL_COUNT; i++) {
+                if (!simpleUnsent[i]) continue;
+                simpleUnsent[i] = false;
+                sendSimpleData(i, simpleLatest[i]);
+            }
+            break;
+        case MQTT_EVENT_CONNECT_FAILED: {
+            mqttConsecutiveFails++;
+            unsigned long next = min(mqttBackoffMs * 2UL, MQTT_BACKOFF_MAX_MS);
+            mqttBackoffMs = jitter(next, 10); // ±10% jitter
+            Serial.printf("MQTT connect failed, code=%u ; next retry ~%lu ms\n",
+                          mqttLink.connackCode(), mqttBackoffMs);
+            break;
+        }
+        case MQTT_EVENT_DISCONNECTED:
+            Serial.printf("MQTT connection lost (%u in flight, resent on reconnect).\n", mqttLink.inflight());
+            break;
     }
 }
 
+void onMqttDelivered(uint8_t tag);
+
+void mqttSetup() {
+    mqttLink.setServer(mqtt_server, 1883);
+    mqttLink.setKeepAlive(CUSTOM_MQTT_KEEPALIVE);
+    mqttLink.setCredentials(MQTT_CLIENT_ID, MQTT_USER, MQTT_PASS);
+    mqttLink.setWill(mqtt_lwt_topic, mqtt_lwt_message, 1, true);
+    mqttLink.setCallback(mqttCallback);
+    mqttLink.setDeliveredCallback(onMqttDelivered);
+    mqttLink.setEventCallback(onMqttEvent);
+    for (uint8_t i = 0; i < FLOW_CHANNEL_COUNT; i++) mqttLink.addSubscription(channelTopics[i].command.c_str());
+    mqttLink.addSubscription(mqtt_warning_ack_topic);
+    restorePendingWarnings();
+}
+
 
 
 // Add small randomness so multiple devices don't slam the broker at the same instant
@@ -205,273 +334,719 @@ static unsigned long jitter(unsigned long base, uint8_t pct) {
 
 
 // === Send MQTT Message ===
-bool sendMQTTMessage(const char *payload) {
-    connectToMQTT();
-    if (!mqttClient.connected()) {
+// Queues a QoS 1 publish. False while offline or when the outbox is full,
+// so the caller keeps its own copy.
+bool sendMQTTMessage(const char *payload, const char *topic, bool retained = true, uint8_t tag = 0) {
+    if (!mqttLink.connected()) {
         Serial.println("MQTT not connected. Skipping send.");
         return false;
     }
 
-    if (millis() - lastMQTTPublishFail < mqttPublishRetryDelayMS) {
-        Serial.println("MQTT publish throttled.");
+    if (!mqttLink.publish(topic, payload, retained, 1, tag)) {
+        Serial.printf("MQTT outbox full (%u queued). Skipping send.\n", mqttLink.queued());
         return false;
     }
-
-    bool success = mqttClient.publish(mqtt_fullflow_topic, payload, true);
-    if (success) {
-        Serial.println("MQTT message sent.");
-    } else {
-        Serial.print("MQTT publish failed. State: ");
-        Serial.println(mqttClient.state());
-        lastMQTTPublishFail = millis();
-    }
-    return success;
+    Serial.println("MQTT message queued.");
+    noteFirstPublish();
+    return true;
 }
 
 // === Buffer Management ===
+// Offline payloads go to the append-only flash log (payloadLog.h) instead of
+// one NVS key per record plus NVS head/tail indices.
 void savePayloadToBuffer(const char *payload) {
-    int head = getIndex("head");
-    char key[8];
-    sprintf(key, "buf%d", head);
+    if (payloadLog.append(payload, strlen(payload)))
+        Serial.printf("Saved payload to log (%lu pending)\n", (unsigned long)payloadLog.pending());
+    else
+        Serial.println("Payload log append failed.");
+}
+
+// One-time import of records left in the legacy NVS ring
+void migrateLegacyBuffer() {
+    preferences.begin("bufidx", true);
+    int tail = preferences.getInt("tail", 0);
+    int head = preferences.getInt("head", 0);
+    preferences.end();
+    if (tail == head) return;
 
     preferences.begin("buffer", false);
-    preferences.putString(key, payload);
+    for (int i = tail; i != head; i = (i + 1) % BUFFER_SIZE) {
+        char key[8];
+        sprintf(key, "buf%d", i);
+        String payload = preferences.getString(key, "");
+        if (payload.length() > 0) payloadLog.append(payload.c_str(), payload.length());
+    }
+    preferences.clear();
     preferences.end();
 
-    setIndex("head", (head + 1) % BUFFER_SIZE);
-    Serial.printf("Saved payload to %s\n", key);
+    preferences.begin("bufidx", false);
+    preferences.clear();
+    preferences.end();
+    Serial.printf("Migrated legacy NVS buffer (%d..%d) to payload log\n", tail, head);
 }
 
-bool loadPayloadFromBuffer(int index, String &payloadOut) {
-    char key[8];
-    sprintf(key, "buf%d", index);
+void payloadLogSetup() {
+#if defined(ARDUINO_ARCH_ESP32)
+    if (!LittleFS.begin(true)) {
+        Serial.println("LittleFS mount failed; offline buffer disabled.");
+        return;
+    }
+#endif
+    payloadLog.begin();
+    migrateLegacyBuffer();
+    Serial.printf("Payload log ready: %lu pending\n", (unsigned long)payloadLog.pending());
+}
 
-    preferences.begin("buffer", true);
-    payloadOut = preferences.getString(key, "");
-    preferences.end();
+// === Backlog Drain ===
+// Packs as many logged reports as fit into one JSON array published
+// (not retained, QoS 1) on flowDataBacklog, so no record is lost to
+// retained-message overwrite. One batch is in flight at a time and its
+// records are only acked in the log once the broker's PUBACK arrives, so a
+// dropped connection or a reboot resends them. The interval halves after
+// each delivered batch down to DRAIN_INTERVAL_MIN_MS and doubles when the
+// outbox refuses one, up to RETRY_INTERVAL.
+unsigned long drainIntervalMs = DRAIN_INTERVAL_MIN_MS;
+unsigned long lastDrainMs = 0;
+bool backlogInFlight = false;
+static char backlogBatch[MQTT_BUFFER_SIZE];
+
+// Returns the number of records queued, 0 on failure or nothing to send
+uint16_t publishBacklogBatch() {
+    size_t cap = MQTT_BUFFER_SIZE;
+    size_t used = 1, recLen = 0;
+    uint16_t count = 0;
+    backlogBatch[0] = '[';
+
+    payloadLog.beginBatch();
+    for (;;) {
+        size_t sep = count ? 1 : 0;
+        // keep room for the closing ']' and NUL
+        if (used + sep + 2 >= cap) break;
+        if (!payloadLog.nextInBatch(backlogBatch + used + sep, cap - used - sep - 1, &recLen)) break;
+        if (sep) backlogBatch[used] = ',';
+        used += sep + recLen;
+        count++;
+    }
+    if (count == 0) return 0;
+    backlogBatch[used++] = ']';
+    backlogBatch[used] = '\0';
 
-    return payloadOut.length() > 0;
+    if (!sendMQTTMessage(backlogBatch, mqtt_backlog_topic, false, MQTT_TAG_BACKLOG)) return 0;
+    backlogInFlight = true;   // committed by onMqttDelivered()
+    return count;
 }
 
-void clearPayloadFromBuffer(int index) {
-    char key[8];
-    sprintf(key, "buf%d", index);
+void drainBacklogTick() {
+    if (backlogInFlight) return;
+    if (payloadLog.pending() == 0 || !mqttLink.connected()) {
+        drainIntervalMs = DRAIN_INTERVAL_MIN_MS;
+        return;
+    }
+    if (millis() - lastDrainMs < drainIntervalMs) return;
+    lastDrainMs = millis();
 
-    preferences.begin("buffer", false);
-    preferences.remove(key);
-    preferences.end();
+    uint16_t sent = publishBacklogBatch();
+    if (sent) {
+        Serial.printf("Backlog: queued %u records, %lu pending\n", sent, (unsigned long)payloadLog.pending());
+    } else {
+        drainIntervalMs = min(drainIntervalMs * 2, RETRY_INTERVAL);
+        Serial.printf("Backlog: publish failed, backing off to %lu ms\n", drainIntervalMs);
+    }
 }
 
-int getIndex(const char *key) {
-    preferences.begin("bufidx", true);
-    int index = preferences.getInt(key, 0);
-    preferences.end();
-    return index;
+void onBacklogDelivered() {
+    if (!backlogInFlight) return;
+    payloadLog.commitBatch();
+    payloadLog.commit();
+    backlogInFlight = false;
+    drainIntervalMs = max(drainIntervalMs / 2, DRAIN_INTERVAL_MIN_MS);
+    Serial.printf("Backlog: batch delivered, %lu pending, next in %lu ms\n",
+                  (unsigned long)payloadLog.pending(), drainIntervalMs);
 }
 
-void setIndex(const char *key, int value) {
-    preferences.begin("bufidx", false);
-    preferences.putInt(key, value);
-    preferences.end();
+// === Flow History ===
+// Per-tick pulse counts in flash (flowHistory.h), written from the
+// COMMS_HISTORY_TICK messages the safety side posts every tick.
+void flowHistorySetup() {
+    for (uint8_t i = 0; i < FLOW_CHANNEL_COUNT; i++) {
+        flowHistory[i].begin();
+        Serial.printf("Flow history %u: %lu of %lu bytes, oldest tick %lu\n", i,
+                      (unsigned long)flowHistory[i].bytesUsed(), (unsigned long)flowHistory[i].capacityBytes(),
+                      (unsigned long)flowHistory[i].oldestEpoch());
+    }
 }
 
-// === Retry Buffer ===
-void retryUnsentPayloads() {
-    int tail = getIndex("tail");
-    int head = getIndex("head");
-
-    while (tail != head) {
-        String payload;
-        if (loadPayloadFromBuffer(tail, payload)) {
-            Serial.printf("Retrying buf%d: %s\n", tail, payload.c_str());
-            if (sendMQTTMessage(payload.c_str())) {
-                clearPayloadFromBuffer(tail);
-                setIndex("tail", (tail + 1) % BUFFER_SIZE);
-                tail = getIndex("tail");
-            } else {
-                break;
-            }
-        } else {
-            clearPayloadFromBuffer(tail);
-            setIndex("tail", (tail + 1) % BUFFER_SIZE);
-            tail = getIndex("tail");
-        }
+// get_history on a channel's cmdSend:
+//   {"cmd":"get_history","from":<epoch>,"to":<epoch>,"id":"<tag>"}
+// ("to" defaults to now) streams the stored ticks in [from, to) on
+// <channel>/history, not retained, QoS 1, one message in flight at a time:
+//   {"id":"<tag>","seq":0,"t0":<epoch>,"dt":10,"p":[pulses,...],"n":<count>,
+//    "next":<epoch>,"done":false}
+// p[i] is the pulse count of the tick starting at t0 + i * dt. A message
+// ends at MQTT_BUFFER_SIZE or at a gap in the data (reboot, clock change),
+// and the next one carries its own t0. To resume after a lost connection
+// or a reboot, request again with "from" set to the last "next" received.
+// A new request replaces the running one.
+#define HISTORY_MAX_SAMPLES 600    // per message; 600 idle ticks are ~1.2 KB of JSON
+#define HISTORY_ID_LEN 24
+
+bool historyActive = false;
+bool historyInFlight = false;
+uint8_t historyChannel = 0;
+uint32_t historyNext = 0, historyTo = 0;
+uint16_t historySeq = 0;
+uint32_t historySamplesSent = 0;
+char historyId[HISTORY_ID_LEN] = "";
+static uint16_t historySamples[HISTORY_MAX_SAMPLES];
+static char historyBatch[MQTT_BUFFER_SIZE];
+
+void startHistoryStream(uint8_t channel, JsonDocument &req) {
+    uint32_t now = getEpoch();
+    uint32_t from = req["from"] | 0UL;
+    uint32_t to = req["to"] | (unsigned long)now;
+    if (now && to > now) to = now;
+    if (from == 0 || to <= from) {
+        sendAck(channel, "get_history", "bad_range");
+        return;
     }
+
+    flowHistory[channel].flush();   // the open chunk becomes readable
+    historyActive = true;
+    historyChannel = channel;
+    historyNext = from;
+    historyTo = to;
+    historySeq = 0;
+    historySamplesSent = 0;
+    copyField(historyId, sizeof(historyId), req["id"] | "");
+    Serial.printf("History: streaming %lu..%lu (id %s)\n", (unsigned long)from, (unsigned long)to, historyId);
+    sendAck(channel, "get_history", "received");
 }
 
+void historyStreamTick() {
+    if (!historyActive || historyInFlight || !mqttLink.connected()) return;
+
+    uint32_t t0 = historyNext;
+    uint16_t n = flowHistory[historyChannel].read(historyNext, historyTo, historySamples, HISTORY_MAX_SAMPLES, &t0);
+
+    // Room for the tail: ],"n":65535,"next":4294967295,"done":false}
+    const size_t tailRoom = 48;
+    size_t cap = sizeof(historyBatch) - tailRoom;
+    int used = snprintf(historyBatch, cap, "{\"id\":\"%s\",\"seq\":%u,\"t0\":%lu,\"dt\":%lu,\"p\":[",
+                        historyId, historySeq, (unsigned long)t0, (unsigned long)ChannelHistory::Plan::tickSec);
+    uint16_t k = 0;
+    for (; k < n; k++) {
+        int w = snprintf(historyBatch + used, cap - used, k ? ",%u" : "%u", historySamples[k]);
+        if (w < 0 || (size_t)(used + w) >= cap) break;
+        used += w;
+    }
+    uint32_t next = k ? t0 + k * ChannelHistory::Plan::tickSec : historyTo;
+    bool done = next >= historyTo;
+    snprintf(historyBatch + used, sizeof(historyBatch) - used, "],\"n\":%u,\"next\":%lu,\"done\":%s}",
+             k, (unsigned long)next, done ? "true" : "false");
+
+    // Outbox full: the same range is read again next pass
+    if (!mqttLink.publish(channelTopics[historyChannel].history.c_str(), historyBatch, false, 1, MQTT_TAG_HISTORY)) return;
+    historyInFlight = true;
+    historyNext = next;
+    historySeq++;
+    historySamplesSent += k;
+    if (done) {
+        historyActive = false;
+        Serial.printf("History: %lu ticks in %u messages (id %s)\n",
+                      (unsigned long)historySamplesSent, historySeq, historyId);
+    }
+}
 
+// === Delivery Callback ===
+void onMqttDelivered(uint8_t tag) {
+    switch (tag) {
+        case MQTT_TAG_BACKLOG: onBacklogDelivered(); break;
+        case MQTT_TAG_HISTORY: historyInFlight = false; break;
+    }
+}
 
 
-// === Flow Data Publishing ===
-void sendBigData(float volumeTotalSend,
-                  String timeStamp) {
-    StaticJsonDocument<512> doc;
-    doc["max10s_fl"] = max10Sec;
-    doc["max1m_fl"] = max1Min;
-    doc["max10m_fl"] = max10Min;
-    doc["total_fl"] = volumeTotalSend;
-    doc["volAll"] = volumeAll;
-    doc["max10sTimeStamp"] = max10SecTime;
-    doc["max1mTimeStamp"] = max1MinTime;
-    doc["max10mTimeStamp"] = max10MinTime;
-    doc["timeStamp"] = timeStamp;
-    doc["valveStatusDom"] = valveClosed;
-    doc["valveModeDom"] = statusMonitor;
 
+
+// === Telemetry Encoding ===
+// JSON keeps the long keys and DateTimeMin strings on flowData/simpleFlowData.
+// MessagePack goes to the parallel ".../mp" topics with short keys and
+// integer epochs (0 = clock not synced):
+//   simple: f flow10s, fa flow30s, vc valveClosed, rt runTime, vm valveMode,
+//           va volAll, w warning, rj rejEdges, ns netStallMs, nw nvsWrites,
+//           lk leakLevel, t epoch
+//   hourly: m10s/m1m/m10m max flows, t10s/t1m/t10m their epochs, vh hour
+//           volume, va volAll, t hour start, vc, vm, rj, mp minPerUs,
+//           h flow histogram counts, hb gpm of one pulse per tick,
+//           ss/sx simpleFlowData sent/suppressed this hour
+// The histogram ("hist"/"h") counts ticks per flow bin: bin 0 = no flow,
+// bin k = [2^(k-1), 2^k) pulses per tick, i.e. from hb * 2^(k-1) gpm.
+// The offline backlog always stores JSON. With more than one flow channel the
+// JSON hourly report also carries "channel" (its name), since the backlog
+// topic is shared by the board.
+#define TELEMETRY_JSON     0   // JSON only
+#define TELEMETRY_BOTH     1   // JSON + MessagePack
+#define TELEMETRY_MSGPACK  2   // MessagePack only for live data
+
+#ifndef TELEMETRY_ENCODING
+#define TELEMETRY_ENCODING TELEMETRY_JSON
+#endif
+
+size_t encodeHourJson(uint8_t channel, const HourFlowReport &r, char *out, size_t len) {
+    char max10sStamp[20], max1mStamp[20], max10mStamp[20];
+    formatEpoch(r.max10sEpoch, max10sStamp, sizeof(max10sStamp));
+    formatEpoch(r.max1mEpoch, max1mStamp, sizeof(max1mStamp));
+    formatEpoch(r.max10mEpoch, max10mStamp, sizeof(max10mStamp));
+
+    jsonTxArena.reset();
+    JsonDocument doc(&jsonTxArena);
+    doc["max10s_fl"] = r.max10s;
+    doc["max1m_fl"] = r.max1m;
+    doc["max10m_fl"] = r.max10m;
+    doc["total_fl"] = r.volumeHour;
+    doc["volAll"] = r.volumeAll;
+    doc["max10sTimeStamp"] = max10sStamp;
+    doc["max1mTimeStamp"] = max1mStamp;
+    doc["max10mTimeStamp"] = max10mStamp;
+    doc["timeStamp"] = r.timeStamp;
+    doc["valveStatusDom"] = r.valveClosed;
+    doc["valveModeDom"] = r.valveMode;
+    doc["rejEdges"] = r.rejEdges;
+    doc["minPerUs"] = r.minPerUs;
+    doc["histBase"] = r.histBaseGpm;
+    doc["simpleSent"] = r.simpleSent;
+    doc["simpleSkipped"] = r.simpleSuppressed;
+    JsonArray hist = doc["hist"].to<JsonArray>();
+    for (uint8_t i = 0; i < FLOW_HIST_BINS; i++) hist.add(r.hist[i]);
+#if FLOW_CHANNEL_COUNT > 1
+    doc["channel"] = flowChannelConfigs[channel].name;
+#else
+    (void)channel;
+#endif
+    return serializeJson(doc, out, len);
+}
+
+size_t encodeHourMsgPack(const HourFlowReport &r, uint8_t *out, size_t len) {
+    jsonTxArena.reset();
+    JsonDocument doc(&jsonTxArena);
+    doc["m10s"] = r.max10s;
+    doc["m1m"] = r.max1m;
+    doc["m10m"] = r.max10m;
+    doc["t10s"] = r.max10sEpoch;
+    doc["t1m"] = r.max1mEpoch;
+    doc["t10m"] = r.max10mEpoch;
+    doc["vh"] = r.volumeHour;
+    doc["va"] = r.volumeAll;
+    doc["t"] = r.startEpoch;
+    doc["vc"] = r.valveClosed;
+    doc["vm"] = r.valveMode;
+    doc["rj"] = r.rejEdges;
+    doc["mp"] = r.minPerUs;
+    doc["hb"] = r.histBaseGpm;
+    doc["ss"] = r.simpleSent;
+    doc["sx"] = r.simpleSuppressed;
+    JsonArray hist = doc["h"].to<JsonArray>();
+    for (uint8_t i = 0; i < FLOW_HIST_BINS; i++) hist.add(r.hist[i]);
+    return serializeMsgPack(doc, out, len);
+}
+
+// Stamped with the tick the values come from, not the time of sending:
+// one that waited in commsQueue or was held while MQTT was down keeps its time
+size_t encodeSimpleJson(const SimpleFlowSnapshot &snap, char *out, size_t len) {
+    char ts[20];
+    if (snap.epoch) formatEpoch(snap.epoch, ts, sizeof(ts));
+    else strcpy(ts, "pending");
+
+    jsonTxArena.reset();
+    JsonDocument doc(&jsonTxArena);
+    doc["flow10s"] = snap.flow10s;
+    doc["flow30s"] = snap.flowAvg;
+    doc["valveClosed"] = snap.valveClosed;
+    doc["runTime"] = snap.runTimeSec;
+    doc["valveMode"] = snap.valveMode;
+    doc["volAll"] = snap.volumeAll;
+    doc["warning"] = snap.warning;
+    doc["rejEdges"] = snap.rejEdges;
+    doc["netStallMs"] = netStallMaxMs;
+    doc["nvsWrites"] = snap.nvsWrites;
+    doc["leak"] = snap.leakLevel;
+    doc["timeStamp"] = ts;
+    return serializeJson(doc, out, len);
+}
+
+size_t encodeSimpleMsgPack(const SimpleFlowSnapshot &snap, uint8_t *out, size_t len) {
+    jsonTxArena.reset();
+    JsonDocument doc(&jsonTxArena);
+    doc["f"] = snap.flow10s;
+    doc["fa"] = snap.flowAvg;
+    doc["vc"] = snap.valveClosed;
+    doc["rt"] = snap.runTimeSec;
+    doc["vm"] = snap.valveMode;
+    doc["va"] = snap.volumeAll;
+    doc["w"] = snap.warning;
+    doc["rj"] = snap.rejEdges;
+    doc["ns"] = netStallMaxMs;
+    doc["nw"] = snap.nvsWrites;
+    doc["lk"] = snap.leakLevel;
+    doc["t"] = snap.epoch;
+    return serializeMsgPack(doc, out, len);
+}
+
+bool publishPacked(const char *topic, const uint8_t *payload, size_t len, bool retained, uint8_t qos) {
+    if (!mqttLink.connected()) return false;
+    bool ok = mqttLink.publish(topic, payload, len, retained, qos);
+    Serial.printf("[MQTT] MsgPack %u bytes -> %s %s\n", (unsigned)len, topic, ok ? "queued" : "failed");
+    if (ok) noteFirstPublish();
+    return ok;
+}
+
+// === Flow Data Publishing ===
+void sendBigData(uint8_t channel, const HourFlowReport &r) {
+    const ChannelTopics &topics = channelTopics[channel];
     char payload[512];
-    if (serializeJson(doc, payload, sizeof(payload)) == 0) {
+    if (encodeHourJson(channel, r, payload, sizeof(payload)) == 0) {
         Serial.println("FlowData serialization failed");
         return;
     }
 
-    Serial.println("[MQTT] Sending FlowData:");
-    serializeJsonPretty(doc, Serial);
-    Serial.println();
+    // Echo the already-serialized buffer instead of serializing a second time
+    Serial.printf("[MQTT] Sending FlowData: %s\n", payload);
 
-    if (!sendMQTTMessage(payload)) {
+#if TELEMETRY_ENCODING != TELEMETRY_JSON
+    uint8_t packed[256];
+    size_t packedLen = encodeHourMsgPack(r, packed, sizeof(packed));
+    bool packedSent = packedLen > 0 && publishPacked(topics.fullflowMp.c_str(), packed, packedLen, true, 1);
+#endif
+
+#if TELEMETRY_ENCODING == TELEMETRY_MSGPACK
+    if (!packedSent) {
+#else
+    if (!sendMQTTMessage(payload, topics.fullflow.c_str())) {
+#endif
         savePayloadToBuffer(payload);
     }
 }
 
 // === Simple Flow Data ===
-void sendSimpleData(int warning) {
-    if (!isWifiReady()) { Serial.println("SimpleFlow skipped: no WiFi."); return; }
-
-
-    StaticJsonDocument<384> doc;
-    doc["flow10s"] = flow10s;
-    doc["flow30s"] = flowAvgValue;
-    doc["valveClosed"] = valveClosed;
-    doc["runTime"] = waterRunDurSec;
-    doc["valveMode"] = statusMonitor;
-    doc["volAll"] = volumeAll;
-    doc["warning"] = warning;
-
-    String ts = getTimeString("DateTimeMin");
-    if (ts.startsWith("0000")) ts = "pending";  // or omit the field
-    doc["timeStamp"] = ts;
-
+void sendSimpleData(uint8_t channel, const SimpleFlowSnapshot &snap) {
+    const ChannelTopics &topics = channelTopics[channel];
+
+    // QoS 0: a newer snapshot replaces this one, so only the latest is kept while offline
+    if (!isWifiReady() || !mqttLink.connected()) {
+        simpleLatest[channel] = snap;
+        simpleUnsent[channel] = true;
+        Serial.println("SimpleFlow send deferred: MQTT not connected.");
+        return;
+    }
 
+#if TELEMETRY_ENCODING != TELEMETRY_MSGPACK
     char payload[384];
-    if (serializeJson(doc, payload, sizeof(payload)) == 0) {
+    if (encodeSimpleJson(snap, payload, sizeof(payload)) == 0) {
         Serial.println("SimpleFlow serialization failed");
         return;
     }
+    Serial.printf("[MQTT] Sending SimpleFlowData: %s\n", payload);
+#endif
 
-    Serial.println("[MQTT] Sending SimpleFlowData:");
-    serializeJsonPretty(doc, Serial);
-    Serial.println();
-
-    connectToMQTT();
-    bool inStartup = (bootMillis != 0) && (millis() - bootMillis < MQTT_STARTUP_GRACE_MS);
+#if TELEMETRY_ENCODING != TELEMETRY_JSON
+    uint8_t packed[128];
+    size_t packedLen = encodeSimpleMsgPack(snap, packed, sizeof(packed));
+    if (packedLen > 0) publishPacked(topics.simpleflowMp.c_str(), packed, packedLen, true, 0);
+#endif
 
-    // During startup, only require connection (skip the publish cooldown)
-    // After startup, keep your normal cooldown guard
-    if (!mqttClient.connected() || (!inStartup && (millis() - lastMQTTPublishFail < mqttPublishRetryDelayMS))) {
-        Serial.println("SimpleFlow send skipped due to connection or throttle.");
-        return;
+#if TELEMETRY_ENCODING != TELEMETRY_MSGPACK
+    if (!mqttLink.publish(topics.simpleflow.c_str(), payload, true, 0)) {
+        Serial.println("SimpleFlow publish failed: outbox full.");
+    } else {
+        Serial.println("SimpleFlow MQTT message queued.");
+        noteFirstPublish();
     }
+#endif
+}
 
+// === Loop Diagnostics ===
+// One message per stage on .../diagnostics (not retained, never backlogged):
+//   {"task":"safety","stage":"flow","periodS":600,"n":..,"minUs":..,
+//    "maxUs":..,"p99Us":..,"hist":[16 counts]}
+// hist bins are log2 microseconds as in loopProfiler.h. The safety task
+// relays its stats through the queue; the comms task publishes its own
+// right after the last safety stage, so both cover the same period.
+void sendStageStats(const char *task, const char *stage, uint32_t periodMs, const StageStats &s) {
+    Serial.printf("[DIAG] %s/%s n=%lu min=%luus max=%luus p99<=%luus\n", task, stage,
+                  (unsigned long)s.count, (unsigned long)s.minOrZero(),
+                  (unsigned long)s.maxUs, (unsigned long)s.p99Us());
+    if (!mqttLink.connected()) return;
+
+    jsonTxArena.reset();
+    JsonDocument doc(&jsonTxArena);
+    doc["task"] = task;
+    doc["stage"] = stage;
+    doc["periodS"] = periodMs / 1000;
+    doc["n"] = s.count;
+    doc["minUs"] = s.minOrZero();
+    doc["maxUs"] = s.maxUs;
+    doc["p99Us"] = s.p99Us();
+    JsonArray hist = doc["hist"].to<JsonArray>();
+    for (uint8_t i = 0; i < STAGE_HIST_BINS; i++) hist.add(s.hist[i]);
+
+    char payload[320];
+    if (serializeJson(doc, payload, sizeof(payload)) == 0) return;
+    mqttLink.publish(mqtt_diag_topic, payload, false, 0);
+}
 
-    if (!mqttClient.publish(mqtt_simpleflow_topic, payload, true)) {
-        Serial.println("SimpleFlow publish failed.");
-        lastMQTTPublishFail = millis();
+// === Memory Health ===
+// Sampled by the comms task (memoryTick() in main.cpp). Limits leave room
+// for the MQTT buffer, a WiFi reconnect and the largest JSON/stack frames.
+const MemConfig memConfig = {
+    24576,   // minFreeHeap bytes
+    8192,    // minBlock bytes
+    80,      // fragWarnPct
+    1024,    // minStackFree bytes
+    10       // recoverPct
+};
+MemHealth memHealth(memConfig);
+uint8_t memAlarmsUnsent = MEM_NONE;   // raised but not yet taken by the warning queue
+
+// One warning per call, queued below valve and leak warnings
+// (WARN_PRIO_MEMORY): they go out first, and a full queue drops memory
+// alarms before them. Anything the queue refuses is retried on the next
+// sample while still active.
+void handleMemAlarms(uint8_t fresh) {
+    memAlarmsUnsent = (memAlarmsUnsent | fresh) & memHealth.active();
+    if (!memAlarmsUnsent) return;
+
+    const MemSample &s = memHealth.latest();
+    char msg[96];
+    uint8_t bits;
+    const char *level = "1";
+    const char *title;
+    if (memAlarmsUnsent & MEM_LOW_STACK) {
+        bits = MEM_LOW_STACK;
+        level = "2";
+        title = "Low Stack";
+        snprintf(msg, sizeof(msg), "Stack headroom loop %lu / comms %lu bytes",
+                 (unsigned long)s.loopStackFree, (unsigned long)s.commsStackFree);
+    } else if (memAlarmsUnsent & MEM_LOW_HEAP) {
+        bits = MEM_LOW_HEAP;
+        level = "2";
+        title = "Low Memory";
+        snprintf(msg, sizeof(msg), "Free heap %lu bytes (lowest ever %lu)",
+                 (unsigned long)s.freeHeap, (unsigned long)s.minFreeHeap);
     } else {
-        Serial.println("SimpleFlow MQTT message sent.");
+        bits = MEM_SMALL_BLOCK | MEM_FRAGMENTED;
+        title = "Heap Fragmented";
+        snprintf(msg, sizeof(msg), "Largest free block %lu of %lu bytes free (%u%% fragmented)",
+                 (unsigned long)s.maxBlock, (unsigned long)s.freeHeap, (unsigned)s.fragPct());
+    }
+    WarningMsg w;
+    copyField(w.level, sizeof(w.level), level);
+    copyField(w.title, sizeof(w.title), title);
+    copyField(w.message, sizeof(w.message), msg);
+    w.priority = WARN_PRIO_MEMORY;
+    if (queueWarning(w, WARN_BOARD)) memAlarmsUnsent &= ~bits;
+}
+
+// Worst values of the period on .../diagnostics, plus the JSON pool peaks:
+//   {"task":"memory","periodS":600,"samples":..,"freeHeap":..,"minFreeHeap":..,
+//    "maxBlock":..,"fragPct":..,"loopStack":..,"commsStack":..,"alarms":..,
+//    "rxArena":..,"txArena":..,"arenaOverflows":..}
+void sendMemoryStats(uint32_t periodMs) {
+    if (memHealth.periodSamples() == 0) return;
+    const MemSample &w = memHealth.periodWorst();
+    uint32_t loopStack = w.loopStackFree == UINT32_MAX ? 0 : w.loopStackFree;
+    uint32_t commsStack = w.commsStackFree == UINT32_MAX ? 0 : w.commsStackFree;
+    Serial.printf("[DIAG] memory free>=%lu block>=%lu frag<=%u%% stack>=%lu/%lu\n",
+                  (unsigned long)w.freeHeap, (unsigned long)w.maxBlock,
+                  (unsigned)memHealth.periodPeakFragPct(), (unsigned long)loopStack, (unsigned long)commsStack);
+    if (!mqttLink.connected()) return;
+
+    jsonTxArena.reset();
+    JsonDocument doc(&jsonTxArena);
+    doc["task"] = "memory";
+    doc["periodS"] = periodMs / 1000;
+    doc["samples"] = memHealth.periodSamples();
+    doc["freeHeap"] = w.freeHeap;
+    doc["minFreeHeap"] = w.minFreeHeap;
+    doc["maxBlock"] = w.maxBlock;
+    doc["fragPct"] = memHealth.periodPeakFragPct();
+    doc["loopStack"] = loopStack;
+    doc["commsStack"] = commsStack;
+    doc["alarms"] = memHealth.active();
+    doc["rxArena"] = jsonRxArena.highWaterMark();
+    doc["txArena"] = jsonTxArena.highWaterMark();
+    doc["arenaOverflows"] = jsonRxArena.overflows() + jsonTxArena.overflows();
+
+    char payload[320];
+    if (serializeJson(doc, payload, sizeof(payload)) == 0) return;
+    mqttLink.publish(mqtt_diag_topic, payload, false, 0);
+}
+
+// === Boot Diagnostics ===
+// Once per boot, right after the first telemetry publish (bootTiming.h):
+//   {"task":"boot","reset":<esp_reset_reason_t>,"safetyMs":..,"firstSampleMs":..,
+//    "wifiMs":..,"timeMs":..,"mqttMs":..,"firstPublishMs":..}
+// 0 = milestone not reached (e.g. no NTP yet).
+void sendBootStats() {
+    if (bootTiming.reported || !mqttLink.connected()) return;
+    bootTiming.reported = true;
+    Serial.printf("[BOOT] safety %lu ms, first sample %lu ms, wifi %lu ms, time %lu ms, mqtt %lu ms, first publish %lu ms\n",
+                  (unsigned long)bootTiming.safetyMs, (unsigned long)bootTiming.firstSampleMs,
+                  (unsigned long)bootTiming.wifiMs, (unsigned long)bootTiming.timeMs,
+                  (unsigned long)bootTiming.mqttMs, (unsigned long)bootTiming.firstPublishMs);
+
+    jsonTxArena.reset();
+    JsonDocument doc(&jsonTxArena);
+    doc["task"] = "boot";
+    doc["reset"] = (int)esp_reset_reason();
+    doc["safetyMs"] = bootTiming.safetyMs;
+    doc["firstSampleMs"] = bootTiming.firstSampleMs;
+    doc["wifiMs"] = bootTiming.wifiMs;
+    doc["timeMs"] = bootTiming.timeMs;
+    doc["mqttMs"] = bootTiming.mqttMs;
+    doc["firstPublishMs"] = bootTiming.firstPublishMs;
+
+    char payload[192];
+    if (serializeJson(doc, payload, sizeof(payload)) == 0) return;
+    mqttLink.publish(mqtt_diag_topic, payload, false, 1);
+}
+
+// Payloads are serialized before they are published, so the tx arena is free here
+void noteFirstPublish() {
+    if (bootTiming.reported) return;
+    markBoot(bootTiming.firstPublishMs);
+    sendBootStats();
+}
+
+void sendCommsStageStats() {
+    uint32_t periodMs = commsProfile.periodMs();
+    for (uint8_t i = 0; i < COMMS_STAGE_COUNT; i++)
+        sendStageStats("comms", commsStageNames[i], periodMs, commsProfile.stats(i));
+    sendMemoryStats(periodMs);
+    commsProfile.reset();
+    memHealth.resetPeriod();
+}
+
+void handleStageStats(const StageStatsMsg &m) {
+    if (m.stage < SAFETY_STAGE_COUNT)
+        sendStageStats("safety", safetyStageNames[m.stage], m.periodMs, m.stats);
+    if (m.last) sendCommsStageStats();
+}
+
+// === Safety -> Comms Drain ===
+// Runs on the comms task; publishes whatever the safety side queued.
+void handleCommsMsg(const CommsMsg &m) {
+    if (m.channel >= FLOW_CHANNEL_COUNT) return;
+    switch (m.type) {
+        case COMMS_SIMPLE_DATA: sendSimpleData(m.channel, m.simple); break;
+        case COMMS_BIG_DATA:    sendBigData(m.channel, m.hour); break;
+        case COMMS_WARNING:
+            queueWarning(m.warning, m.channel);
+            break;
+        case COMMS_ACK:         sendAck(m.channel, m.ack.cmd, m.ack.status); break;
+        case COMMS_STAGE_STATS: handleStageStats(m.stage); break;
+        case COMMS_HISTORY_TICK: flowHistory[m.channel].add(m.tick.epoch, m.tick.pulses); break;
     }
 }
 
+void drainCommsQueue() {
+    CommsMsg m;
+    while (commsQueue.pop(m)) handleCommsMsg(m);
+}
+
 // === MQTT Auto Reconnect ===
 void reconnectIfNeeded() {
-    if (isWifiReady() && !mqttClient.connected()) connectToMQTT();
+    if (isWifiReady() && mqttLink.state() == MQTT_LINK_DOWN) connectToMQTT();
 }
 
 
 // Build a unique ID using client id + random + time
-static String buildWarningID() {
-    char rnd[9];
-    snprintf(rnd, sizeof(rnd), "%08lx", (unsigned long)esp_random());
-    return String(MQTT_CLIENT_ID) + "-" + String(rnd) + "-" + getTimeString("DateTimeMin");
+static void buildWarningID(char *out, size_t len) {
+    char ts[20];
+    formatTimeNow(ts, sizeof(ts));
+    snprintf(out, len, "%s-%08lx-%s", MQTT_CLIENT_ID, (unsigned long)esp_random(), ts);
 }
 
-// One-shot publish; sets pending state for retry-on-no-ACK
-bool sendWarning(const char *wLevel, const char *wMessage, const char *wTitle) {
-    connectToMQTT();
-    if (!mqttClient.connected()) {
-        Serial.println("[WARN] MQTT not connected; cannot send warning.");
-        return false;
-    }
+// === Pending Warning Shadow ===
+void shadowWarningQueue() {
+    warningShadow.save(warningQueue.state());
+}
 
-    // if a previous warning still pending, don't overwrite—retry loop will handle it
-    if (pendingWarnID.length() > 0) {
-        Serial.println("[WARN] Previous warning still awaiting ACK; skipping new send.");
+// Warm restart: pick up the unacknowledged warnings; they go again as soon
+// as MQTT is connected (processWarningAckTick)
+void restorePendingWarnings() {
+    WarningQueueState st;
+    if (!warningShadow.load(st) || !warningQueue.restore(st) || warningQueue.size() == 0) return;
+    Serial.printf("[WARN] %u pending warning(s) restored from RTC memory\n", warningQueue.size());
+}
+
+// Queue a warning for delivery; processWarningAckTick() publishes it and
+// retries until the consumer ACKs. False if the queue had no room for it.
+bool queueWarning(const WarningMsg &w, uint8_t channel) {
+    PendingWarning e;
+    memset(&e, 0, sizeof(e));
+    buildWarningID(e.id, sizeof(e.id));
+    formatTimeNow(e.timeStamp, sizeof(e.timeStamp));
+    e.msg = w;
+    e.channel = channel;
+    e.priority = w.priority;
+
+    if (!warningQueue.push(e)) {
+        Serial.printf("[WARN] Warning queue full; dropped \"%s\".\n", w.title);
         return false;
     }
+    shadowWarningQueue();
+    Serial.printf("[WARN] Warning queued (wID=%s, %u pending).\n", e.id, warningQueue.size());
+    return true;
+}
 
-    String wID = buildWarningID();
-
-    StaticJsonDocument<384> doc;
-    doc["wLevel"] = wLevel;        // e.g. "info", "warn", "crit"
-    doc["wMessage"] = wMessage;    // human-readable description
-    doc["wTitle"] = wTitle;        // short title
-    doc["wID"] = wID;              // unique id to match ACK
-    doc["client"] = MQTT_CLIENT_ID;
-    doc["timeStamp"] = getTimeString("DateTimeMin");
-
-    char payload[384];
+// One QoS 1 publish of a queued warning; the payload is rebuilt from the
+// entry each time, so a resend is identical to the first send
+static bool publishWarning(const PendingWarning &e) {
+    jsonTxArena.reset();
+    JsonDocument doc(&jsonTxArena);
+    doc["wLevel"] = e.msg.level;        // e.g. "info", "warn", "crit"
+    doc["wMessage"] = e.msg.message;    // human-readable description
+    doc["wTitle"] = e.msg.title;        // short title
+    doc["wID"] = e.id;                  // unique id to match ACK
+    doc["client"] = e.channel < FLOW_CHANNEL_COUNT ? flowChannelConfigs[e.channel].name : MQTT_CLIENT_ID;
+    doc["timeStamp"] = e.timeStamp;
+
+    char payload[WARN_PAYLOAD_LEN];
     if (serializeJson(doc, payload, sizeof(payload)) == 0) {
         Serial.println("[WARN] Warning JSON serialization failed.");
         return false;
     }
-
-    bool ok = mqttClient.publish(mqtt_warning_topic, payload, false);
-    if (!ok) {
-        Serial.print("[WARN] Publish failed. State: ");
-        Serial.println(mqttClient.state());
-        return false;
-    }
-
-    // Track pending for ACK
-    pendingWarnID = wID;
-    pendingWarnPayload = payload;
-    pendingWarnSentAt = millis();
-    pendingWarnRetries = 0;
-
-    Serial.printf("[WARN] Warning sent (wID=%s). Awaiting ACK...\n", pendingWarnID.c_str());
-    return true;
+    return mqttLink.publish(mqtt_warning_topic, payload, false, 1);
 }
 
-// Call this frequently (e.g., from your main loop) to enforce the ACK timeout & retry
+// Call this frequently: sends new warnings and resends those whose ACK
+// timed out, in queue order, while the link can take them
 void processWarningAckTick() {
-    if (pendingWarnID.length() == 0) return; // nothing pending
+    if (warningQueue.size() == 0 || !mqttLink.connected()) return;
 
-    unsigned long elapsed = millis() - pendingWarnSentAt;
-    if (elapsed < WARN_ACK_TIMEOUT_MS) return;
-
-    if (!mqttClient.connected()) connectToMQTT();
-
-    if (pendingWarnRetries >= WARN_MAX_RETRIES) {
-        Serial.printf("[WARN] No ACK after %d retries (wID=%s). Giving up.\n",
-                      WARN_MAX_RETRIES, pendingWarnID.c_str());
-        // Clear pending so future warnings can proceed
-        pendingWarnID = "";
-        pendingWarnPayload = "";
-        pendingWarnRetries = 0;
-        return;
+    bool changed = false;
+    unsigned long now = millis();
+    for (uint8_t i = 0; i < warningQueue.size(); i++) {
+        if (!warningQueue.isDue(i, now)) continue;
+        const PendingWarning &e = warningQueue.at(i);
+        bool retry = e.sent;
+        if (!publishWarning(e)) break;   // outbox full: the rest wait for the next tick
+        warningQueue.markSent(i, now);
+        changed = true;
+        if (retry)
+            Serial.printf("[WARN] No ACK yet; resent wID=%s (retry %u, next in %lu s)\n",
+                          e.id, e.retries, WarningQueue::ackTimeout(e.retries) / 1000);
+        else
+            Serial.printf("[WARN] Warning published (wID=%s). Awaiting ACK...\n", e.id);
     }
-
-    // Retry
-    bool ok = mqttClient.publish(mqtt_warning_topic, pendingWarnPayload.c_str(), false);
-    pendingWarnRetries++;
-    pendingWarnSentAt = millis();
-    Serial.printf("[WARN] Retrying warning send (attempt %d of %d) wID=%s ok=%d\n",
-                  pendingWarnRetries, WARN_MAX_RETRIES, pendingWarnID.c_str(), ok);
+    if (changed) shadowWarningQueue();
 }
 
 // Process an ACK message from Node-RED (or other consumer)
-void handleWarningAck(const String &msg) {
-    StaticJsonDocument<256> ack;
-    if (deserializeJson(ack, msg)) {
+void handleWarningAck(const byte *payload, unsigned int length) {
+    jsonRxArena.reset();
+    JsonDocument ack(&jsonRxArena);
+    if (deserializeJson(ack, payload, length)) {
         Serial.println("[WARN] Failed to parse warning ACK JSON.");
         return;
     }
@@ -480,24 +1055,14 @@ void handleWarningAck(const String &msg) {
     const char *status = ack["status"] | "unknown";
     const char *receiver = ack["receiver"] | "n/a";
 
-    if (pendingWarnID.length() == 0) {
-        Serial.println("[WARN] Received ACK but no warning was pending.");
+    if (!warningQueue.ack(ackID)) {
+        Serial.printf("[WARN] ACK for wID=%s matches no pending warning. Ignoring.\n", ackID);
         return;
     }
 
-    if (pendingWarnID != String(ackID)) {
-        Serial.printf("[WARN] ACK wID mismatch (expected %s, got %s). Ignoring.\n",
-                      pendingWarnID.c_str(), ackID);
-        return;
-    }
-
-    Serial.printf("[WARN] ACK received for wID=%s status=%s receiver=%s\n",
-                  ackID, status, receiver);
-
-    // Clear pending now that we've confirmed delivery
-    pendingWarnID = "";
-    pendingWarnPayload = "";
-    pendingWarnRetries = 0;
+    Serial.printf("[WARN] ACK received for wID=%s status=%s receiver=%s (%u still pending)\n",
+                  ackID, status, receiver, warningQueue.size());
+    shadowWarningQueue();
 }
 
 
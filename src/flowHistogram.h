@@ -0,0 +1,44 @@
+#ifndef MY_FLOWHISTOGRAM_H
+#define MY_FLOWHISTOGRAM_H
+
+#include <Arduino.h>
+
+// ==================================
+// === Log-scaled Histogram =========
+// ==================================
+// Fixed-size counts of integer samples (pulses per tick). Bin 0 holds zero
+// samples; bin k >= 1 holds values in [2^(k-1), 2^k), and the last bin also
+// takes everything above. Memory is Bins counters however long it runs.
+template <uint8_t Bins, typename CountT = uint16_t>
+class LogHistogram {
+  static_assert(Bins >= 2 && Bins <= 33, "LogHistogram needs 2..33 bins");
+
+public:
+  LogHistogram() { reset(); }
+
+  void reset() { memset(counts, 0, sizeof(counts)); }
+
+  void add(uint32_t value) {
+    uint8_t bin = binOf(value);
+    if (counts[bin] != (CountT)~(CountT)0) counts[bin]++;   // saturate
+  }
+
+  static uint8_t binOf(uint32_t value) {
+    if (value == 0) return 0;
+    uint8_t bin = 32 - __builtin_clz(value);
+    return bin < Bins ? bin : Bins - 1;
+  }
+
+  // Smallest value counted in a bin
+  static uint32_t lowerBound(uint8_t bin) { return bin == 0 ? 0 : 1UL << (bin - 1); }
+
+  uint8_t size() const { return Bins; }
+  CountT count(uint8_t bin) const { return counts[bin]; }
+  const CountT *data() const { return counts; }
+  void assign(const CountT *src) { memcpy(counts, src, sizeof(counts)); }
+
+private:
+  CountT counts[Bins];
+};
+
+#endif
@@ -0,0 +1,343 @@
+#ifndef MY_FLOWHISTORY_H
+#define MY_FLOWHISTORY_H
+
+#include <Arduino.h>
+#include <stdio.h>
+#include "crc32.h"
+#include "samplingConfig.h"
+
+// ==================================
+// === Per-tick Flow History ========
+// ==================================
+// Every tick's pulse count, kept in flash for weeks so the server can fetch
+// fine-grained data it missed. Samples are buffered in RAM as one chunk of
+// consecutive ticks and written as a single framed record (header + CRC)
+// when the chunk fills, every FLOW_HISTORY_FLUSH_TICKS, or at a gap in time.
+// Chunks are appended to FLOW_HISTORY_PAGES page files used as a ring; when
+// the active page is full the oldest one is truncated and reused.
+//
+// Chunk body: one varint token per change. (zigzag(pulses - previous) << 1)
+// is a tick whose count differs from the previous tick, (n << 1) | 1 is n
+// more ticks with the same count. The previous count starts at 0 in every
+// chunk, so a chunk decodes on its own and an idle hour is a few bytes.
+// Tick i of a chunk is at startEpoch + i * tickSec.
+//
+// Same stdio approach as payloadLog.h: LittleFS on the ESP32, a plain
+// directory on Linux. Used by the comms task only.
+
+#ifndef FLOW_HISTORY_PAGES
+#define FLOW_HISTORY_PAGES 64            // per channel
+#endif
+#define FLOW_HISTORY_PAGE_BYTES  4096UL  // one flash sector per page, 256 KB per channel
+#define FLOW_HISTORY_CHUNK_BYTES 240     // encoded bytes per chunk, at most
+
+template <typename Config>
+class FlowHistory {
+public:
+  typedef SamplingPlan<Config> Plan;
+
+  // Unflushed ticks lost to a crash, at most
+  static constexpr uint16_t flushTicks = Plan::hourTicks / 6;
+
+  FlowHistory(const char *dir, uint8_t channel) : dir(dir), channel(channel) {}
+
+  // Scan all pages and rebuild the in-RAM page index
+  void begin() {
+    active = 0;
+    nextSeq = 1;
+    uint32_t maxSeq = 0;
+    for (uint8_t i = 0; i < FLOW_HISTORY_PAGES; i++) {
+      scanPage(i);
+      if (pages[i].seq > maxSeq) { maxSeq = pages[i].seq; active = i; }
+    }
+    nextSeq = maxSeq + 1;
+    resetChunk();
+  }
+
+  // One tick; epoch is when its interval began (0 = clock never synced, dropped)
+  void add(uint32_t epoch, uint16_t pulses) {
+    if (epoch == 0) return;
+    if (ticks && (!onGrid(epoch, chunkStart + ticks * Plan::tickSec) ||
+                  len + 2 * VARINT_MAX > FLOW_HISTORY_CHUNK_BYTES)) flush();
+    if (ticks == 0) chunkStart = epoch;
+
+    if (pulses == prev) {
+      run++;
+    } else {
+      putRun();
+      int32_t delta = (int32_t)pulses - (int32_t)prev;
+      putVarint(zigzag(delta) << 1);
+      prev = pulses;
+    }
+    if (++ticks >= flushTicks) flush();
+  }
+
+  // Write the open chunk, so read() sees every tick added so far
+  void flush() {
+    if (ticks == 0) return;
+    putRun();
+    if (!writeChunk()) failedCount++;
+    resetChunk();
+  }
+
+  // The first run of consecutive ticks at or after fromEpoch and before
+  // toEpoch: up to maxCount counts into out, the first tick's epoch into
+  // *firstEpoch. Stops at a gap in time; returns 0 when nothing is left.
+  uint16_t read(uint32_t fromEpoch, uint32_t toEpoch, uint16_t *out, uint16_t maxCount, uint32_t *firstEpoch) {
+    uint16_t count = 0;
+    uint32_t expect = 0;   // epoch of the tick that would continue the run
+    for (uint8_t hop = 1; hop <= FLOW_HISTORY_PAGES; hop++) {
+      uint8_t slot = (active + hop) % FLOW_HISTORY_PAGES;   // oldest first
+      const PageInfo &p = pages[slot];
+      if (p.bytes <= sizeof(PageHeader) || p.endEpoch <= fromEpoch) continue;
+
+      char path[48];
+      pagePath(slot, path, sizeof(path));
+      FILE *f = fopen(path, "rb");
+      if (!f) continue;
+      fseek(f, sizeof(PageHeader), SEEK_SET);
+      ChunkHeader h;
+      for (uint32_t off = sizeof(PageHeader); off < p.bytes; off += sizeof(h) + h.len) {
+        if (!readChunk(f, h, rbuf)) break;
+        uint32_t end = h.startEpoch + h.ticks * Plan::tickSec;
+        if (count == 0 && end <= fromEpoch) continue;
+        if (count && !onGrid(h.startEpoch, expect)) { fclose(f); return count; }
+
+        uint16_t value = 0, i = 0;
+        for (uint16_t at = 0; at < h.len && i < h.ticks; ) {
+          uint32_t token;
+          if (!getVarint(rbuf, h.len, at, token)) break;
+          uint32_t repeat = 1;
+          if (token & 1) repeat = token >> 1;
+          else value = (uint16_t)(value + unzigzag(token >> 1));
+          for (; repeat && i < h.ticks; repeat--, i++) {
+            uint32_t t = h.startEpoch + i * Plan::tickSec;
+            if (count == 0 && t + Plan::tickSec / 2 < fromEpoch) continue;
+            if (t >= toEpoch || count == maxCount) { fclose(f); return count; }
+            if (count == 0) *firstEpoch = t;
+            out[count++] = value;
+          }
+        }
+        expect = end;
+      }
+      fclose(f);
+    }
+    return count;
+  }
+
+  // Oldest tick still stored, 0 if none
+  uint32_t oldestEpoch() const {
+    for (uint8_t hop = 1; hop <= FLOW_HISTORY_PAGES; hop++) {
+      const PageInfo &p = pages[(active + hop) % FLOW_HISTORY_PAGES];
+      if (p.bytes > sizeof(PageHeader)) return p.firstEpoch;
+    }
+    return 0;
+  }
+
+  uint32_t bytesUsed() const {
+    uint32_t n = 0;
+    for (uint8_t i = 0; i < FLOW_HISTORY_PAGES; i++) n += pages[i].bytes;
+    return n;
+  }
+  uint32_t capacityBytes() const { return FLOW_HISTORY_PAGES * FLOW_HISTORY_PAGE_BYTES; }
+  uint32_t chunksWritten() const { return writtenCount; }
+  uint32_t chunksFailed() const { return failedCount; }
+
+private:
+  static const uint16_t PAGE_MAGIC = 0x4846;   // "FH"
+  static const uint16_t CHUNK_MAGIC = 0x4B43;  // "CK"
+  static const uint8_t VERSION = 1;
+  static const uint8_t VARINT_MAX = 5;
+
+  struct __attribute__((packed)) PageHeader {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t tickSec;
+    uint32_t seq;      // increases with every page started
+  };
+
+  struct __attribute__((packed)) ChunkHeader {
+    uint16_t magic;
+    uint16_t len;      // encoded bytes
+    uint16_t ticks;
+    uint16_t reserved;
+    uint32_t startEpoch;
+    uint32_t crc;      // over header (crc = 0) + body
+  };
+
+  struct PageInfo {
+    uint32_t seq;      // 0 = empty
+    uint32_t firstEpoch, endEpoch;
+    uint32_t bytes;    // valid bytes, page header included
+    bool torn;
+  };
+
+  const char *dir;
+  const uint8_t channel;
+  PageInfo pages[FLOW_HISTORY_PAGES];
+  uint8_t active;
+  uint32_t nextSeq;
+  uint32_t writtenCount = 0, failedCount = 0;
+
+  // Open chunk
+  uint8_t buf[FLOW_HISTORY_CHUNK_BYTES];
+  uint8_t rbuf[FLOW_HISTORY_CHUNK_BYTES];   // read() decode buffer
+  uint16_t len, ticks, prev;
+  uint32_t run, chunkStart;
+
+  void pagePath(uint8_t slot, char *out, size_t outLen) const {
+    snprintf(out, outLen, "%s/fh%u_%u.bin", dir, (unsigned)channel, (unsigned)slot);
+  }
+
+  static uint32_t zigzag(int32_t v) { return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31); }
+  static int32_t unzigzag(uint32_t v) { return (int32_t)(v >> 1) ^ -(int32_t)(v & 1); }
+
+  // Within half a tick: the tick timer runs a little long, so epochs drift
+  static bool onGrid(uint32_t epoch, uint32_t expected) {
+    int32_t d = (int32_t)(epoch - expected);
+    return d >= -(int32_t)(Plan::tickSec / 2) && d <= (int32_t)(Plan::tickSec / 2);
+  }
+
+  static uint32_t chunkCrc(ChunkHeader h, const uint8_t *body) {
+    h.crc = 0;
+    return crc32Update(crc32(&h, sizeof(h)), body, h.len);
+  }
+
+  void resetChunk() {
+    len = ticks = prev = 0;
+    run = 0;
+    chunkStart = 0;
+  }
+
+  void putVarint(uint32_t v) {
+    while (v >= 0x80) {
+      buf[len++] = (uint8_t)(v | 0x80);
+      v >>= 7;
+    }
+    buf[len++] = (uint8_t)v;
+  }
+
+  void putRun() {
+    if (run == 0) return;
+    putVarint((run << 1) | 1);
+    run = 0;
+  }
+
+  static bool getVarint(const uint8_t *in, uint16_t inLen, uint16_t &at, uint32_t &v) {
+    v = 0;
+    for (uint8_t shift = 0; at < inLen && shift < 7 * VARINT_MAX; shift += 7) {
+      uint8_t b = in[at++];
+      v |= (uint32_t)(b & 0x7F) << shift;
+      if (!(b & 0x80)) return true;
+    }
+    return false;
+  }
+
+  // Header + body at the file position, CRC checked
+  static bool readChunk(FILE *f, ChunkHeader &h, uint8_t *body) {
+    return fread(&h, 1, sizeof(h), f) == sizeof(h) && h.magic == CHUNK_MAGIC &&
+           h.len <= FLOW_HISTORY_CHUNK_BYTES && fread(body, 1, h.len, f) == h.len &&
+           chunkCrc(h, body) == h.crc;
+  }
+
+  void scanPage(uint8_t slot) {
+    PageInfo &p = pages[slot];
+    p.seq = p.firstEpoch = p.endEpoch = p.bytes = 0;
+    p.torn = false;
+
+    char path[48];
+    pagePath(slot, path, sizeof(path));
+    FILE *f = fopen(path, "rb");
+    if (!f) return;
+
+    PageHeader ph;
+    if (fread(&ph, 1, sizeof(ph), f) != sizeof(ph) || ph.magic != PAGE_MAGIC ||
+        ph.version != VERSION || ph.tickSec != Plan::tickSec) {
+      fclose(f);   // foreign or stale layout: reused when its turn comes
+      return;
+    }
+    p.seq = ph.seq;
+    p.bytes = sizeof(ph);
+
+    ChunkHeader h;
+    for (;;) {
+      int c = fgetc(f);
+      if (c == EOF) break;
+      ungetc(c, f);
+      if (!readChunk(f, h, rbuf)) {
+        p.torn = true;   // never append after a partial chunk
+        break;
+      }
+      if (p.bytes == sizeof(ph)) p.firstEpoch = h.startEpoch;
+      uint32_t end = h.startEpoch + h.ticks * Plan::tickSec;
+      if (end > p.endEpoch) p.endEpoch = end;
+      p.bytes += sizeof(h) + h.len;
+    }
+    fclose(f);
+  }
+
+  // Truncate the slot and give it the next sequence number
+  bool startPage(uint8_t slot) {
+    PageInfo &p = pages[slot];
+    p.seq = p.firstEpoch = p.endEpoch = p.bytes = 0;
+    p.torn = false;
+    active = slot;
+
+    PageHeader ph;
+    ph.magic = PAGE_MAGIC;
+    ph.version = VERSION;
+    ph.tickSec = Plan::tickSec;
+    ph.seq = nextSeq;
+
+    char path[48];
+    pagePath(slot, path, sizeof(path));
+    FILE *f = fopen(path, "wb");
+    if (!f) return false;
+    bool ok = fwrite(&ph, 1, sizeof(ph), f) == sizeof(ph);
+    ok = (fclose(f) == 0) && ok;
+    if (!ok) {
+      p.torn = true;
+      return false;
+    }
+    p.seq = nextSeq++;
+    p.bytes = sizeof(ph);
+    return true;
+  }
+
+  bool writeChunk() {
+    ChunkHeader h;
+    h.magic = CHUNK_MAGIC;
+    h.len = len;
+    h.ticks = ticks;
+    h.reserved = 0;
+    h.startEpoch = chunkStart;
+    h.crc = chunkCrc(h, buf);
+
+    PageInfo *p = &pages[active];
+    if (p->torn || p->bytes == 0 || p->bytes + sizeof(h) + len > FLOW_HISTORY_PAGE_BYTES) {
+      uint8_t slot = (p->bytes == 0 && !p->torn) ? active : (active + 1) % FLOW_HISTORY_PAGES;
+      if (!startPage(slot)) return false;
+      p = &pages[active];
+    }
+
+    char path[48];
+    pagePath(active, path, sizeof(path));
+    FILE *f = fopen(path, "ab");
+    if (!f) return false;
+    bool ok = fwrite(&h, 1, sizeof(h), f) == sizeof(h) && fwrite(buf, 1, len, f) == len;
+    ok = (fclose(f) == 0) && ok;
+    if (!ok) {
+      p->torn = true;
+      return false;
+    }
+
+    if (p->bytes == sizeof(PageHeader)) p->firstEpoch = chunkStart;
+    uint32_t end = chunkStart + ticks * Plan::tickSec;
+    if (end > p->endEpoch) p->endEpoch = end;
+    p->bytes += sizeof(h) + len;
+    writtenCount++;
+    return true;
+  }
+};
+
+#endif
@@ -3,62 +3,260 @@
 
 #include <Preferences.h>
 #include "espMqtt.h"
-
-// === Pins ===
-#define FLOW_SENSOR_PIN    25
-#define VALVE_RELAY        4
-#define BUTTON_MODE_PIN    32
-#define BUTTON_VALVE_PIN   33
+#include "channelConfig.h"
+#include "pulseSource.h"
+#include "nvsJournal.h"
+#include "rtcShadow.h"
+#include "flowStats.h"
+#include "leakDetector.h"
+#include "reportFilter.h"
+#include "bootTiming.h"
 
 // === Flow & Timing Configuration ===
-const unsigned int pulseDebounceUs = 200000;
-const int sendFlowTimeMs = 10000;
-const int updateFlowTimeMs = 10000;
-const float calibrationFactor = 10.0; ////pulse/Gal
+const unsigned int pulseDebounceUs = 200000;  // max (slow-meter) debounce window
+const unsigned int maxMeterHz = 50;            // fastest legitimate pulse rate, bounds adaptive debounce
+const uint16_t pcntFilterApbCycles = 1023;  // ~12.8 us hardware glitch filter
+// Tick, send period and meter calibration: see samplingConfig.h
+typedef SamplingPlan<FLOW_SAMPLING> Sampling;
 const unsigned long waterRunMinSec = 15;
 /// @brief {manual, Home, Away}
 const int waterRunMaxSec[3] = {0, 600, 300};
-const int maxIntervals = 3600 / (updateFlowTimeMs / 1000);
-const float galPerMinFactor = 60.0 / (updateFlowTimeMs / 1000);
+const LeakConfig leakConfig = {
+    300,            // quietSec: 5 min without pulses counts as flow stopping
+    6 * 3600UL,     // continuousWarnSec: no such quiet interval for 6 h
+    24 * 3600UL,    // continuousCritSec: ... for 24 h
+    3.0f, 10.0f,    // hour alert: volume > 3x that hour's baseline + 10 gal
+    4.0f, 20.0f,    // run alert: volume > 4x typical run + 20 gal
+    waterRunMinSec, // runGapSec
+    7,              // minSamples: a week of each hour before hour alerts
+    3               // ewmaShift: 1/8 weight
+};
+// simpleFlowData is sent on transitions, on a change past these deadbands,
+// or as a heartbeat (reportFilter.h). One pulse per tick is gpmPerPulse.
+const ReportConfig simpleReportConfig = {
+    {Sampling::gpmPerPulse, 0.15f},  // flow10s: ignore a one-pulse wobble and <15% drift
+    {Sampling::gpmPerPulse, 0.15f},  // flowAvg
+    120,                             // runTimeStepSec
+    1800000UL                        // heartbeatMs: 30 min
+};
 #define VALVE_CYCLE_TIMEOUT 40000
 #define VALVE_CYCLE_DELAY   10000
+const unsigned long VALVE_TIMED_CLOSE_MAX_MS = 86400000UL;  // 24 h
+
+// === Pulse Input ===
+#if PULSE_SOURCE == PULSE_SOURCE_PCNT
+typedef PcntPulseSource FlowPulseSource;
+#elif PULSE_SOURCE == PULSE_SOURCE_SIM
+typedef SimPulseSource FlowPulseSource;
+#else
+typedef IsrPulseSource FlowPulseSource;
+#endif
 
-// === State Variables ===
-bool valveClosed = false;
-int statusMonitor = 1; // 0: manual, 1: home, 2: away
-
-// === Flow Tracking ===
-volatile unsigned long pulseCount = 0;
-volatile unsigned long lastPulseTime = 0;
-float flowSamples[maxIntervals] = {0};
-String minuteStamps[maxIntervals] = {""};
-String minuteStampsPrevious = "";
-float flowAvg[6] = {0};
-float flow10s = 0, lastFlow10s = 0;
-float flowAvgValue = 0, lastFlowAvgValue = 0;
-int sampleIndex = 0, flowAvgIndex = 0;
-// Warn once per sustained-run event
-bool warnActive = false;
-
-
-// === Time Tracking ===
-unsigned long waterRunDurSec = 0, lastWaterRunDurSec = 0, waterStopDurSec = 0;
-unsigned long timerUpdateCheckMs = 0, timerSendFlowCheckMs = 0;
-bool waterRun = false;
-int oldHour = 0, oldDay = 0, oldMin = 0;
-int lastValveClosed = 3, LastStatusMonitor = 4;
-String oldTimeStamp = getTimeString("DateTimeMin");
-
-// === Max Flow Volumes ===
-float max1Min = 0, max10Sec = 0, max10Min = 0, max30Min = 0;
-String max1MinTime = "", max10SecTime = "", max10MinTime = "", max30MinTime = "";
-
-// === Volume Tracking ===
-float volumeHour = 0.0, volumeMin = 0.0, volumeDay = 0.0, volumeAll = 0.0;
-bool volumeNeedsSave = false;
-unsigned long lastVolumeSave = 0;
+// === Preferences Storage ===
+// Everything that survives a reboot, written as one journaled blob per
+// channel. Bump PERSIST_VERSION when the layout changes.
+struct __attribute__((packed)) PersistedState {
+    float volHour, volMin, volDay, volAll;
+    int32_t oldHour, oldDay;
+    uint32_t hourStartEpoch;
+    uint32_t reserved;      // v1 stored sampleStartEpoch here; always 0 now
+    char oldTimeStamp[TIME_STR_LEN];
+    int32_t statusMonitor;
+    uint8_t valveClosed;
+};
+#define PERSIST_VERSION 1
+
+// === RTC Shadow ===
+// The live state, written to RTC memory every tick (rtcShadow.h). After a
+// watchdog, panic or ESP.restart() it is restored instead of the journal,
+// which can be up to volumeSaveInterval behind, and also brings back the
+// run timer, the hour's peaks, the leak detector and any post still
+// waiting for room in the comms queue. Bump
+// LIVE_STATE_VERSION when the layout changes.
+struct __attribute__((packed)) LiveState {
+    PersistedState saved;
+    uint32_t waterRunDurSec, waterStopDurSec;
+    uint8_t waterRun, warnActive;
+    int32_t oldMin;
+    uint32_t pulseRejectedHour, pulseRejectedTotal, pulseMinPeriodUs;
+    FlowStats<FLOW_SAMPLING>::HourSummary hour;
+    LeakState leak;
+    uint8_t shutoffUnposted, hourUnposted;
+    WarningMsg unpostedShutoff;
+    HourFlowReport unpostedHour;
+};
+#define LIVE_STATE_VERSION 2
+typedef RtcShadow<LiveState, LIVE_STATE_VERSION> LiveShadow;
+RTC_NOINIT_ATTR LiveShadow::Slots liveShadowMem[FLOW_CHANNEL_COUNT];
+
+// === Persistence Scheduling ===
+// Routine volume updates are coalesced to one write per volumeSaveInterval;
+// mode/valve changes are written urgentSaveDelayMs after the last change so
+// a burst of button presses costs one flash write. A warm restart recovers
+// the unsaved part from the RTC shadow; a power cut loses at most this much.
 const unsigned long volumeSaveInterval = 60000;
-int warningAlert = 0;
+const unsigned long urgentSaveDelayMs = 2000;
+
+// === Valve Sequencer ===
+// Timed sequences (cycle, timed close) run from tickValveSequence() in loop()
+// so the MQTT callback returns immediately and nothing blocks for the hold.
+enum ValveSeqState { VALVE_SEQ_IDLE, VALVE_SEQ_HOLD_CLOSED };
+
+struct ValveSequence {
+    ValveSeqState state;
+    const char *cmd;          // command name used for acks
+    unsigned long startMs;
+    unsigned long holdMs;     // closed time before reopening
+};
+
+// ==================================
+// === Flow Channel =================
+// ==================================
+// One meter and its valve: sampling, statistics, volumes, valve logic and
+// persistence. flowCalcs() drives every channel from one shared tick.
+class FlowChannel {
+public:
+    FlowChannel(uint8_t index);
+
+    void begin();                                  // pins, pulse input, saved state
+    void tick(const TimeSnapshot &now, uint32_t pulseNow);
+    void sendIfChanged();
+    void logFlowStatus(long pulseCountNow);
+    bool saveIfDue();
+    void handleCommand(const ValveCmdMsg &vc);
+    void tickValveSequence();
+
+    void closeValve();
+    void openValve();
+    void toggleValve();
+    void setValveMode(int newMode);
+    void showModePixel();
+
+    uint8_t channel() const { return index; }
+    bool isValveClosed() const { return valveClosed; }
+    int mode() const { return statusMonitor; }
+    float volumeTotal() const { return volumeAll; }
+    float volumeThisHour() const { return volumeHour; }
+    uint32_t journalWrites() const { return stateJournal.writes(); }
+    const ReportFilter &simpleReports() const { return simpleReport; }
+
+    FlowPulseSource pulseInput;
+
+private:
+    const uint8_t index;
+    const FlowChannelConfig &cfg;
+
+    // === State Variables ===
+    bool valveClosed = false;
+    int statusMonitor = 1; // 0: manual, 1: home, 2: away
+
+    // Lost-pulse accounting: rejected edges and shortest period (this hour / since boot)
+    unsigned long pulseRejectedHour = 0, pulseRejectedTotal = 0;
+    unsigned long pulseMinPeriodUs = 0;
+
+    // === Flow Tracking ===
+    FlowStats<FLOW_SAMPLING> flowStats;
+    uint32_t sampleStartEpoch = 0;
+    float flow10s = 0;
+    float flowAvgValue = 0;
+    LeakDetector leakDetector;
+    ReportFilter simpleReport;
+    // Warn once per sustained-run event
+    bool warnActive = false;
+
+    // Posts the full comms queue refused, retried every tick until one
+    // goes through (retryUnposted): the shutoff warning and the hourly
+    // report must not be lost to a comms task that is behind
+    WarningMsg unpostedShutoff;
+    HourFlowReport unpostedHour;
+    bool shutoffUnposted = false, hourUnposted = false;
+    uint32_t postsLost = 0;   // hourly reports that found the slot taken
+
+    // === Time Tracking ===
+    unsigned long waterRunDurSec = 0, waterStopDurSec = 0;
+    bool waterRun = false;
+    int oldHour = 0, oldDay = 0, oldMin = 0;
+    char oldTimeStamp[TIME_STR_LEN] = "";
+    uint32_t hourStartEpoch;
+
+    // === Volume Tracking ===
+    float volumeHour = 0.0, volumeMin = 0.0, volumeDay = 0.0, volumeAll = 0.0;
+    int warningAlert = 0;
+
+    // === Persistence ===
+    bool volumeNeedsSave = false, saveUrgent = false;
+    bool legacyPrefsPending = false;   // imported, cleared once the journal holds them
+    unsigned long lastVolumeSave = 0, saveRequestMs = 0;
+    NvsJournal<PersistedState, PERSIST_VERSION> stateJournal;
+    LiveShadow liveShadow;
+
+    ValveSequence valveSeq = {VALVE_SEQ_IDLE, "", 0, 0};
+
+    void requestUrgentSave();
+    bool valveSequenceActive() const { return valveSeq.state != VALVE_SEQ_IDLE; }
+    bool startValveSequence(const char *cmd, unsigned long holdMs);
+    bool startValveCycle();
+    bool startTimedClose(unsigned long sec);
+    void cancelValveSequence();
+
+    void resetMaxValues();
+    void calculateFlowStats(unsigned long pulses, const TimeSnapshot &now);
+    void updateWaterState(long pulses, float volumeNowgal);
+    void handleValveLogic();
+    void updatePulseStats(const PulseStats &stats);
+    void postLeakAlerts(uint8_t alerts);
+    void postHourReport();
+    void retryUnposted();
+    void handleTimedEvents(const TimeSnapshot &now);
+
+    SimpleFlowSnapshot simpleSnapshot(int warning);
+    HourFlowReport hourReport();
+
+    PersistedState persistedState() const;
+    void applyPersistedState(const PersistedState &st);
+    void shadowLiveState();
+    bool restoreLiveState(const PersistedState *journal);
+
+    bool loadLegacyPrefs();
+    void clearLegacyPrefs();
+    void loadVolumeFromPrefs();
+    void saveVolumeToPrefs();
+};
+
+FlowChannel::FlowChannel(uint8_t index)
+#if PULSE_SOURCE == PULSE_SOURCE_PCNT
+    : pulseInput(flowChannelConfigs[index].sensorPin, pcntFilterApbCycles, (pcnt_unit_t)(PCNT_UNIT_0 + index)),
+#elif PULSE_SOURCE == PULSE_SOURCE_SIM
+    : pulseInput(maxMeterHz, pulseDebounceUs),
+#else
+    : pulseInput(flowChannelConfigs[index].sensorPin, maxMeterHz, pulseDebounceUs),
+#endif
+      index(index),
+      cfg(flowChannelConfigs[index]),
+      leakDetector(leakConfig, Sampling::tickSec),
+      simpleReport(simpleReportConfig),
+      hourStartEpoch(getEpoch()),
+      stateJournal(flowChannelConfigs[index].nvsNamespace),
+      liveShadow(liveShadowMem[index]) {
+}
+
+// Channel 0 is the board's original meter; see channelConfig.h
+FlowChannel flowChannels[FLOW_CHANNEL_COUNT] = {
+    {0},
+#if FLOW_CHANNEL_COUNT > 1
+    {1},
+#endif
+#if FLOW_CHANNEL_COUNT > 2
+    {2},
+#endif
+#if FLOW_CHANNEL_COUNT > 3
+    {3},
+#endif
+};
+
+// === Shared Tick Timing ===
+unsigned long timerUpdateCheckMs = 0, timerSendFlowCheckMs = 0;
+TimeSnapshot tickTime;   // captured once per flowCalcs() tick, shared by all channels
 
 // === Button Debounce ===
 const unsigned long debounceDelay = 50;
@@ -68,118 +266,131 @@ unsigned long buttonModePressStart = 0, buttonModeLastDebounceTime = 0;
 bool buttonValveState = HIGH, buttonValveLastReading = HIGH, buttonValvePreviouslyPressed = false;
 unsigned long buttonValveLastDebounceTime = 0;
 
-// === Preferences Storage ===
-Preferences volumePrefs;
-
-// === Function Declarations ===
-void loadVolumeFromPrefs();
+Preferences volumePrefs;   // legacy per-key "flowvol" namespace, migration only
 
 
-// === Interrupt: Flow Pulse Counter ===
-void IRAM_ATTR pulseCounter() {
-    unsigned long now = micros();
-    if (now - lastPulseTime > pulseDebounceUs) {
-        pulseCount++;
-        lastPulseTime = now;
-    }
+// === Setup ===
+// valveRelaySetup() runs first, so the saved valve state is on the relay
+// before anything else at boot
+void FlowChannel::begin() {
+    pulseInput.begin();
+    loadVolumeFromPrefs();
+    digitalWrite(cfg.valvePin, valveClosed ? HIGH : LOW);
 }
 
-// === Setup ===
 void flowMeterSetup() {
     Serial.print("Initializing Flowmeter Monitoring...");
-    pinMode(FLOW_SENSOR_PIN, INPUT_PULLUP);
-    attachInterrupt(digitalPinToInterrupt(FLOW_SENSOR_PIN), pulseCounter, RISING);
     pinMode(BUTTON_MODE_PIN, INPUT_PULLUP);
     pinMode(BUTTON_VALVE_PIN, INPUT_PULLUP);
     Serial.println("Done");
-    loadVolumeFromPrefs();
+    for (uint8_t i = 0; i < FLOW_CHANNEL_COUNT; i++) flowChannels[i].begin();
 }
 
 void valveRelaySetup() {
-    pinMode(VALVE_RELAY, OUTPUT);
+    for (uint8_t i = 0; i < FLOW_CHANNEL_COUNT; i++) pinMode(flowChannelConfigs[i].valvePin, OUTPUT);
+}
+
+void FlowChannel::requestUrgentSave() {
+    volumeNeedsSave = true;
+    saveUrgent = true;
+    saveRequestMs = millis();
+    shadowLiveState();
 }
 
 // === Valve Control ===
-void closeValve() {
-    digitalWrite(VALVE_RELAY, HIGH);
-    Serial.println("!!! SHUT OFF WATER !!!");
+void FlowChannel::closeValve() {
+    digitalWrite(cfg.valvePin, HIGH);
+    Serial.printf("!!! SHUT OFF WATER (%s) !!!\n", cfg.label);
     valveClosed = true;
     warningAlert = 1;
-    showPixelColorEx(1, 255, 0, 0);
+    requestUrgentSave();
+    if (index == 0) showPixelColorEx(1, 255, 0, 0);
 }
 
-void openValve() {
-    digitalWrite(VALVE_RELAY, LOW);
-    Serial.println("Valve OPEN");
+void FlowChannel::openValve() {
+    digitalWrite(cfg.valvePin, LOW);
+    Serial.printf("Valve OPEN (%s)\n", cfg.label);
     valveClosed = false;
     waterRunDurSec = 0;
-    showPixelColorEx(1, 0, 255, 0);
+    requestUrgentSave();
+    if (index == 0) showPixelColorEx(1, 0, 255, 0);
 }
 
-void cycleValve() {
-    Serial.println("Starting valve cycle...");
-    unsigned long startTime = millis();
+void FlowChannel::toggleValve() {
+    cancelValveSequence();
+    valveClosed ? openValve() : closeValve();
+}
+
+// === Valve Sequencer ===
+// Close now, reopen after holdMs. Returns false if a sequence is already running.
+bool FlowChannel::startValveSequence(const char *cmd, unsigned long holdMs) {
+    if (valveSequenceActive()) return false;
+    Serial.printf("Starting valve sequence %s (%lu ms)...\n", cmd, holdMs);
     closeValve();
-    while (millis() - startTime < VALVE_CYCLE_DELAY) {
-        delay(100);
-        if (millis() - startTime > VALVE_CYCLE_TIMEOUT) {
-            Serial.println("Cycle timeout before reopening valve!");
-            sendAck("cycle_valve", "timeout_before_open");
-            return;
-        }
-    }
-    openValve();
-    if (millis() - startTime > VALVE_CYCLE_TIMEOUT) {
-        Serial.println("Cycle timeout after reopening valve!");
-        sendAck("cycle_valve", "timeout_after_open");
-        return;
-    }
-    sendAck("cycle_valve", "completed");
+    valveSeq.state = VALVE_SEQ_HOLD_CLOSED;
+    valveSeq.cmd = cmd;
+    valveSeq.startMs = millis();
+    valveSeq.holdMs = holdMs;
+    return true;
 }
 
-// === Flow & Volume Processing ===
-void resetMaxValues() {
-    memset(flowSamples, 0, sizeof(flowSamples));
-    for (int i = 0; i < maxIntervals; i++) minuteStamps[i] = "";
-    sampleIndex = 0;
-    max1Min = max10Sec = max10Min = max30Min = 0;
-    max1MinTime = max10SecTime = max10MinTime = max30MinTime = "";
-}
-
-void updateMax(float *maxVol, String *maxTime, int numSamples, int index) {
-    if (numSamples > index + 1) return;
-    float sum = 0;
-    for (int i = index + 1 - numSamples; i <= index; i++) sum += flowSamples[i];
-    float avg = sum / numSamples;
-    if (avg > *maxVol) {
-        *maxVol = avg;
-        *maxTime = minuteStamps[index - numSamples + 1];
-    }
+bool FlowChannel::startValveCycle() {
+    return startValveSequence("cycle_valve", VALVE_CYCLE_DELAY);
 }
 
-void updateVolumes(int index) {
-    updateMax(&max1Min, &max1MinTime, 60 / (updateFlowTimeMs / 1000), index);
-    updateMax(&max10Sec, &max10SecTime, 10 / (updateFlowTimeMs / 1000), index);
-    updateMax(&max10Min, &max10MinTime, 600 / (updateFlowTimeMs / 1000), index);
-    updateMax(&max30Min, &max30MinTime, 1800 / (updateFlowTimeMs / 1000), index);
+bool FlowChannel::startTimedClose(unsigned long sec) {
+    if (sec == 0 || sec > VALVE_TIMED_CLOSE_MAX_MS / 1000UL) return false;
+    return startValveSequence("timed_close", sec * 1000UL);
 }
 
+// Manual open/close overrides any running sequence
+void FlowChannel::cancelValveSequence() {
+    if (!valveSequenceActive()) return;
+    Serial.printf("Valve sequence %s cancelled.\n", valveSeq.cmd);
+    postAck(index, valveSeq.cmd, "cancelled");
+    valveSeq.state = VALVE_SEQ_IDLE;
+}
+
+void FlowChannel::tickValveSequence() {
+    if (valveSeq.state != VALVE_SEQ_HOLD_CLOSED) return;
+
+    unsigned long elapsed = millis() - valveSeq.startMs;
+    if (elapsed < valveSeq.holdMs) return;
+
+    // Same slack the blocking cycle allowed between delay and timeout
+    unsigned long timeoutMs = valveSeq.holdMs + (VALVE_CYCLE_TIMEOUT - VALVE_CYCLE_DELAY);
+    valveSeq.state = VALVE_SEQ_IDLE;
+    if (elapsed > timeoutMs) {
+        Serial.println("Valve sequence timeout before reopening valve!");
+        postAck(index, valveSeq.cmd, "timeout_before_open");
+        return;
+    }
+    openValve();
+    postAck(index, valveSeq.cmd, "completed");
+}
 
-void calculateFlowStats(float volumeNowgal) {
-    flowSamples[sampleIndex] = flowAvg[flowAvgIndex] = volumeNowgal * galPerMinFactor;
-    minuteStamps[sampleIndex] = minuteStampsPrevious;
-    minuteStampsPrevious = getTimeString("DateTimeMin");
-    updateVolumes(sampleIndex);
-    sampleIndex = (sampleIndex + 1) % maxIntervals;
+void tickValveSequence() {
+    for (uint8_t i = 0; i < FLOW_CHANNEL_COUNT; i++) flowChannels[i].tickValveSequence();
+}
 
-    flowAvgValue = 0;
-    for (int i = 0; i < 3; i++) flowAvgValue += flowAvg[i];
-    flowAvgValue /= 3;
-    flowAvgIndex = (flowAvgIndex + 1) % 3;
+// === Flow & Volume Processing ===
+void FlowChannel::resetMaxValues() {
+    flowStats.resetHour();
+    simpleReport.resetHour();
+    pulseRejectedHour = 0;
+    pulseMinPeriodUs = 0;
 }
 
-void updateWaterState(long pulses, float volumeNowgal) {
-    long deltaSec = updateFlowTimeMs / 1000;
+void FlowChannel::calculateFlowStats(unsigned long pulses, const TimeSnapshot &now) {
+    uint16_t tickPulses = pulses > 0xFFFF ? 0xFFFF : (uint16_t)pulses;
+    flowStats.add(tickPulses, sampleStartEpoch);
+    postHistoryTick(index, sampleStartEpoch, tickPulses);
+    sampleStartEpoch = now.epoch;
+    flowAvgValue = flowStats.flowAvgGpm();
+}
+
+void FlowChannel::updateWaterState(long pulses, float volumeNowgal) {
+    long deltaSec = Sampling::tickSec;
     if (pulses > 0) {
         waterRunDurSec += deltaSec;
         waterStopDurSec = 0;
@@ -200,7 +411,7 @@ void updateWaterState(long pulses, float volumeNowgal) {
     }
 }
 
-void handleValveLogic() {
+void FlowChannel::handleValveLogic() {
     if (statusMonitor < 0 || statusMonitor > 2) statusMonitor = 1;
 
     // Only trigger when NOT manual, valve is open, and run duration exceeded limit
@@ -209,13 +420,17 @@ void handleValveLogic() {
         if (!warnActive) {
             closeValve();  // sets valveClosed=true and warningAlert=1
 
-            String msgTemp;
-            msgTemp  = "Sustained Flow on Domestic Line of more than ";
-            msgTemp += waterRunMaxSec[statusMonitor];
-            msgTemp += " Seconds";
+            char msgTemp[96], title[32];
+            snprintf(msgTemp, sizeof(msgTemp), "Sustained Flow on %s Line of more than %d Seconds",
+                     cfg.label, waterRunMaxSec[statusMonitor]);
+            snprintf(title, sizeof(title), "%s Shutoff", cfg.label);
 
             // Level 1 = warning; adjust as you like ("info","warn","crit")
-            sendWarning("1", msgTemp.c_str(), "Domestic Shutoff");
+            WarningMsg w = makeWarning("1", msgTemp, title, WARN_PRIO_VALVE);
+            if (!postWarning(index, w)) {
+                unpostedShutoff = w;
+                shutoffUnposted = true;
+            }
             warnActive = true;
         }
     } else {
@@ -228,77 +443,230 @@ void handleValveLogic() {
 }
 
 
-void handleTimedEvents() {
-    if (oldMin != getTimeInt("Minute")) {
-        volumeMin = 0;
-        oldMin = getTimeInt("Minute");
-        volumeNeedsSave = true;
-    }
+// === Report Snapshots (handed to the comms task by value) ===
+SimpleFlowSnapshot FlowChannel::simpleSnapshot(int warning) {
+    SimpleFlowSnapshot snap;
+    snap.flow10s = flow10s;
+    snap.flowAvg = flowAvgValue;
+    snap.volumeAll = volumeAll;
+    snap.runTimeSec = waterRunDurSec;
+    snap.rejEdges = pulseRejectedTotal;
+    snap.nvsWrites = stateJournal.writes();
+    snap.epoch = tickTime.epoch;
+    snap.leakLevel = leakDetector.level();
+    snap.valveMode = statusMonitor;
+    snap.warning = warning;
+    snap.valveClosed = valveClosed;
+    return snap;
+}
 
-    if (oldHour != getTimeInt("Hour")) {
-        sendBigData(volumeHour,oldTimeStamp);
-        oldTimeStamp = getTimeString("DateTimeMin");
-        volumeHour = 0;
-        oldHour = getTimeInt("Hour");
-        volumeNeedsSave = true;
-        resetMaxValues();
+HourFlowReport FlowChannel::hourReport() {
+    HourFlowReport r;
+    r.max10s = flowStats.peak10Sec().gpm;
+    r.max1m = flowStats.peak1Min().gpm;
+    r.max10m = flowStats.peak10Min().gpm;
+    r.volumeHour = volumeHour;
+    r.volumeAll = volumeAll;
+    r.max10sEpoch = flowStats.peak10Sec().epoch;
+    r.max1mEpoch = flowStats.peak1Min().epoch;
+    r.max10mEpoch = flowStats.peak10Min().epoch;
+    r.startEpoch = hourStartEpoch;
+    r.rejEdges = pulseRejectedHour;
+    r.minPerUs = pulseMinPeriodUs;
+    r.histBaseGpm = Sampling::gpmPerPulse;
+    r.simpleSent = simpleReport.sentThisHour();
+    r.simpleSuppressed = simpleReport.suppressedThisHour();
+    memcpy(r.hist, flowStats.histogram().data(), sizeof(r.hist));
+    r.valveMode = statusMonitor;
+    r.valveClosed = valveClosed;
+    copyField(r.timeStamp, sizeof(r.timeStamp), oldTimeStamp);
+    return r;
+}
+
+// === Leak Alerts ===
+// Graded: continuous-flow critical is level "2", everything else level "1"
+void FlowChannel::postLeakAlerts(uint8_t alerts) {
+    char msg[96];
+    if (alerts & LEAK_CONTINUOUS_CRIT) {
+        snprintf(msg, sizeof(msg), "Flow has not stopped for %lu h; likely leak",
+                 (unsigned long)(leakDetector.continuousFlowSec() / 3600));
+        postWarning(index, "2", msg, "Continuous Flow");
+    } else if (alerts & LEAK_CONTINUOUS_WARN) {
+        snprintf(msg, sizeof(msg), "No zero-flow interval for %lu h; possible trickle leak",
+                 (unsigned long)(leakDetector.continuousFlowSec() / 3600));
+        postWarning(index, "1", msg, "Continuous Flow");
+    }
+    if (alerts & LEAK_RUN_VOLUME) {
+        snprintf(msg, sizeof(msg), "Current run %.1f gal vs typical %.1f gal",
+                 leakDetector.runVolumeGal(), leakDetector.runBaselineGal());
+        postWarning(index, "1", msg, "Abnormal Run Volume");
+    }
+    if (alerts & LEAK_HOUR_VOLUME) {
+        snprintf(msg, sizeof(msg), "Hour %02d used %.1f gal vs typical %.1f gal",
+                 oldHour, volumeHour, leakDetector.hourBaselineGal(oldHour));
+        postWarning(index, "1", msg, "Abnormal Hourly Volume");
     }
+}
 
-    if (oldDay != getTimeInt("Day")) {
-        volumeDay = 0;
-        oldDay = getTimeInt("Day");
-        volumeNeedsSave = true;
+void FlowChannel::postHourReport() {
+    HourFlowReport r = hourReport();
+    if (postBigData(index, r)) return;
+    if (hourUnposted) {
+        postsLost++;
+        Serial.printf("[%s] Comms queue full for an hour; hourly report lost (%lu so far)\n",
+                      cfg.label, (unsigned long)postsLost);
+        return;
     }
+    unpostedHour = r;
+    hourUnposted = true;
+}
 
-    if (millis() - timerSendFlowCheckMs > sendFlowTimeMs) {
-        timerSendFlowCheckMs = millis();
-        if (flow10s != lastFlow10s || flowAvgValue != lastFlowAvgValue ||
-            waterRunDurSec != lastWaterRunDurSec || lastValveClosed != valveClosed ||
-            LastStatusMonitor != statusMonitor) {
-
-            lastFlow10s = flow10s;
-            lastFlowAvgValue = flowAvgValue;
-            lastWaterRunDurSec = waterRunDurSec;
-            lastValveClosed = valveClosed;
-            LastStatusMonitor = statusMonitor;
-            sendSimpleData(warningAlert);
-            warningAlert = 0;
+// Oldest first, so nothing posted this tick overtakes them
+void FlowChannel::retryUnposted() {
+    if (shutoffUnposted && postWarning(index, unpostedShutoff)) shutoffUnposted = false;
+    if (hourUnposted && postBigData(index, unpostedHour)) hourUnposted = false;
+}
+
+// Rollovers wait for a synced clock instead of firing on the -1 "no time" value
+void FlowChannel::handleTimedEvents(const TimeSnapshot &now) {
+    if (now.valid) {
+        int minute = timeField(now, TIME_MINUTE);
+        int hour = timeField(now, TIME_HOUR);
+        int day = timeField(now, TIME_DAY);
+
+        // oldMin is not persisted; only a non-zero minute volume dirties the state
+        if (oldMin != minute) {
+            if (volumeMin != 0) volumeNeedsSave = true;
+            volumeMin = 0;
+            oldMin = minute;
+        }
+
+        if (oldHour != hour) {
+            postLeakAlerts(leakDetector.endHour(oldHour, volumeHour));
+            postHourReport();
+            formatTime(now, TIME_FMT_DATE_TIME_MIN, oldTimeStamp, sizeof(oldTimeStamp));
+            hourStartEpoch = now.epoch;
+            volumeHour = 0;
+            oldHour = hour;
+            volumeNeedsSave = true;
+            resetMaxValues();
+        }
+
+        if (oldDay != day) {
+            volumeDay = 0;
+            oldDay = day;
+            volumeNeedsSave = true;
         }
     }
 }
 
-void logFlowStatus(long pulseCountNow, float volumeNowgal) {
-    Serial.printf("\nPulse Count: %ld\n", pulseCountNow);
+// A snapshot the queue refuses is not marked sent, so it goes on the next check
+void FlowChannel::sendIfChanged() {
+    SimpleFlowSnapshot snap = simpleSnapshot(warningAlert);
+    unsigned long now = millis();
+    ReportReason why = simpleReport.evaluate(snap, now);
+    if (why == REPORT_NONE || !postSimpleData(index, snap)) return;
+    simpleReport.sent(snap, now, why);
+    warningAlert = 0;
+}
+
+void FlowChannel::updatePulseStats(const PulseStats &stats) {
+    pulseRejectedHour += stats.rejectedEdges;
+    pulseRejectedTotal += stats.rejectedEdges;
+    if (stats.minPeriodUs && (pulseMinPeriodUs == 0 || stats.minPeriodUs < pulseMinPeriodUs))
+        pulseMinPeriodUs = stats.minPeriodUs;
+}
+
+void FlowChannel::logFlowStatus(long pulseCountNow) {
+    Serial.printf("\n[%s] Pulse Count: %ld | Rejected: %lu | Min Period: %lu us\n",
+                  cfg.label, pulseCountNow, pulseRejectedHour, pulseMinPeriodUs);
     Serial.printf("Flow10s: %.2f GPM | FlowAvg: %.2f GPM | VolumeHour: %.2f gal | VolumeAll: %.2f gal\n",
                   flow10s, flowAvgValue, volumeHour, volumeAll);
     Serial.printf("Running: %d | Time Run: %lu s | Stop: %lu s | ValveClosed: %d\n",
                   waterRun, waterRunDurSec, waterStopDurSec, valveClosed);
 }
 
+void FlowChannel::tick(const TimeSnapshot &now, uint32_t pulseNow) {
+    updatePulseStats(pulseInput.takeStats());
+
+    float volNowGal = pulseNow * Sampling::galPerPulse;
+    flow10s = pulseNow * Sampling::gpmPerPulse;
+
+    retryUnposted();
+    calculateFlowStats(pulseNow, now);
+    updateWaterState(pulseNow, volNowGal);
+    postLeakAlerts(leakDetector.tick(pulseNow, volNowGal));
+    handleValveLogic();
+    handleTimedEvents(now);
+    shadowLiveState();
+}
+
+// Returns true if a save was attempted
+bool FlowChannel::saveIfDue() {
+    if (!volumeNeedsSave) return false;
+    unsigned long now = millis();
+    if (saveUrgent ? now - saveRequestMs >= urgentSaveDelayMs
+                   : now - lastVolumeSave > volumeSaveInterval) {
+        saveVolumeToPrefs();
+        return true;
+    }
+    return false;
+}
+
+// All channels are read back to back at one shared tick, then processed,
+// so their samples cover the same interval and their reports go out together.
 void flowCalcs() {
-    if (millis() - timerUpdateCheckMs > updateFlowTimeMs) {
-        checkWiFiReconnect();
+    if (millis() - timerUpdateCheckMs > Sampling::tickMs) {
         timerUpdateCheckMs = millis();
+        uint32_t tickStart = safetyProfile.stamp();
+        captureTime(tickTime);
+
+        uint32_t pulseNow[FLOW_CHANNEL_COUNT];
+        for (uint8_t i = 0; i < FLOW_CHANNEL_COUNT; i++) pulseNow[i] = flowChannels[i].pulseInput.takeCount();
+        for (uint8_t i = 0; i < FLOW_CHANNEL_COUNT; i++) flowChannels[i].tick(tickTime, pulseNow[i]);
+        safetyProfile.record(SAFETY_FLOW, tickStart);
+
+        uint32_t logStart = safetyProfile.stamp();
+        for (uint8_t i = 0; i < FLOW_CHANNEL_COUNT; i++) flowChannels[i].logFlowStatus(pulseNow[i]);
+        safetyProfile.record(SAFETY_LOG, logStart);
+        markBoot(bootTiming.firstSampleMs);
+    }
 
-        noInterrupts();
-        unsigned long pulseNow = pulseCount;
-        pulseCount = 0;
-        interrupts();
+    if (millis() - timerSendFlowCheckMs > Sampling::sendMs) {
+        timerSendFlowCheckMs = millis();
+        for (uint8_t i = 0; i < FLOW_CHANNEL_COUNT; i++) flowChannels[i].sendIfChanged();
+    }
 
-        float volNowGal = pulseNow / calibrationFactor;
-        flow10s = volNowGal * galPerMinFactor;
+    for (uint8_t i = 0; i < FLOW_CHANNEL_COUNT; i++) {
+        uint32_t saveStart = safetyProfile.stamp();
+        if (flowChannels[i].saveIfDue()) safetyProfile.record(SAFETY_NVS, saveStart);
+    }
+}
 
-        calculateFlowStats(volNowGal);
-        updateWaterState(pulseNow, volNowGal);
-        handleValveLogic();
-        handleTimedEvents();
-        logFlowStatus(pulseNow, volNowGal);
+// === Valve Commands (queued by the comms task) ===
+void FlowChannel::handleCommand(const ValveCmdMsg &vc) {
+    switch (vc.type) {
+        case VALVE_CMD_CLOSE: cancelValveSequence(); closeValve(); break;
+        case VALVE_CMD_OPEN:  cancelValveSequence(); openValve(); break;
+        case VALVE_CMD_CYCLE:
+            if (!startValveCycle()) postAck(index, "cycle_valve", "already_running");
+            break;
+        case VALVE_CMD_TIMED_CLOSE:
+            if (valveSequenceActive())          postAck(index, "timed_close", "already_running");
+            else if (!startTimedClose(vc.arg))  postAck(index, "timed_close", "bad_duration");
+            break;
+        case VALVE_CMD_MODE: setValveMode((int)vc.arg); break;
+    }
+}
 
-        if (volumeNeedsSave && millis() - lastVolumeSave > volumeSaveInterval)
-            saveVolumeToPrefs();
+void handleValveCommands() {
+    ValveCmdMsg vc;
+    while (valveCmdQueue.pop(vc)) {
+        if (vc.channel < FLOW_CHANNEL_COUNT) flowChannels[vc.channel].handleCommand(vc);
     }
 }
 
+// Buttons act on channel 0
 void checkButtonMode() {
     bool reading = digitalRead(BUTTON_MODE_PIN);
     if (reading != buttonModeLastReading) buttonModeLastDebounceTime = millis();
@@ -315,8 +683,8 @@ void checkButtonMode() {
                     Serial.println("Long press: restarting");
                     ESP.restart();
                 } else {
-                    int newMode = (statusMonitor + 1) % 3;
-                    setValveMode(newMode);
+                    int newMode = (flowChannels[0].mode() + 1) % 3;
+                    flowChannels[0].setValveMode(newMode);
                 }
                 buttonModePreviouslyPressed = false;
             }
@@ -335,7 +703,7 @@ void checkButtonValve() {
             if (buttonValveState == LOW) {
                 buttonValvePreviouslyPressed = true;
             } else if (buttonValvePreviouslyPressed) {
-                valveClosed ? openValve() : closeValve();
+                flowChannels[0].toggleValve();
                 buttonValvePreviouslyPressed = false;
             }
         }
@@ -343,53 +711,173 @@ void checkButtonValve() {
     buttonValveLastReading = reading;
 }
 
-void loadVolumeFromPrefs() {
-    Serial.println("Loading values...");
-    volumePrefs.begin("flowvol", true);
-    volumeHour = volumePrefs.getFloat("volHour", 0.0);
-    volumeMin = volumePrefs.getFloat("volMin", 0.0);
-    volumeDay = volumePrefs.getFloat("volDay", 0.0);
-    volumeAll = volumePrefs.getFloat("volAll", 0.0);
-    oldHour = volumePrefs.getInt("oldHour", 0);
-    oldDay = volumePrefs.getInt("oldDay", 0);
-    oldTimeStamp = volumePrefs.getString("oldTimeStamp", "");
-    minuteStampsPrevious = volumePrefs.getString("minStP", "");
-    int savedStatus = volumePrefs.getInt("statusMonitor", 1);
-    valveClosed = volumePrefs.getBool("valveClosed", false);
+void FlowChannel::showModePixel() {
+    if (index != 0) return;
+    if (statusMonitor == 0)      showPixelColorEx(0, 255, 102, 0);
+    else if (statusMonitor == 1) showPixelColorEx(0, 0, 0, 255);
+    else if (statusMonitor == 2) showPixelColorEx(0, 255, 0, 255);
+}
+
+// Pre-journal builds stored one NVS key per value; import once, and clear
+// them only after the journal has taken the values (clearLegacyPrefs(),
+// from saveVolumeToPrefs()). Only channel 0 existed then.
+bool FlowChannel::loadLegacyPrefs() {
+    if (index != 0) return false;
+    if (!volumePrefs.begin("flowvol", true)) return false;
+    bool found = volumePrefs.isKey("volAll");
+    if (found) {
+        volumeHour = volumePrefs.getFloat("volHour", 0.0);
+        volumeMin = volumePrefs.getFloat("volMin", 0.0);
+        volumeDay = volumePrefs.getFloat("volDay", 0.0);
+        volumeAll = volumePrefs.getFloat("volAll", 0.0);
+        oldHour = volumePrefs.getInt("oldHour", 0);
+        oldDay = volumePrefs.getInt("oldDay", 0);
+        oldTimeStamp[0] = '\0';
+        volumePrefs.getString("oldTimeStamp", oldTimeStamp, sizeof(oldTimeStamp));
+        hourStartEpoch = volumePrefs.getUInt("oldTsE", 0);
+        statusMonitor = volumePrefs.getInt("statusMonitor", 1);
+        valveClosed = volumePrefs.getBool("valveClosed", false);
+    }
     volumePrefs.end();
-    setValveMode(savedStatus);
-    showPixelColorEx(1, valveClosed ? 255 : 0, valveClosed ? 0 : 255, 0);
-}
-
-void saveVolumeToPrefs() {
-    Serial.println("Saving values...");
-    volumePrefs.begin("flowvol", false);
-    volumePrefs.putFloat("volHour", volumeHour);
-    volumePrefs.putFloat("volMin", volumeMin);
-    volumePrefs.putFloat("volDay", volumeDay);
-    volumePrefs.putFloat("volAll", volumeAll);
-    volumePrefs.putInt("oldHour", oldHour);
-    volumePrefs.putInt("oldDay", oldDay);
-    volumePrefs.putString("oldTimeStamp", oldTimeStamp);
-    volumePrefs.putString("minStP", minuteStampsPrevious);
-    volumePrefs.putInt("statusMonitor", statusMonitor);
-    volumePrefs.putBool("valveClosed", valveClosed);
+    return found;
+}
+
+void FlowChannel::clearLegacyPrefs() {
+    if (!volumePrefs.begin("flowvol", false)) return;
+    if (volumePrefs.clear()) {
+        legacyPrefsPending = false;
+        Serial.println("Migrated legacy per-key state to journal");
+    }
     volumePrefs.end();
+}
+
+PersistedState FlowChannel::persistedState() const {
+    PersistedState st;
+    memset(&st, 0, sizeof(st));   // stable bytes for the unchanged check
+    st.volHour = volumeHour;
+    st.volMin = volumeMin;
+    st.volDay = volumeDay;
+    st.volAll = volumeAll;
+    st.oldHour = oldHour;
+    st.oldDay = oldDay;
+    st.hourStartEpoch = hourStartEpoch;
+    copyField(st.oldTimeStamp, sizeof(st.oldTimeStamp), oldTimeStamp);
+    st.statusMonitor = statusMonitor;
+    st.valveClosed = valveClosed;
+    return st;
+}
+
+void FlowChannel::applyPersistedState(const PersistedState &st) {
+    volumeHour = st.volHour;
+    volumeMin = st.volMin;
+    volumeDay = st.volDay;
+    volumeAll = st.volAll;
+    oldHour = st.oldHour;
+    oldDay = st.oldDay;
+    hourStartEpoch = st.hourStartEpoch;
+    copyField(oldTimeStamp, sizeof(oldTimeStamp), st.oldTimeStamp);
+    statusMonitor = (st.statusMonitor >= 0 && st.statusMonitor <= 2) ? st.statusMonitor : 1;
+    valveClosed = st.valveClosed;
+}
+
+// Every tick and on each valve/mode change: a copy and a CRC, no flash
+void FlowChannel::shadowLiveState() {
+    LiveState live;
+    live.saved = persistedState();
+    live.waterRunDurSec = waterRunDurSec;
+    live.waterStopDurSec = waterStopDurSec;
+    live.waterRun = waterRun;
+    live.warnActive = warnActive;
+    live.oldMin = oldMin;
+    live.pulseRejectedHour = pulseRejectedHour;
+    live.pulseRejectedTotal = pulseRejectedTotal;
+    live.pulseMinPeriodUs = pulseMinPeriodUs;
+    live.hour = flowStats.hourSummary();
+    live.leak = leakDetector.state();
+    live.shutoffUnposted = shutoffUnposted;
+    live.hourUnposted = hourUnposted;
+    live.unpostedShutoff = unpostedShutoff;
+    live.unpostedHour = unpostedHour;
+    liveShadow.save(live);
+}
+
+// Warm restart: the shadow is at least as new as the journal. The journal
+// catches up on the routine interval, or at once if the valve or mode
+// differ. journal is NULL when NVS holds no record.
+bool FlowChannel::restoreLiveState(const PersistedState *journal) {
+    LiveState live;
+    if (!liveShadow.load(live)) return false;
+    PersistedState saved = live.saved;   // packed members are copied out, not bound
+    FlowStats<FLOW_SAMPLING>::HourSummary hour = live.hour;
+    LeakState leak = live.leak;
+    applyPersistedState(saved);
+    waterRunDurSec = live.waterRunDurSec;
+    waterStopDurSec = live.waterStopDurSec;
+    waterRun = live.waterRun;
+    warnActive = live.warnActive;
+    oldMin = live.oldMin;
+    pulseRejectedHour = live.pulseRejectedHour;
+    pulseRejectedTotal = live.pulseRejectedTotal;
+    pulseMinPeriodUs = live.pulseMinPeriodUs;
+    flowStats.restoreHour(hour);
+    leakDetector.restore(leak);
+    shutoffUnposted = live.shutoffUnposted;
+    hourUnposted = live.hourUnposted;
+    unpostedShutoff = live.unpostedShutoff;
+    unpostedHour = live.unpostedHour;
+
+    if (!journal || journal->valveClosed != saved.valveClosed || journal->statusMonitor != saved.statusMonitor)
+        requestUrgentSave();
+    else
+        volumeNeedsSave = true;
+    return true;
+}
+
+void FlowChannel::loadVolumeFromPrefs() {
+    Serial.printf("Loading values (%s)...\n", cfg.label);
+    PersistedState st;
+    bool journalOk = stateJournal.load(st);   // always read: the next save continues its sequence
+    if (restoreLiveState(journalOk ? &st : NULL)) {
+        Serial.printf("Live state restored from RTC memory (reset reason %d)\n", (int)esp_reset_reason());
+    } else if (journalOk) {
+        applyPersistedState(st);
+        Serial.printf("State journal loaded (%lu lifetime writes)\n", (unsigned long)stateJournal.writes());
+    } else if (loadLegacyPrefs()) {
+        Serial.println("Legacy per-key state loaded");
+        legacyPrefsPending = true;
+        volumeNeedsSave = true;   // a failed write retries on the routine interval
+        saveVolumeToPrefs();
+    } else {
+        Serial.println("No saved state; using defaults");
+    }
+    showModePixel();
+    if (index == 0) showPixelColorEx(1, valveClosed ? 255 : 0, valveClosed ? 0 : 255, 0);
+}
+
+void FlowChannel::saveVolumeToPrefs() {
+    uint32_t before = stateJournal.writes();
+    if (!stateJournal.save(persistedState())) {
+        Serial.println("State journal write failed.");
+        lastVolumeSave = millis();   // retry on the routine interval, not every loop
+        saveUrgent = false;
+        return;
+    }
+    if (stateJournal.writes() != before)
+        Serial.printf("State saved (%s, write #%lu)\n", cfg.label, (unsigned long)stateJournal.writes());
+    if (legacyPrefsPending) clearLegacyPrefs();
     volumeNeedsSave = false;
+    saveUrgent = false;
     lastVolumeSave = millis();
-    Serial.println("Done");
 }
 
-void setValveMode(int newMode) {
+void FlowChannel::setValveMode(int newMode) {
     if (newMode != statusMonitor) {
         statusMonitor = newMode;
-        saveVolumeToPrefs();
-        Serial.printf("Valve mode updated: %d\n", statusMonitor);
-        if (statusMonitor == 0)      showPixelColorEx(0, 255, 102, 0);
-        else if (statusMonitor == 1) showPixelColorEx(0, 0, 0, 255);
-        else if (statusMonitor == 2) showPixelColorEx(0, 255, 0, 255);
+        requestUrgentSave();
+        Serial.printf("Valve mode updated (%s): %d\n", cfg.label, statusMonitor);
+        showModePixel();
     } else {
-        Serial.printf("Valve mode unchanged: %d\n", statusMonitor);
+        Serial.printf("Valve mode unchanged (%s): %d\n", cfg.label, statusMonitor);
     }
 }
 
@@ -0,0 +1,133 @@
+#ifndef MY_FLOWSTATS_H
+#define MY_FLOWSTATS_H
+
+#include <Arduino.h>
+#include "samplingConfig.h"
+#include "rollingWindow.h"
+#include "flowHistogram.h"
+#include "taskQueues.h"
+
+// ==================================
+// === Per-tick Flow Statistics =====
+// ==================================
+// The hour's sample ring, the max-flow windows, the flow histogram and the
+// short flowAvg, all sized from SamplingPlan<Config> at compile time. Each
+// window converts its pulse sum to gpm with one folded constant, so a tick
+// costs no divisions once the flowAvg window has filled after boot.
+
+// Packed per-tick record: interval start epoch + raw pulse count (6 bytes).
+// Timestamps are only formatted when a report is serialized.
+struct __attribute__((packed)) FlowSample {
+    uint32_t epoch;
+    uint16_t pulses;
+};
+
+// Highest window average this hour and the start of that window
+struct FlowMax {
+    float gpm;
+    uint32_t epoch;
+};
+
+template <typename Config>
+class FlowStats {
+public:
+    typedef SamplingPlan<Config> Plan;
+
+    // What the hourly report needs from the hour so far, small enough for
+    // the RTC shadow (rtcShadow.h). Plain data, so an RTC_NOINIT copy is
+    // never touched by a constructor. The sample ring and the windows are
+    // not part of it; they refill after a restore.
+    struct HourSummary {
+        FlowMax max10Sec, max1Min, max10Min, max30Min;
+        uint16_t hist[FLOW_HIST_BINS];
+    };
+
+    FlowStats() { resetHour(); }
+
+    // Hour rollover; the flowAvg window carries over
+    void resetHour() {
+        memset(samples, 0, sizeof(samples));
+        slot = 0;
+        win10Sec.reset(); win1Min.reset(); win10Min.reset(); win30Min.reset();
+        max10Sec = max1Min = max10Min = max30Min = FlowMax{0, 0};
+        hist.reset();
+    }
+
+    // One tick's pulses; startEpoch is when the tick's interval began
+    void add(uint16_t pulses, uint32_t startEpoch) {
+        samples[slot].epoch = startEpoch;
+        samples[slot].pulses = pulses;
+        win10Sec.push(pulses);
+        win1Min.push(pulses);
+        win10Min.push(pulses);
+        win30Min.push(pulses);
+        updateMax(win10Sec, max10Sec);
+        updateMax(win1Min, max1Min);
+        updateMax(win10Min, max10Min);
+        updateMax(win30Min, max30Min);
+        hist.add(pulses);
+        if (++slot == Plan::hourTicks) slot = 0;
+
+        winFlowAvg.push(pulses);
+    }
+
+    float flowAvgGpm() const {
+        constexpr float gpmPerSum = Plan::gpmPerPulse / Plan::flowAvgTicks;
+        if (winFlowAvg.full()) return winFlowAvg.sum() * gpmPerSum;
+        return winFlowAvg.avg() * Plan::gpmPerPulse;
+    }
+
+    const FlowMax &peak10Sec() const { return max10Sec; }
+    const FlowMax &peak1Min() const { return max1Min; }
+    const FlowMax &peak10Min() const { return max10Min; }
+    const FlowMax &peak30Min() const { return max30Min; }
+    const LogHistogram<FLOW_HIST_BINS> &histogram() const { return hist; }
+
+    HourSummary hourSummary() const {
+        HourSummary s;
+        s.max10Sec = max10Sec;
+        s.max1Min = max1Min;
+        s.max10Min = max10Min;
+        s.max30Min = max30Min;
+        memcpy(s.hist, hist.data(), sizeof(s.hist));
+        return s;
+    }
+
+    void restoreHour(const HourSummary &s) {
+        max10Sec = s.max10Sec;
+        max1Min = s.max1Min;
+        max10Min = s.max10Min;
+        max30Min = s.max30Min;
+        hist.assign(s.hist);
+    }
+
+private:
+    FlowSample samples[Plan::hourTicks];
+    uint16_t slot;
+
+    // Rolling windows over per-tick pulse counts (O(1) per sample)
+    RollingWindow<uint16_t, Plan::win10SecTicks, uint32_t> win10Sec;
+    RollingWindow<uint16_t, Plan::win1MinTicks, uint32_t>  win1Min;
+    RollingWindow<uint16_t, Plan::win10MinTicks, uint32_t> win10Min;
+    RollingWindow<uint16_t, Plan::win30MinTicks, uint32_t> win30Min;
+    RollingWindow<uint16_t, Plan::flowAvgTicks, uint32_t>  winFlowAvg;
+    FlowMax max10Sec, max1Min, max10Min, max30Min;
+    // Per-tick flow distribution for the hourly report
+    LogHistogram<FLOW_HIST_BINS> hist;
+
+    // Runs before slot advances; the window's first sample sits Ticks-1 slots back
+    template <uint16_t Ticks>
+    void updateMax(const RollingWindow<uint16_t, Ticks, uint32_t> &win, FlowMax &peak) {
+        static_assert(Ticks <= Plan::hourTicks, "window longer than the hour ring");
+        constexpr float gpmPerSum = Plan::gpmPerPulse / Ticks;
+        if (!win.full()) return;
+        float gpm = win.sum() * gpmPerSum;
+        if (gpm > peak.gpm) {
+            peak.gpm = gpm;
+            uint16_t first = slot + 1 >= Ticks ? slot + 1 - Ticks : slot + 1 + Plan::hourTicks - Ticks;
+            peak.epoch = samples[first].epoch;
+        }
+    }
+};
+
+#endif
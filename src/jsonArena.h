@@ -0,0 +1,107 @@
+#ifndef MY_JSONARENA_H
+#define MY_JSONARENA_H
+
+#include <Arduino.h>
+
+// ArduinoJson 7 takes one whole variant pool (ARDUINOJSON_POOL_CAPACITY
+// slots) from the allocator for the first value of a document, and one
+// block per copied string after that. The capacity is pinned here so the
+// pool has the same slot count on every 7.x release and target; it only
+// takes effect if this header is included before ArduinoJson.h.
+#ifdef ARDUINOJSON_VERSION
+#error "include jsonArena.h before ArduinoJson.h"
+#endif
+#define JSON_POOL_SLOTS 64
+#define ARDUINOJSON_POOL_CAPACITY JSON_POOL_SLOTS
+#include <ArduinoJson.h>
+
+// Arena sizing, upper bounds over the 7.x releases:
+//   slot   - 16 B on ESP32 (8 B from 7.3), 24 B on a 64-bit host
+//   block  - arena size header + 8-byte alignment padding
+//   string - StringNode header, terminating NUL and one arena block
+// The largest documents (hourly flowData, a stage diag) use ~50 slots.
+#define JSON_SLOT_BYTES (2 * sizeof(void *) + 8)
+#define JSON_BLOCK_OVERHEAD (sizeof(uint32_t) + 7)
+#define JSON_STRING_OVERHEAD (2 * sizeof(void *) + 1 + JSON_BLOCK_OVERHEAD)
+#define JSON_POOL_BYTES (JSON_POOL_SLOTS * JSON_SLOT_BYTES + JSON_BLOCK_OVERHEAD)
+#define JSON_ARENA_BYTES(chars, strings) \
+  (JSON_POOL_BYTES + (chars) + (strings) * JSON_STRING_OVERHEAD)
+
+// ==========================
+// === JSON Arena ===========
+// ==========================
+// ArduinoJson 7 documents (StaticJsonDocument included) allocate from the
+// heap by default. Passing a JsonArena to JsonDocument keeps every pool and
+// string in fixed static storage instead. Blocks are bump-allocated and
+// released all at once by reset(), so use one arena per non-nested document:
+//
+//   jsonTxArena.reset();
+//   JsonDocument doc(&jsonTxArena);
+//
+// When the arena is full, allocate() returns NULL; ArduinoJson reports
+// NoMemory / overflowed() and nothing falls back to malloc(). A document
+// that outgrows JSON_POOL_SLOTS asks for a second pool and overflows too.
+template <size_t N>
+class JsonArena : public ArduinoJson::Allocator {
+public:
+  void *allocate(size_t size) override {
+    size_t need = align(sizeof(uint32_t) + size);
+    if (used + need > N) {
+      overflowCount++;
+      return NULL;
+    }
+    uint8_t *block = storage + used;
+    *(uint32_t *)block = (uint32_t)size;
+    lastBlock = block;
+    used += need;
+    if (used > highWater) highWater = used;
+    return block + sizeof(uint32_t);
+  }
+
+  void deallocate(void *ptr) override { (void)ptr; }   // freed by reset()
+
+  void *reallocate(void *ptr, size_t newSize) override {
+    if (!ptr) return allocate(newSize);
+    uint8_t *block = (uint8_t *)ptr - sizeof(uint32_t);
+    uint32_t oldSize = *(uint32_t *)block;
+
+    // The most recent block can grow or shrink in place
+    if (block == lastBlock) {
+      size_t start = block - storage;
+      size_t need = align(sizeof(uint32_t) + newSize);
+      if (start + need > N) {
+        overflowCount++;
+        return NULL;
+      }
+      *(uint32_t *)block = (uint32_t)newSize;
+      used = start + need;
+      if (used > highWater) highWater = used;
+      return ptr;
+    }
+    if (newSize <= oldSize) return ptr;
+
+    void *fresh = allocate(newSize);
+    if (fresh) memcpy(fresh, ptr, oldSize);
+    return fresh;
+  }
+
+  void reset() {
+    used = 0;
+    lastBlock = NULL;
+  }
+
+  size_t highWaterMark() const { return highWater; }
+  static size_t capacity() { return N; }
+  uint32_t overflows() const { return overflowCount; }
+
+private:
+  static size_t align(size_t n) { return (n + 7) & ~(size_t)7; }
+
+  alignas(8) uint8_t storage[N];
+  size_t used = 0;
+  size_t highWater = 0;
+  uint8_t *lastBlock = NULL;
+  uint32_t overflowCount = 0;
+};
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef MY_LEAKDETECTOR_H
+#define MY_LEAKDETECTOR_H
+
+#include <Arduino.h>
+
+// ==================================
+// === Streaming Leak Detector ======
+// ==================================
+// Runs on every flow tick with O(1) work and fixed memory (~220 bytes), so
+// it keeps protecting the line while the broker is unreachable. It tracks:
+//  - continuous flow: time since the last quiet interval (quietSec with no
+//    pulses). A toilet flapper or dripping fixture can sit below one pulse
+//    per tick, so single empty ticks do not count as the flow stopping.
+//  - hourly volume against an EWMA baseline for that hour of day.
+//  - volume of the current run against an EWMA of completed runs.
+// Baselines only learn from hours/runs that did not raise an alert, and only
+// alert once they have minSamples behind them. They live in RAM and in the
+// RTC shadow, so a warm restart keeps them; a power cut relearns them.
+
+struct LeakConfig {
+  uint32_t quietSec;            // no pulses this long = a zero-flow interval
+  uint32_t continuousWarnSec;   // no zero-flow interval for this long -> warn
+  uint32_t continuousCritSec;   // ... -> critical
+  float hourFactor;             // hour alert when volume > base * factor + margin
+  float hourMarginGal;
+  float runFactor;              // run alert when volume > base * factor + margin
+  float runMarginGal;
+  uint32_t runGapSec;           // zero flow this long ends a run
+  uint8_t minSamples;           // baseline samples needed before alerting
+  uint8_t ewmaShift;            // EWMA weight 1 / 2^ewmaShift
+};
+
+// Everything the detector learns and tracks; plain data so it can be
+// shadowed in RTC memory (flowMon.h)
+struct LeakState {
+  uint32_t continuousSec, stopSec;
+  float runGal, runBaseGal;
+  uint8_t runSamples;
+  float hourBaseGal[24];
+  uint8_t hourSamples[24];
+  uint8_t raised;          // alerts active in the current event, fire once each
+};
+
+enum LeakAlert : uint8_t {
+  LEAK_NONE            = 0,
+  LEAK_CONTINUOUS_WARN = 1 << 0,
+  LEAK_CONTINUOUS_CRIT = 1 << 1,
+  LEAK_HOUR_VOLUME     = 1 << 2,
+  LEAK_RUN_VOLUME      = 1 << 3,
+};
+
+class LeakDetector {
+public:
+  LeakDetector(const LeakConfig &cfg, uint32_t tickSec) : cfg(cfg), tickSec(tickSec) { reset(); }
+
+  void reset() {
+    st.continuousSec = 0;
+    st.stopSec = cfg.quietSec;   // start idle
+    st.runGal = 0;
+    st.runBaseGal = 0;
+    st.runSamples = 0;
+    for (uint8_t h = 0; h < 24; h++) { st.hourBaseGal[h] = 0; st.hourSamples[h] = 0; }
+    st.raised = LEAK_NONE;
+  }
+
+  // One flow tick; returns alerts newly raised by this tick (bitmask)
+  uint8_t tick(uint32_t pulses, float gallons) {
+    uint8_t fresh = LEAK_NONE;
+
+    if (pulses > 0) {
+      st.stopSec = 0;
+      st.runGal += gallons;
+      if (st.runSamples >= cfg.minSamples && st.runGal > st.runBaseGal * cfg.runFactor + cfg.runMarginGal)
+        fresh |= raise(LEAK_RUN_VOLUME);
+    } else {
+      st.stopSec += tickSec;
+    }
+
+    if (st.stopSec >= cfg.quietSec) {
+      st.continuousSec = 0;
+      st.raised &= ~(LEAK_CONTINUOUS_WARN | LEAK_CONTINUOUS_CRIT);
+    } else {
+      st.continuousSec += tickSec;
+      if (st.continuousSec >= cfg.continuousWarnSec) fresh |= raise(LEAK_CONTINUOUS_WARN);
+      if (st.continuousSec >= cfg.continuousCritSec) fresh |= raise(LEAK_CONTINUOUS_CRIT);
+    }
+
+    if (pulses == 0 && st.runGal > 0 && st.stopSec >= cfg.runGapSec) {
+      if (!(st.raised & LEAK_RUN_VOLUME)) learn(st.runBaseGal, st.runSamples, st.runGal);
+      st.runGal = 0;
+      st.raised &= ~LEAK_RUN_VOLUME;
+    }
+    return fresh;
+  }
+
+  // Call with the hour that just ended (0..23) before its volume is cleared
+  uint8_t endHour(int hour, float volumeHourGal) {
+    if (hour < 0 || hour > 23) return LEAK_NONE;
+    bool alert = st.hourSamples[hour] >= cfg.minSamples &&
+                 volumeHourGal > st.hourBaseGal[hour] * cfg.hourFactor + cfg.hourMarginGal;
+    if (!alert) learn(st.hourBaseGal[hour], st.hourSamples[hour], volumeHourGal);
+    return alert ? LEAK_HOUR_VOLUME : LEAK_NONE;
+  }
+
+  // Highest active grade: 0 none, 1 warn, 2 critical
+  uint8_t level() const {
+    if (st.raised & LEAK_CONTINUOUS_CRIT) return 2;
+    return st.raised ? 1 : 0;
+  }
+
+  uint32_t continuousFlowSec() const { return st.continuousSec; }
+  float runVolumeGal() const { return st.runGal; }
+  float runBaselineGal() const { return st.runBaseGal; }
+  float hourBaselineGal(int hour) const { return (hour >= 0 && hour < 24) ? st.hourBaseGal[hour] : 0; }
+
+  const LeakState &state() const { return st; }
+  void restore(const LeakState &saved) { st = saved; }
+
+private:
+  const LeakConfig &cfg;
+  uint32_t tickSec;
+
+  LeakState st;
+
+  uint8_t raise(uint8_t alert) {
+    if (st.raised & alert) return LEAK_NONE;
+    st.raised |= alert;
+    return alert;
+  }
+
+  // EWMA; the first sample seeds the baseline
+  void learn(float &base, uint8_t &samples, float value) {
+    if (samples == 0) base = value;
+    else base += (value - base) / (float)(1 << cfg.ewmaShift);
+    if (samples < 255) samples++;
+  }
+};
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef MY_LOOPPROFILER_H
+#define MY_LOOPPROFILER_H
+
+#include <Arduino.h>
+#include "flowHistogram.h"
+
+// ==================================
+// === Loop Stage Profiler ==========
+// ==================================
+// Times each stage of the safety loop and the comms loop with the CPU cycle
+// counter (a register read, no syscalls). Every stage keeps count, min, max
+// and a log2 histogram of microseconds for the current report period:
+// bin 0 = under 1 us, bin k = [2^(k-1), 2^k) us, last bin = 16 ms and up.
+// Each profiler is only touched by its own task; the counter is per core
+// and both tasks are pinned. A 32-bit cycle count wraps after ~17 s at
+// 240 MHz, so a single stage longer than that reads short.
+
+#define STAGE_HIST_BINS 16
+
+// Safety task (loop()) stages
+enum SafetyStage : uint8_t {
+    SAFETY_BUTTONS,     // checkButtonMode/checkButtonValve, renderNetLed
+    SAFETY_VALVE,       // handleValveCommands + tickValveSequence
+    SAFETY_FLOW,        // flowCalcs() tick math, leak + valve logic
+    SAFETY_LOG,         // logFlowStatus() Serial output
+    SAFETY_NVS,         // state journal save
+    SAFETY_LOOP,        // whole loop() pass
+    SAFETY_STAGE_COUNT
+};
+
+// Comms task (commsTick()) stages
+enum CommsStage : uint8_t {
+    COMMS_STAGE_WIFI,       // connectivityTick()
+    COMMS_STAGE_MQTT_LOOP,  // mqttLink.loop(): reads, PUBACKs, outbox writes
+    COMMS_STAGE_QUEUE,      // drainCommsQueue(), incl. publishes and history writes
+    COMMS_STAGE_WARN_ACK,   // processWarningAckTick()
+    COMMS_STAGE_BACKLOG,    // drainBacklogTick()
+    COMMS_STAGE_HISTORY,    // historyStreamTick()
+    COMMS_STAGE_RECONNECT,  // reconnectIfNeeded()
+    COMMS_STAGE_LOOP,       // whole commsTick() pass
+    COMMS_STAGE_COUNT
+};
+
+const char *const safetyStageNames[SAFETY_STAGE_COUNT] = { "buttons", "valve", "flow", "log", "nvs", "loop" };
+const char *const commsStageNames[COMMS_STAGE_COUNT] = { "wifi", "mqttLoop", "queue", "warnAck", "backlog", "history", "reconnect", "loop" };
+
+// Plain data so it can ride in a CommsMsg
+struct StageStats {
+    uint32_t count, minUs, maxUs;
+    uint32_t hist[STAGE_HIST_BINS];
+
+    void reset() {
+        memset(this, 0, sizeof(*this));
+        minUs = UINT32_MAX;
+    }
+
+    void add(uint32_t us) {
+        count++;
+        if (us < minUs) minUs = us;
+        if (us > maxUs) maxUs = us;
+        hist[LogHistogram<STAGE_HIST_BINS>::binOf(us)]++;
+    }
+
+    // Upper edge of the bin holding the 99th percentile, capped at maxUs
+    uint32_t p99Us() const {
+        if (count == 0) return 0;
+        uint32_t target = count - count / 100;
+        uint32_t seen = 0;
+        for (uint8_t b = 0; b < STAGE_HIST_BINS - 1; b++) {
+            seen += hist[b];
+            if (seen >= target) return min(maxUs, (uint32_t)((1UL << b) - 1));
+        }
+        return maxUs;
+    }
+
+    uint32_t minOrZero() const { return count ? minUs : 0; }
+};
+
+template <uint8_t Stages>
+class LoopProfiler {
+public:
+    LoopProfiler() { reset(); }
+
+    void reset() {
+        for (uint8_t i = 0; i < Stages; i++) stages[i].reset();
+        periodStartMs = millis();
+    }
+
+    static uint32_t stamp() { return ESP.getCycleCount(); }
+
+    // Record the time since a stamp() taken at the start of the stage
+    void record(uint8_t stage, uint32_t startCycles) {
+        if (!cyclesPerUs) cyclesPerUs = getCpuFrequencyMhz();
+        stages[stage].add((ESP.getCycleCount() - startCycles) / cyclesPerUs);
+    }
+
+    const StageStats &stats(uint8_t stage) const { return stages[stage]; }
+    uint32_t periodMs() const { return millis() - periodStartMs; }
+
+private:
+    StageStats stages[Stages];
+    unsigned long periodStartMs;
+    uint32_t cyclesPerUs = 0;
+};
+
+LoopProfiler<SAFETY_STAGE_COUNT> safetyProfile;   // owned by the safety task
+LoopProfiler<COMMS_STAGE_COUNT> commsProfile;     // owned by the comms task
+
+#endif
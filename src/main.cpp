@@ -1,4 +1,3 @@
-
 #include <wifiComs.h>
 #include "flowMon.h"
 #include "espMqtt.h"
@@ -15,49 +14,173 @@ unsigned long timerCheckMs;        // establish variable to check timer loop
 unsigned long timerTimeMs = 10000; // set timer loop  to 15 seconds
 #define WDT_TIMEOUT 300            //  watchdog loop timer seconds
 
+// Stage timings (loopProfiler.h) go out on the diagnostics topic this often
+unsigned long diagCheckMs = 0;
+const unsigned long diagPeriodMs = 600000UL;
+
+////////////
+// Task Setup
+////////////
+// loop() is the safety task (Arduino loopTask, pinned to the app core):
+// pulse sampling, valve logic and buttons. The comms task runs WiFi/MQTT
+// and the NVS backlog on the protocol core. Set SPLIT_TASKS=0 to run the
+// comms work inline in loop() instead.
+#ifndef SPLIT_TASKS
+#define SPLIT_TASKS 1
+#endif
+#define COMMS_TASK_CORE     0
+#define COMMS_TASK_STACK    8192
+#define COMMS_TASK_PRIORITY 1
+#define COMMS_TASK_DELAY_MS 5
+TaskHandle_t safetyTaskHandle = NULL;   // Arduino loopTask, set in setup()
+TaskHandle_t commsTaskHandle = NULL;
+
+// Heap/stack samples for memHealth (espMqtt.h)
+unsigned long memCheckMs = 0;
+const unsigned long memCheckPeriodMs = 30000UL;
+
+// === Memory Health ===
+void memoryTick() {
+  if (millis() - memCheckMs < memCheckPeriodMs) return;
+  memCheckMs = millis();
+
+  MemSample s;
+  s.freeHeap = ESP.getFreeHeap();
+  s.minFreeHeap = ESP.getMinFreeHeap();
+  s.maxBlock = ESP.getMaxAllocHeap();
+  s.loopStackFree = safetyTaskHandle ? uxTaskGetStackHighWaterMark(safetyTaskHandle) : 0;
+  s.commsStackFree = commsTaskHandle ? uxTaskGetStackHighWaterMark(commsTaskHandle) : 0;
+  handleMemAlarms(memHealth.update(s));
+}
+
+// === Comms Task ===
+void commsTick() {
+  uint32_t tickStart = commsProfile.stamp();
+  uint32_t t = tickStart;
+  connectivityTick();
+  commsProfile.record(COMMS_STAGE_WIFI, t);
+
+  unsigned long netStartMs = millis();
+  t = commsProfile.stamp();
+  mqttLink.loop();
+  commsProfile.record(COMMS_STAGE_MQTT_LOOP, t);
+  recordNetStall(netStartMs);
+
+  t = commsProfile.stamp();
+  drainCommsQueue();
+  commsProfile.record(COMMS_STAGE_QUEUE, t);
+
+  t = commsProfile.stamp();
+  processWarningAckTick();
+  commsProfile.record(COMMS_STAGE_WARN_ACK, t);
+
+  // offline backlog drain (self-paced)
+  t = commsProfile.stamp();
+  drainBacklogTick();
+  commsProfile.record(COMMS_STAGE_BACKLOG, t);
+
+  t = commsProfile.stamp();
+  historyStreamTick();
+  commsProfile.record(COMMS_STAGE_HISTORY, t);
+
+  /// basic timer
+  /// (the first MQTT attempt goes as soon as WiFi is up, not on the timer)
+  ///////////////
+  if (millis() - timerCheckMs > timerTimeMs || lastMQTTConnectAttempt == 0)
+  {
+    timerCheckMs = millis();
+    t = commsProfile.stamp();
+    reconnectIfNeeded();  //reconnect mqtt if needed
+    commsProfile.record(COMMS_STAGE_RECONNECT, t);
+  }
+  memoryTick();
+  commsProfile.record(COMMS_STAGE_LOOP, tickStart);
+}
+
+// === Loop Diagnostics ===
+// Relay the safety stages to the comms task and start a new period. Skipped
+// (and the period extended) while the queue is busy, so telemetry and
+// warnings always have room.
+void postLoopDiagnostics() {
+  if (commsQueue.size() + SAFETY_STAGE_COUNT > COMMS_QUEUE_LEN / 2) return;
+  uint32_t periodMs = safetyProfile.periodMs();
+  for (uint8_t i = 0; i < SAFETY_STAGE_COUNT; i++)
+    postStageStats(i, i == SAFETY_STAGE_COUNT - 1, periodMs, safetyProfile.stats(i));
+  safetyProfile.reset();
+  diagCheckMs = millis();
+}
+
+// Storage and network bring-up, off the safety path: flash mounts, WiFi
+// and the MQTT link come up while loop() is already sampling
+void commsSetup() {
+  payloadLogSetup();
+  flowHistorySetup();
+
+  connectToWiFi();                 // returns at once; connectivityTick() brings up NTP + MQTT
+  mqttSetup();
+}
+
+void commsTask(void *param) {
+  esp_task_wdt_add(NULL);
+  commsSetup();
+  for (;;) {
+    esp_task_wdt_reset();
+    commsTick();
+    vTaskDelay(pdMS_TO_TICKS(COMMS_TASK_DELAY_MS));
+  }
+}
+
 void setup() {
   Serial.begin(115200);
-  delay(3000);
   esp_task_wdt_init(WDT_TIMEOUT, true);
   esp_task_wdt_add(NULL);
+  safetyTaskHandle = xTaskGetCurrentTaskHandle();
+
+  // Local time before the first flow tick: after a warm reset the RTC
+  // still has a valid epoch, but TZ is only set again once NTP starts
+  setenv("TZ", timeZone, 1);
+  tzset();
 
+  // Safety first: relays hold the saved valve state, then pulse capture
   startNeoPixel();
-  flowMeterSetup();
   valveRelaySetup();
+  flowMeterSetup();
+  markBoot(bootTiming.safetyMs);
+  Serial.printf("[BOOT] safety up at %lu ms (reset reason %d)\n",
+                (unsigned long)bootTiming.safetyMs, (int)esp_reset_reason());
 
-  connectToWiFi();                 // events will trigger NTP + MQTT
-  mqttClient.setServer(mqtt_server, 1883);
-  mqttClient.setKeepAlive(CUSTOM_MQTT_KEEPALIVE);
-  // connectToMQTT();              // <-- remove; event will handle it
-  // initTime();                   // <-- remove; event will handle it
+#if SPLIT_TASKS
+  xTaskCreatePinnedToCore(commsTask, "comms", COMMS_TASK_STACK, NULL,
+                          COMMS_TASK_PRIORITY, &commsTaskHandle, COMMS_TASK_CORE);
+#else
+  commsSetup();
+#endif
 }
 
 
 void loop()
 {
   esp_task_wdt_reset();
+  uint32_t loopStart = safetyProfile.stamp();
 
   // check buttons
+  uint32_t t = loopStart;
   checkButtonMode();
   checkButtonValve();
+  renderNetLed();
+  safetyProfile.record(SAFETY_BUTTONS, t);
 
-  if (mqttClient.connected()) mqttClient.loop();
-  processWarningAckTick();
+  t = safetyProfile.stamp();
+  handleValveCommands();
+  tickValveSequence();
+  safetyProfile.record(SAFETY_VALVE, t);
 
-  flowCalcs(); // run flow check
+  flowCalcs(); // run flow check (times its own stages)
 
-  // mqtt failed send resends
-  if (millis() - lastRetryTime > RETRY_INTERVAL)
-  {
-    retryUnsentPayloads();
-    lastRetryTime = millis();
-  }
+  if (millis() - diagCheckMs > diagPeriodMs) postLoopDiagnostics();
+  safetyProfile.record(SAFETY_LOOP, loopStart);
 
-  /// basic timer
-  ///////////////
-  if (millis() - timerCheckMs > timerTimeMs)
-  {
-    timerCheckMs = millis();
-    reconnectIfNeeded();  //reconnect mqtt if needed
-  }
+#if !SPLIT_TASKS
+  commsTick();
+#endif
 }
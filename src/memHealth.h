@@ -0,0 +1,110 @@
+#ifndef MY_MEMHEALTH_H
+#define MY_MEMHEALTH_H
+
+#include <Arduino.h>
+
+// ==================================
+// === Heap / Stack Health ==========
+// ==================================
+// Periodic samples of free heap, largest free block, the minimum-ever free
+// heap and the task stacks' high-water marks (bytes never used). Keeps the
+// worst value of each per report period and raises an alarm once when a
+// limit is crossed; it clears only after the value recovers past the
+// limit plus a margin, so a value hovering at the edge does not flap.
+// Fragmentation is 100 - 100 * largestBlock / freeHeap. The ESP32 heap is
+// split into regions, so a healthy device already reads 40-60 %.
+
+struct MemSample {
+    uint32_t freeHeap, minFreeHeap, maxBlock;
+    uint32_t loopStackFree, commsStackFree;   // 0 = not sampled
+
+    uint8_t fragPct() const {
+        if (freeHeap == 0 || maxBlock >= freeHeap) return 0;
+        return (uint8_t)(100 - (uint64_t)maxBlock * 100 / freeHeap);
+    }
+};
+
+struct MemConfig {
+    uint32_t minFreeHeap;      // free heap below this -> alarm
+    uint32_t minBlock;         // largest free block below this -> alarm
+    uint8_t fragWarnPct;       // fragmentation at or above this -> alarm
+    uint32_t minStackFree;     // either task's stack headroom below this -> alarm
+    uint8_t recoverPct;        // margin past the limit before an alarm clears
+};
+
+enum MemAlarm : uint8_t {
+    MEM_NONE        = 0,
+    MEM_LOW_HEAP    = 1 << 0,
+    MEM_SMALL_BLOCK = 1 << 1,
+    MEM_FRAGMENTED  = 1 << 2,
+    MEM_LOW_STACK   = 1 << 3,
+};
+
+class MemHealth {
+public:
+    MemHealth(const MemConfig &cfg) : cfg(cfg) { resetPeriod(); }
+
+    // Returns alarms newly raised by this sample (bitmask)
+    uint8_t update(const MemSample &s) {
+        last = s;
+        samples++;
+        worst.freeHeap = min(worst.freeHeap, s.freeHeap);
+        worst.minFreeHeap = min(worst.minFreeHeap, s.minFreeHeap);
+        worst.maxBlock = min(worst.maxBlock, s.maxBlock);
+        if (s.loopStackFree) worst.loopStackFree = min(worst.loopStackFree, s.loopStackFree);
+        if (s.commsStackFree) worst.commsStackFree = min(worst.commsStackFree, s.commsStackFree);
+        peakFrag = max(peakFrag, s.fragPct());
+
+        uint32_t stackFree = stackHeadroom(s);
+        uint8_t fresh = MEM_NONE;
+        fresh |= check(MEM_LOW_HEAP, s.freeHeap < cfg.minFreeHeap, s.freeHeap > grow(cfg.minFreeHeap));
+        fresh |= check(MEM_SMALL_BLOCK, s.maxBlock < cfg.minBlock, s.maxBlock > grow(cfg.minBlock));
+        fresh |= check(MEM_FRAGMENTED, s.fragPct() >= cfg.fragWarnPct,
+                       s.fragPct() + cfg.recoverPct < cfg.fragWarnPct);
+        fresh |= check(MEM_LOW_STACK, stackFree && stackFree < cfg.minStackFree,
+                       !stackFree || stackFree > grow(cfg.minStackFree));
+        return fresh;
+    }
+
+    void resetPeriod() {
+        worst.freeHeap = worst.minFreeHeap = worst.maxBlock = UINT32_MAX;
+        worst.loopStackFree = worst.commsStackFree = UINT32_MAX;
+        peakFrag = 0;
+        samples = 0;
+    }
+
+    const MemSample &latest() const { return last; }
+    const MemSample &periodWorst() const { return worst; }   // valid when periodSamples() > 0
+    uint8_t periodPeakFragPct() const { return peakFrag; }
+    uint32_t periodSamples() const { return samples; }
+    uint8_t active() const { return raised; }
+
+    // Smaller of the two task stacks' headroom, 0 if neither was sampled
+    static uint32_t stackHeadroom(const MemSample &s) {
+        if (!s.loopStackFree) return s.commsStackFree;
+        if (!s.commsStackFree) return s.loopStackFree;
+        return min(s.loopStackFree, s.commsStackFree);
+    }
+
+private:
+    const MemConfig &cfg;
+    MemSample last = {};
+    MemSample worst;
+    uint8_t peakFrag;
+    uint32_t samples;
+    uint8_t raised = MEM_NONE;
+
+    uint32_t grow(uint32_t limit) const { return limit + limit / 100 * cfg.recoverPct; }
+
+    uint8_t check(uint8_t alarm, bool bad, bool recovered) {
+        if (bad) {
+            if (raised & alarm) return MEM_NONE;
+            raised |= alarm;
+            return alarm;
+        }
+        if (recovered) raised &= ~alarm;
+        return MEM_NONE;
+    }
+};
+
+#endif
@@ -0,0 +1,429 @@
+#ifndef MY_MQTTLINK_H
+#define MY_MQTTLINK_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include "mqttOutbox.h"
+
+// ==================================
+// === Non-blocking MQTT Link =======
+// ==================================
+// Minimal MQTT 3.1.1 client for the comms task. publish() only copies into
+// the outbox (mqttOutbox.h) and returns. loop() reads whatever bytes have
+// arrived, writes queued publishes, and keeps the connection alive. Nothing
+// waits on the broker: CONNACK, SUBACK and PUBACK are handled when they
+// show up, and overdue ones drop the connection.
+//
+// QoS 1 publishes stay in the outbox until their PUBACK, at most
+// MQTT_MAX_INFLIGHT at a time, and are sent again (DUP) after a reconnect.
+// The delivered callback reports each acknowledged tag, so callers can
+// release durable copies only once the broker has the message.
+//
+// beginConnect() is the one call that can still block, once per attempt
+// (attempts are spaced by the reconnect backoff in espMqtt.h):
+//  - DNS: WiFiClient::connect() resolves a host name synchronously, up to
+//    lwIP's DNS timeout (a few seconds) if the resolver does not answer.
+//    An IP literal in MQTT_SERVER skips the lookup.
+//  - TCP connect: bounded by MQTT_TCP_CONNECT_TIMEOUT_MS.
+//  - CONNECT write: ~100 bytes into a fresh socket's empty send buffer, so
+//    it returns at once in practice; a socket that stalls right after the
+//    handshake can hold it for WiFiClient's write retry limit (~10 s).
+// With SPLIT_TASKS this stalls only the comms task (recordNetStall() reports
+// it as netStallMs); the safety loop keeps running. Everything after the
+// CONNECT is asynchronous. Sessions are clean: subscriptions are renewed
+// on every connect.
+
+#define MQTT_OUTBOX_BYTES          8192
+#define MQTT_OUTBOX_SLOTS          32
+#define MQTT_MAX_INFLIGHT          8
+#define MQTT_RX_BUFFER_SIZE        1024    // largest inbound packet (commands, warning ACKs)
+#define MQTT_MAX_SUBSCRIPTIONS     8
+#define MQTT_TCP_CONNECT_TIMEOUT_MS 1500
+#define MQTT_CONNACK_TIMEOUT_MS    5000
+#define MQTT_ACK_TIMEOUT_MS        20000   // in-flight publish with no PUBACK -> reconnect
+
+enum MqttLinkState : uint8_t { MQTT_LINK_DOWN, MQTT_LINK_CONNECTING, MQTT_LINK_UP };
+
+enum MqttLinkEvent : uint8_t {
+    MQTT_EVENT_CONNECTED,       // CONNACK accepted; subscriptions sent
+    MQTT_EVENT_CONNECT_FAILED,  // TCP connect failed, CONNACK refused or timed out
+    MQTT_EVENT_DISCONNECTED     // an established connection was lost
+};
+
+class MqttLink {
+public:
+    typedef void (*MessageCallback)(char *topic, byte *payload, unsigned int length);
+    typedef void (*DeliveredCallback)(uint8_t tag);
+    typedef void (*EventCallback)(MqttLinkEvent event);
+
+    MqttLink(WiFiClient &net) : net(net) {}
+
+    void setServer(const char *host, uint16_t port) { this->host = host; this->port = port; }
+    void setKeepAlive(uint16_t sec) { keepAliveSec = sec; }
+    void setCredentials(const char *id, const char *user, const char *pass) {
+        clientId = id; this->user = user; this->pass = pass;
+    }
+    void setWill(const char *topic, const char *message, uint8_t qos, bool retained) {
+        willTopic = topic; willMessage = message; willQos = qos; willRetain = retained;
+    }
+    void setCallback(MessageCallback cb) { onMessage = cb; }
+    void setDeliveredCallback(DeliveredCallback cb) { onDelivered = cb; }
+    void setEventCallback(EventCallback cb) { onEvent = cb; }
+
+    // Subscribed (QoS 0) on every connect; topic must outlive the link
+    bool addSubscription(const char *topic) {
+        if (subscriptionCount >= MQTT_MAX_SUBSCRIPTIONS) return false;
+        subscriptions[subscriptionCount++] = topic;
+        return true;
+    }
+
+    // Opens the socket and sends CONNECT; CONNACK is handled by loop().
+    // Blocks for DNS, the TCP handshake and the first write (see above).
+    bool beginConnect() {
+        if (linkState != MQTT_LINK_DOWN) return true;
+        if (!net.connect(host, port, MQTT_TCP_CONNECT_TIMEOUT_MS)) {
+            lastConnackCode = 0xFF;
+            emit(MQTT_EVENT_CONNECT_FAILED);
+            return false;
+        }
+        resetRx();
+        pingOutstanding = false;
+        linkState = MQTT_LINK_CONNECTING;
+        stateSinceMs = lastOutMs = millis();
+        return sendConnect();   // a failed write has already dropped the link
+    }
+
+    void disconnect() {
+        if (linkState == MQTT_LINK_UP) {
+            const uint8_t pkt[2] = {0xE0, 0x00};
+            net.write(pkt, sizeof(pkt));
+        }
+        drop(false);
+    }
+
+    // Queue a publish; false if the outbox is full
+    bool publish(const char *topic, const uint8_t *payload, size_t len, bool retained, uint8_t qos, uint8_t tag = 0) {
+        if (len > 0xFFFF || !outbox.push(topic, payload, (uint16_t)len, qos, retained, tag)) {
+            rejectedCount++;
+            return false;
+        }
+        return true;
+    }
+
+    bool publish(const char *topic, const char *payload, bool retained, uint8_t qos, uint8_t tag = 0) {
+        return publish(topic, (const uint8_t *)payload, strlen(payload), retained, qos, tag);
+    }
+
+    void loop() {
+        if (linkState == MQTT_LINK_DOWN) return;
+        if (!net.connected()) { drop(true); return; }
+        if (!readPackets()) return;
+
+        unsigned long now = millis();
+        if (linkState == MQTT_LINK_CONNECTING) {
+            if (now - stateSinceMs > MQTT_CONNACK_TIMEOUT_MS) {
+                lastConnackCode = 0xFE;
+                drop(true);
+            }
+            return;
+        }
+
+        unsigned long oldest;
+        if (outbox.oldestInflight(&oldest) && now - oldest > MQTT_ACK_TIMEOUT_MS) {
+            Serial.println("[MQTT] PUBACK overdue; reconnecting.");
+            drop(true);
+            return;
+        }
+        if (!flushOutbox()) return;
+
+        unsigned long keepAliveMs = keepAliveSec * 1000UL;
+        if (pingOutstanding && now - pingSentMs > keepAliveMs) {
+            Serial.println("[MQTT] No PINGRESP; reconnecting.");
+            drop(true);
+        } else if (!pingOutstanding && keepAliveMs && now - lastOutMs >= keepAliveMs) {
+            const uint8_t pkt[2] = {0xC0, 0x00};
+            if (writeAll(pkt, sizeof(pkt))) {
+                pingOutstanding = true;
+                pingSentMs = now;
+            }
+        }
+    }
+
+    bool connected() const { return linkState == MQTT_LINK_UP; }
+    MqttLinkState state() const { return linkState; }
+    // 0 accepted, 1..5 CONNACK refusal, 0xFE CONNACK timeout, 0xFF TCP failure
+    uint8_t connackCode() const { return lastConnackCode; }
+    // Waiting on the broker: CONNACK, a PUBACK or a PINGRESP
+    bool awaitingBroker() const {
+        return linkState == MQTT_LINK_CONNECTING || outbox.size() || pingOutstanding;
+    }
+
+    uint8_t queued() const { return outbox.size(); }
+    uint8_t inflight() const { return outbox.inflight(); }
+    uint16_t queuedBytes() const { return outbox.bytesUsed(); }
+    uint32_t sent() const { return sentCount; }           // PUBLISH packets written, incl. resends
+    uint32_t delivered() const { return ackedCount; }     // PUBACKs matched
+    uint32_t rejected() const { return rejectedCount; }   // publish() refused: outbox full
+    uint32_t droppedStale() const { return staleCount; }  // unsent QoS 0 dropped on disconnect
+
+private:
+    WiFiClient &net;
+    const char *host = "";
+    uint16_t port = 1883;
+    uint16_t keepAliveSec = 60;
+    const char *clientId = "", *user = NULL, *pass = NULL;
+    const char *willTopic = NULL, *willMessage = NULL;
+    uint8_t willQos = 0;
+    bool willRetain = false;
+    MessageCallback onMessage = NULL;
+    DeliveredCallback onDelivered = NULL;
+    EventCallback onEvent = NULL;
+
+    const char *subscriptions[MQTT_MAX_SUBSCRIPTIONS];
+    uint8_t subscriptionCount = 0;
+
+    MqttOutbox<MQTT_OUTBOX_BYTES, MQTT_OUTBOX_SLOTS> outbox;
+    MqttLinkState linkState = MQTT_LINK_DOWN;
+    uint8_t lastConnackCode = 0;
+    unsigned long stateSinceMs = 0, lastOutMs = 0, pingSentMs = 0;
+    bool pingOutstanding = false;
+    uint16_t nextPacketId = 1;
+    uint32_t sentCount = 0, ackedCount = 0, rejectedCount = 0, staleCount = 0;
+
+    // Inbound packet being assembled across loop() calls
+    enum RxStage : uint8_t { RX_HEADER, RX_LENGTH, RX_BODY };
+    RxStage rxStage;
+    uint8_t rxType, rxLenShift;
+    uint32_t rxRemaining, rxGot;
+    uint8_t rxBuf[MQTT_RX_BUFFER_SIZE + 1];
+
+    void emit(MqttLinkEvent e) { if (onEvent) onEvent(e); }
+
+    void closeSocket() {
+        net.stop();
+        linkState = MQTT_LINK_DOWN;
+        stateSinceMs = millis();
+    }
+
+    void drop(bool notify) {
+        bool wasUp = linkState == MQTT_LINK_UP;
+        closeSocket();
+        staleCount += outbox.connectionLost();
+        if (notify) emit(wasUp ? MQTT_EVENT_DISCONNECTED : MQTT_EVENT_CONNECT_FAILED);
+    }
+
+    uint16_t takePacketId() {
+        uint16_t id = nextPacketId++;
+        if (nextPacketId == 0) nextPacketId = 1;
+        return id;
+    }
+
+    bool writeAll(const uint8_t *buf, size_t len) {
+        if (len && net.write(buf, len) != len) {
+            drop(true);
+            return false;
+        }
+        lastOutMs = millis();
+        return true;
+    }
+
+    // Fixed header byte + remaining-length varint; returns bytes used
+    static uint8_t encodeHeader(uint8_t *out, uint8_t type, uint32_t remaining) {
+        uint8_t n = 0;
+        out[n++] = type;
+        do {
+            uint8_t b = remaining & 0x7F;
+            remaining >>= 7;
+            out[n++] = remaining ? b | 0x80 : b;
+        } while (remaining);
+        return n;
+    }
+
+    static uint8_t *putString(uint8_t *p, const char *s, uint16_t len) {
+        *p++ = len >> 8;
+        *p++ = len & 0xFF;
+        memcpy(p, s, len);
+        return p + len;
+    }
+
+    bool sendConnect() {
+        uint16_t idLen = strlen(clientId);
+        uint16_t willTopicLen = willTopic ? strlen(willTopic) : 0;
+        uint16_t willMsgLen = willTopic ? strlen(willMessage) : 0;
+        uint16_t userLen = user ? strlen(user) : 0;
+        uint16_t passLen = pass ? strlen(pass) : 0;
+
+        uint32_t remaining = 10 + 2 + idLen;
+        uint8_t flags = 0x02;   // clean session
+        if (willTopic) {
+            remaining += 2 + willTopicLen + 2 + willMsgLen;
+            flags |= 0x04 | (willQos << 3) | (willRetain ? 0x20 : 0);
+        }
+        if (user) { remaining += 2 + userLen; flags |= 0x80; }
+        if (pass) { remaining += 2 + passLen; flags |= 0x40; }
+        if (remaining + 5 > MQTT_RX_BUFFER_SIZE) { drop(true); return false; }
+
+        // rxBuf is idle until CONNACK, so CONNECT is built in it
+        uint8_t *p = rxBuf + encodeHeader(rxBuf, 0x10, remaining);
+        p = putString(p, "MQTT", 4);
+        *p++ = 4;   // protocol level 3.1.1
+        *p++ = flags;
+        *p++ = keepAliveSec >> 8;
+        *p++ = keepAliveSec & 0xFF;
+        p = putString(p, clientId, idLen);
+        if (willTopic) {
+            p = putString(p, willTopic, willTopicLen);
+            p = putString(p, willMessage, willMsgLen);
+        }
+        if (user) p = putString(p, user, userLen);
+        if (pass) p = putString(p, pass, passLen);
+        return writeAll(rxBuf, p - rxBuf);
+    }
+
+    bool sendSubscriptions() {
+        if (subscriptionCount == 0) return true;
+        uint32_t remaining = 2;
+        for (uint8_t i = 0; i < subscriptionCount; i++) remaining += 2 + strlen(subscriptions[i]) + 1;
+        uint8_t hdr[5];
+        uint8_t n = encodeHeader(hdr, 0x82, remaining);
+        uint16_t id = takePacketId();
+        hdr[n++] = id >> 8;
+        hdr[n++] = id & 0xFF;
+        if (!writeAll(hdr, n)) return false;
+        for (uint8_t i = 0; i < subscriptionCount; i++) {
+            uint16_t len = strlen(subscriptions[i]);
+            uint8_t lenBytes[2] = {(uint8_t)(len >> 8), (uint8_t)(len & 0xFF)};
+            const uint8_t qos = 0;
+            if (!writeAll(lenBytes, 2) || !writeAll((const uint8_t *)subscriptions[i], len) || !writeAll(&qos, 1))
+                return false;
+        }
+        return true;
+    }
+
+    bool sendPublish(MqttOutboxEntry &e) {
+        if (e.qos && e.packetId == 0) e.packetId = takePacketId();
+        uint32_t remaining = 2 + e.topicLen + (e.qos ? 2 : 0) + e.payloadLen;
+        uint8_t type = 0x30 | (e.dup ? 0x08 : 0) | (e.qos << 1) | (e.retained ? 0x01 : 0);
+        uint8_t hdr[9];
+        uint8_t n = encodeHeader(hdr, type, remaining);
+        hdr[n++] = e.topicLen >> 8;
+        hdr[n++] = e.topicLen & 0xFF;
+        if (!writeAll(hdr, n) || !writeAll((const uint8_t *)outbox.topic(e), e.topicLen)) return false;
+        if (e.qos) {
+            uint8_t id[2] = {(uint8_t)(e.packetId >> 8), (uint8_t)(e.packetId & 0xFF)};
+            if (!writeAll(id, 2)) return false;
+        }
+        if (!writeAll(outbox.payload(e), e.payloadLen)) return false;
+        sentCount++;
+        outbox.markWritten(e, millis());
+        return true;
+    }
+
+    bool flushOutbox() {
+        MqttOutboxEntry *e;
+        while ((e = outbox.nextToSend(MQTT_MAX_INFLIGHT)) != NULL) {
+            if (!sendPublish(*e)) return false;
+        }
+        return true;
+    }
+
+    void resetRx() {
+        rxStage = RX_HEADER;
+        rxRemaining = rxGot = 0;
+        rxLenShift = 0;
+    }
+
+    // Drains the socket without waiting; false if the link was dropped
+    bool readPackets() {
+        while (linkState != MQTT_LINK_DOWN && net.available() > 0) {
+            int c = net.read();
+            if (c < 0) break;
+            uint8_t b = (uint8_t)c;
+            switch (rxStage) {
+                case RX_HEADER:
+                    rxType = b;
+                    rxRemaining = rxGot = 0;
+                    rxLenShift = 0;
+                    rxStage = RX_LENGTH;
+                    break;
+                case RX_LENGTH:
+                    rxRemaining |= (uint32_t)(b & 0x7F) << rxLenShift;
+                    rxLenShift += 7;
+                    if (b & 0x80) {
+                        if (rxLenShift > 21) { drop(true); return false; }
+                        break;
+                    }
+                    rxStage = RX_BODY;
+                    if (rxRemaining == 0 && !handlePacket()) return false;
+                    break;
+                case RX_BODY:
+                    // Bytes past the buffer are read and discarded
+                    if (rxGot < MQTT_RX_BUFFER_SIZE) rxBuf[rxGot] = b;
+                    if (++rxGot == rxRemaining && !handlePacket()) return false;
+                    break;
+            }
+        }
+        return linkState != MQTT_LINK_DOWN;
+    }
+
+    bool handlePacket() {
+        rxStage = RX_HEADER;
+        uint32_t len = rxGot;
+        bool truncated = len > MQTT_RX_BUFFER_SIZE;
+        switch (rxType >> 4) {
+            case 2:   // CONNACK
+                if (linkState != MQTT_LINK_CONNECTING || len < 2) break;
+                lastConnackCode = rxBuf[1];
+                if (lastConnackCode != 0) { drop(true); return false; }
+                linkState = MQTT_LINK_UP;
+                stateSinceMs = millis();
+                if (!sendSubscriptions()) return false;
+                emit(MQTT_EVENT_CONNECTED);
+                return flushOutbox();
+            case 3:   // PUBLISH
+                if (!truncated) return handlePublish(len);
+                Serial.printf("[MQTT] Inbound message of %lu bytes dropped (buffer %u).\n",
+                              (unsigned long)len, (unsigned)MQTT_RX_BUFFER_SIZE);
+                break;
+            case 4: { // PUBACK
+                if (len < 2) break;
+                uint8_t tag = 0;
+                if (outbox.acknowledge(((uint16_t)rxBuf[0] << 8) | rxBuf[1], &tag)) {
+                    ackedCount++;
+                    if (tag && onDelivered) onDelivered(tag);
+                }
+                break;
+            }
+            case 13:  // PINGRESP
+                pingOutstanding = false;
+                break;
+            default:  // SUBACK and anything else: nothing to do
+                break;
+        }
+        return true;
+    }
+
+    // Topic is moved down a byte so it can be NUL-terminated in place
+    bool handlePublish(uint32_t len) {
+        if (len < 2) return true;
+        uint8_t qos = (rxType >> 1) & 0x03;
+        uint16_t topicLen = ((uint16_t)rxBuf[0] << 8) | rxBuf[1];
+        uint32_t payloadAt = 2 + topicLen + (qos ? 2 : 0);
+        if (payloadAt > len) return true;
+        uint16_t packetId = qos ? ((uint16_t)rxBuf[2 + topicLen] << 8) | rxBuf[3 + topicLen] : 0;
+
+        memmove(rxBuf + 1, rxBuf + 2, topicLen);
+        rxBuf[1 + topicLen] = '\0';
+        uint8_t *payload = rxBuf + payloadAt;
+        payload[len - payloadAt] = '\0';   // rxBuf has a spare byte for this
+        if (onMessage) onMessage((char *)rxBuf + 1, payload, len - payloadAt);
+
+        if (qos == 1) {
+            uint8_t pkt[4] = {0x40, 0x02, (uint8_t)(packetId >> 8), (uint8_t)(packetId & 0xFF)};
+            return writeAll(pkt, sizeof(pkt));
+        }
+        return linkState != MQTT_LINK_DOWN;
+    }
+};
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef MY_MQTTOUTBOX_H
+#define MY_MQTTOUTBOX_H
+
+#include <Arduino.h>
+
+// ==================================
+// === MQTT Outbound Queue ==========
+// ==================================
+// Bounded FIFO of publishes waiting to be written or acknowledged. Topic and
+// payload are copied into one static byte ring (each record contiguous; a
+// record that does not fit before the end starts over at offset 0), and a
+// ring of Slots entries keeps their order and delivery state. Entries are
+// sent strictly in order; QoS 0 entries are done once written, QoS 1
+// entries stay in flight until their PUBACK. Space is reclaimed from the
+// front as soon as the oldest entry is done, so a PUBACK that arrives out
+// of order only frees space once everything before it is done too.
+// Used by one task (the comms task); no locking.
+
+enum MqttEntryState : uint8_t { MQTT_ENTRY_QUEUED, MQTT_ENTRY_INFLIGHT, MQTT_ENTRY_DONE };
+
+struct MqttOutboxEntry {
+    uint16_t offset;        // topic, then payload, in the byte ring
+    uint16_t topicLen;
+    uint16_t payloadLen;
+    uint16_t packetId;      // QoS 1, 0 until first sent
+    uint8_t qos;
+    bool retained;
+    bool dup;               // resent after a reconnect
+    uint8_t tag;            // caller's delivery tag, 0 = none
+    MqttEntryState state;
+    unsigned long sentMs;
+};
+
+template <uint16_t Bytes, uint8_t Slots>
+class MqttOutbox {
+public:
+    MqttOutbox() { clear(); }
+
+    void clear() {
+        head = count = 0;
+        dataHead = dataTail = 0;
+        inflightCount = 0;
+    }
+
+    // Copies topic and payload; false when either ring is full
+    bool push(const char *topic, const uint8_t *payload, uint16_t len, uint8_t qos, bool retained, uint8_t tag) {
+        uint16_t topicLen = strlen(topic);
+        uint32_t need = (uint32_t)topicLen + len;
+        if (count >= Slots || need > Bytes) return false;
+        int32_t at = alloc(need);
+        if (at < 0) return false;
+
+        MqttOutboxEntry &e = entries[(head + count) % Slots];
+        e.offset = at;
+        e.topicLen = topicLen;
+        e.payloadLen = len;
+        e.packetId = 0;
+        e.qos = qos ? 1 : 0;
+        e.retained = retained;
+        e.dup = false;
+        e.tag = tag;
+        e.state = MQTT_ENTRY_QUEUED;
+        e.sentMs = 0;
+        memcpy(data + at, topic, topicLen);
+        memcpy(data + at + topicLen, payload, len);
+        count++;
+        return true;
+    }
+
+    // Oldest entry still to be written, or NULL. A QoS 1 entry waits while
+    // maxInflight are outstanding, and everything behind it waits too.
+    MqttOutboxEntry *nextToSend(uint8_t maxInflight) {
+        for (uint8_t i = 0; i < count; i++) {
+            MqttOutboxEntry &e = at(i);
+            if (e.state != MQTT_ENTRY_QUEUED) continue;
+            if (e.qos && inflightCount >= maxInflight) return NULL;
+            return &e;
+        }
+        return NULL;
+    }
+
+    void markWritten(MqttOutboxEntry &e, unsigned long nowMs) {
+        e.sentMs = nowMs;
+        if (e.qos) {
+            e.state = MQTT_ENTRY_INFLIGHT;
+            inflightCount++;
+        } else {
+            e.state = MQTT_ENTRY_DONE;
+            reclaim();
+        }
+    }
+
+    // PUBACK: completes the in-flight entry; returns false for an unknown id
+    bool acknowledge(uint16_t packetId, uint8_t *tagOut) {
+        for (uint8_t i = 0; i < count; i++) {
+            MqttOutboxEntry &e = at(i);
+            if (e.state != MQTT_ENTRY_INFLIGHT || e.packetId != packetId) continue;
+            e.state = MQTT_ENTRY_DONE;
+            inflightCount--;
+            if (tagOut) *tagOut = e.tag;
+            reclaim();
+            return true;
+        }
+        return false;
+    }
+
+    // Connection lost: in-flight entries go again (DUP) on the next
+    // connection; unsent QoS 0 entries are stale by then and are dropped.
+    // Returns the number dropped.
+    uint8_t connectionLost() {
+        uint8_t dropped = 0;
+        for (uint8_t i = 0; i < count; i++) {
+            MqttOutboxEntry &e = at(i);
+            if (e.state == MQTT_ENTRY_INFLIGHT) {
+                e.state = MQTT_ENTRY_QUEUED;
+                e.dup = true;
+            } else if (e.state == MQTT_ENTRY_QUEUED && e.qos == 0) {
+                e.state = MQTT_ENTRY_DONE;
+                dropped++;
+            }
+        }
+        inflightCount = 0;
+        reclaim();
+        return dropped;
+    }
+
+    // sentMs of the oldest in-flight entry; false if none
+    bool oldestInflight(unsigned long *sentMs) {
+        for (uint8_t i = 0; i < count; i++) {
+            if (at(i).state != MQTT_ENTRY_INFLIGHT) continue;
+            *sentMs = at(i).sentMs;
+            return true;
+        }
+        return false;
+    }
+
+    const char *topic(const MqttOutboxEntry &e) const { return (const char *)data + e.offset; }
+    const uint8_t *payload(const MqttOutboxEntry &e) const { return data + e.offset + e.topicLen; }
+
+    uint8_t size() const { return count; }
+    uint8_t inflight() const { return inflightCount; }
+    uint16_t bytesUsed() const {
+        if (count == 0) return 0;
+        return dataTail > dataHead ? dataTail - dataHead : Bytes - dataHead + dataTail;
+    }
+
+private:
+    MqttOutboxEntry entries[Slots];
+    uint8_t head, count, inflightCount;
+    uint8_t data[Bytes];
+    uint16_t dataHead, dataTail;    // oldest live byte, next free byte
+
+    MqttOutboxEntry &at(uint8_t i) { return entries[(head + i) % Slots]; }
+
+    int32_t alloc(uint32_t n) {
+        if (count == 0) dataHead = dataTail = 0;
+        uint16_t start;
+        if (count == 0 || dataTail > dataHead) {
+            if ((uint32_t)(Bytes - dataTail) >= n) start = dataTail;
+            else if (dataHead >= n) start = 0;    // skip the unused end
+            else return -1;
+        } else {
+            // Wrapped: free space is between tail and head (none if equal)
+            if ((uint32_t)(dataHead - dataTail) < n) return -1;
+            start = dataTail;
+        }
+        dataTail = start + n;
+        return start;
+    }
+
+    void reclaim() {
+        while (count && entries[head].state == MQTT_ENTRY_DONE) {
+            head = (head + 1) % Slots;
+            count--;
+        }
+        if (count == 0) dataHead = dataTail = 0;
+        else dataHead = entries[head].offset;
+    }
+};
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef MY_HAL_NEOPIXEL_H
+#define MY_HAL_NEOPIXEL_H
+
+#include <Arduino.h>
+
+// ==================================
+// === Host HAL: NeoPixel ===========
+// ==================================
+// Status LEDs are write-only; keep the last colour per pixel for inspection.
+#define NEO_GRB      0x52
+#define NEO_KHZ800   0x0000
+
+class Adafruit_NeoPixel {
+public:
+  Adafruit_NeoPixel(uint16_t n, int16_t pin, uint16_t type) : count(n) { (void)pin; (void)type; }
+
+  void begin() {}
+  void show() {}
+  void setBrightness(uint8_t b) { (void)b; }
+  void setPixelColor(uint16_t n, uint32_t c) { if (n < count && n < 8) colors[n] = c; }
+  static uint32_t Color(uint8_t r, uint8_t g, uint8_t b) { return ((uint32_t)r << 16) | ((uint32_t)g << 8) | b; }
+
+  uint32_t colors[8] = {};
+
+private:
+  uint16_t count;
+};
+
+#endif
@@ -0,0 +1,216 @@
+#ifndef MY_HAL_ARDUINO_H
+#define MY_HAL_ARDUINO_H
+
+// ==================================
+// === Host HAL: Arduino core =======
+// ==================================
+// Just enough of the ESP32 Arduino core for the firmware headers to build
+// and run on Linux (env:native). Time is virtual: nothing advances until
+// the driver calls halAdvanceMs()/halAdvanceUs(), so a replay runs as fast
+// as the CPU allows. time() is routed to the same clock.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <string>
+#include <algorithm>
+
+#define IRAM_ATTR
+#define RTC_NOINIT_ATTR
+#define RTC_DATA_ATTR
+
+#define HIGH 1
+#define LOW  0
+#define INPUT        0x01
+#define OUTPUT       0x03
+#define INPUT_PULLUP 0x05
+#define RISING  0x01
+#define FALLING 0x02
+#define CHANGE  0x03
+#define PIN_NEOPIXEL 0
+
+typedef uint8_t byte;
+using std::min;
+using std::max;
+
+// === Virtual Clock ===
+static uint64_t halNowUs = 0;
+static time_t halEpochBase = 0;     // epoch at halNowUs == 0; 0 = clock never set
+
+inline void halAdvanceUs(uint64_t us) { halNowUs += us; }
+inline void halAdvanceMs(uint32_t ms) { halNowUs += (uint64_t)ms * 1000ULL; }
+inline void halSetEpoch(time_t epoch) { halEpochBase = epoch - (time_t)(halNowUs / 1000000ULL); }
+
+inline unsigned long millis() { return (unsigned long)(halNowUs / 1000ULL); }
+inline unsigned long micros() { return (unsigned long)halNowUs; }
+inline void delay(unsigned long ms) { halAdvanceMs(ms); }
+inline void delayMicroseconds(unsigned int us) { halAdvanceUs(us); }
+inline void yield() {}
+
+inline time_t halTime(time_t *out) {
+  time_t now = halEpochBase ? halEpochBase + (time_t)(halNowUs / 1000000ULL) : (time_t)(halNowUs / 1000000ULL);
+  if (out) *out = now;
+  return now;
+}
+#define time(out) halTime(out)
+
+inline bool getLocalTime(struct tm *info, uint32_t ms = 5000) {
+  (void)ms;
+  time_t now = halTime(NULL);
+  if (now < 1600000000) return false;
+  localtime_r(&now, info);
+  return true;
+}
+
+inline void configTzTime(const char *tz, const char *server1, const char *server2 = NULL, const char *server3 = NULL) {
+  (void)server1; (void)server2; (void)server3;
+  setenv("TZ", tz, 1);
+  tzset();
+}
+
+// === GPIO ===
+#define HAL_PIN_COUNT 40
+static uint8_t halPinLevel[HAL_PIN_COUNT];
+static uint8_t halPinModeOf[HAL_PIN_COUNT];
+static void (*halIsr[HAL_PIN_COUNT])(void *);
+static void *halIsrArg[HAL_PIN_COUNT];
+
+inline void pinMode(uint8_t pin, uint8_t mode) {
+  if (pin >= HAL_PIN_COUNT) return;
+  halPinModeOf[pin] = mode;
+  if (mode == INPUT_PULLUP) halPinLevel[pin] = HIGH;
+}
+inline void digitalWrite(uint8_t pin, uint8_t val) { if (pin < HAL_PIN_COUNT) halPinLevel[pin] = val ? HIGH : LOW; }
+inline int digitalRead(uint8_t pin) { return pin < HAL_PIN_COUNT ? halPinLevel[pin] : LOW; }
+inline int digitalPinToInterrupt(uint8_t pin) { return pin; }
+
+inline void attachInterruptArg(uint8_t pin, void (*fn)(void *), void *arg, int mode) {
+  (void)mode;
+  if (pin >= HAL_PIN_COUNT) return;
+  halIsr[pin] = fn;
+  halIsrArg[pin] = arg;
+}
+inline void detachInterrupt(uint8_t pin) { if (pin < HAL_PIN_COUNT) halIsr[pin] = NULL; }
+
+// Fire the edge interrupt attached to pin (ISR pulse backend)
+inline void halPulse(uint8_t pin) { if (pin < HAL_PIN_COUNT && halIsr[pin]) halIsr[pin](halIsrArg[pin]); }
+
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+// Deterministic so replays are repeatable
+static uint32_t halRandomState = 0x12345678;
+inline uint32_t esp_random() {
+  uint32_t x = halRandomState;
+  x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+  return halRandomState = x;
+}
+
+// Reset cause (esp_system.h); a replay starts from power-on and may
+// simulate a warm restart by changing it
+typedef enum {
+  ESP_RST_UNKNOWN, ESP_RST_POWERON, ESP_RST_EXT, ESP_RST_SW, ESP_RST_PANIC, ESP_RST_INT_WDT,
+  ESP_RST_TASK_WDT, ESP_RST_WDT, ESP_RST_DEEPSLEEP, ESP_RST_BROWNOUT, ESP_RST_SDIO
+} esp_reset_reason_t;
+static esp_reset_reason_t halResetReason = ESP_RST_POWERON;
+inline esp_reset_reason_t esp_reset_reason() { return halResetReason; }
+
+// === String ===
+class String {
+public:
+  String() {}
+  String(const char *c) : s(c ? c : "") {}
+  String(const std::string &x) : s(x) {}
+  String(char c) : s(1, c) {}
+  String(int v) : s(std::to_string(v)) {}
+  String(unsigned int v) : s(std::to_string(v)) {}
+  String(long v) : s(std::to_string(v)) {}
+  String(unsigned long v) : s(std::to_string(v)) {}
+
+  const char *c_str() const { return s.c_str(); }
+  unsigned int length() const { return (unsigned int)s.size(); }
+  bool startsWith(const String &p) const { return s.compare(0, p.s.size(), p.s) == 0; }
+  void reserve(unsigned int n) { s.reserve(n); }
+  char operator[](unsigned int i) const { return s[i]; }
+
+  String &operator+=(const String &o) { s += o.s; return *this; }
+  String &operator+=(const char *o) { s += o; return *this; }
+  String &operator+=(char c) { s += c; return *this; }
+  bool operator==(const String &o) const { return s == o.s; }
+  bool operator==(const char *o) const { return s == o; }
+  bool operator!=(const String &o) const { return s != o.s; }
+  bool operator!=(const char *o) const { return s != o; }
+
+  friend String operator+(const String &a, const String &b) { return String(a.s + b.s); }
+  friend String operator+(const String &a, const char *b) { return String(a.s + b); }
+  friend String operator+(const char *a, const String &b) { return String(std::string(a) + b.s); }
+
+private:
+  std::string s;
+};
+
+// === Serial ===
+// Silent unless halSerialEcho is set; the firmware logs every tick.
+static bool halSerialEcho = false;
+
+class HardwareSerial {
+public:
+  void begin(unsigned long baud) { (void)baud; }
+
+  int printf(const char *fmt, ...) __attribute__((format(printf, 2, 3))) {
+    if (!halSerialEcho) return 0;
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vprintf(fmt, ap);
+    va_end(ap);
+    return n;
+  }
+
+  size_t print(const char *v) { return out("%s", v); }
+  size_t print(const String &v) { return out("%s", v.c_str()); }
+  size_t print(char v) { return out("%c", v); }
+  size_t print(int v) { return out("%d", v); }
+  size_t print(unsigned int v) { return out("%u", v); }
+  size_t print(long v) { return out("%ld", v); }
+  size_t print(unsigned long v) { return out("%lu", v); }
+  size_t print(double v, int digits = 2) { return out("%.*f", digits, v); }
+
+  size_t println() { return out("\n"); }
+  template <typename T> size_t println(const T &v) { return print(v) + println(); }
+
+private:
+  size_t out(const char *fmt, ...) __attribute__((format(printf, 2, 3))) {
+    if (!halSerialEcho) return 0;
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vprintf(fmt, ap);
+    va_end(ap);
+    return n > 0 ? (size_t)n : 0;
+  }
+};
+
+// Serial and ESP are marked unused: not every host test prints or reads ESP
+static HardwareSerial Serial __attribute__((unused));
+
+// === ESP ===
+static bool halRestartRequested = false;
+
+// The cycle counter follows the virtual clock at a nominal 240 MHz
+#define HAL_CPU_MHZ 240
+
+class EspClass {
+public:
+  void restart() { halRestartRequested = true; }
+  uint32_t getCycleCount() { return (uint32_t)(halNowUs * HAL_CPU_MHZ); }
+};
+
+static EspClass ESP __attribute__((unused));
+
+inline uint32_t getCpuFrequencyMhz() { return HAL_CPU_MHZ; }
+
+#endif
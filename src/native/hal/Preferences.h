@@ -0,0 +1,91 @@
+#ifndef MY_HAL_PREFERENCES_H
+#define MY_HAL_PREFERENCES_H
+
+#include <Arduino.h>
+#include <map>
+#include <string>
+#include <vector>
+
+// ==================================
+// === Host HAL: Preferences ========
+// ==================================
+// NVS held in memory for the life of the process: namespace -> key -> bytes.
+// halNvsWrites counts put* calls so replays can report flash wear.
+
+typedef std::map<std::string, std::vector<uint8_t> > HalNvsNamespace;
+static std::map<std::string, HalNvsNamespace> halNvs;
+static uint32_t halNvsWrites = 0;
+
+class Preferences {
+public:
+  bool begin(const char *name, bool readOnly = false, const char *partition = NULL) {
+    (void)partition;
+    if (readOnly && !halNvs.count(name)) return false;
+    ns = &halNvs[name];
+    ro = readOnly;
+    return true;
+  }
+  void end() { ns = NULL; }
+
+  bool clear() { if (!writable()) return false; ns->clear(); return true; }
+  bool remove(const char *key) { return writable() && ns->erase(key) > 0; }
+  bool isKey(const char *key) { return ns && ns->count(key); }
+
+  size_t putBytes(const char *key, const void *value, size_t len) {
+    if (!writable()) return 0;
+    const uint8_t *p = (const uint8_t *)value;
+    (*ns)[key] = std::vector<uint8_t>(p, p + len);
+    halNvsWrites++;
+    return len;
+  }
+  size_t getBytesLength(const char *key) {
+    const std::vector<uint8_t> *v = find(key);
+    return v ? v->size() : 0;
+  }
+  size_t getBytes(const char *key, void *buf, size_t maxLen) {
+    const std::vector<uint8_t> *v = find(key);
+    if (!v || v->size() > maxLen) return 0;
+    memcpy(buf, v->data(), v->size());
+    return v->size();
+  }
+
+  size_t putFloat(const char *key, float v) { return putBytes(key, &v, sizeof(v)); }
+  size_t putInt(const char *key, int32_t v) { return putBytes(key, &v, sizeof(v)); }
+  size_t putUInt(const char *key, uint32_t v) { return putBytes(key, &v, sizeof(v)); }
+  size_t putBool(const char *key, bool v) { uint8_t b = v; return putBytes(key, &b, 1); }
+  size_t putString(const char *key, const char *v) { return putBytes(key, v, strlen(v) + 1); }
+  size_t putString(const char *key, const String &v) { return putString(key, v.c_str()); }
+
+  float getFloat(const char *key, float def = 0) { return get(key, def); }
+  int32_t getInt(const char *key, int32_t def = 0) { return get(key, def); }
+  uint32_t getUInt(const char *key, uint32_t def = 0) { return get(key, def); }
+  bool getBool(const char *key, bool def = false) { return get<uint8_t>(key, def) != 0; }
+
+  size_t getString(const char *key, char *buf, size_t maxLen) { return getBytes(key, buf, maxLen); }
+  String getString(const char *key, const String &def = String()) {
+    const std::vector<uint8_t> *v = find(key);
+    return v ? String((const char *)v->data()) : def;
+  }
+
+private:
+  HalNvsNamespace *ns = NULL;
+  bool ro = false;
+
+  bool writable() const { return ns && !ro; }
+
+  const std::vector<uint8_t> *find(const char *key) const {
+    if (!ns) return NULL;
+    HalNvsNamespace::const_iterator it = ns->find(key);
+    return it == ns->end() ? NULL : &it->second;
+  }
+
+  template <typename T> T get(const char *key, T def) {
+    const std::vector<uint8_t> *v = find(key);
+    if (!v || v->size() != sizeof(T)) return def;
+    T out;
+    memcpy(&out, v->data(), sizeof(T));
+    return out;
+  }
+};
+
+#endif
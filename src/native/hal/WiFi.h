@@ -0,0 +1,186 @@
+#ifndef MY_HAL_WIFI_H
+#define MY_HAL_WIFI_H
+
+#include <Arduino.h>
+#include <functional>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include "halMqttBroker.h"
+
+// ==================================
+// === Host HAL: WiFi ===============
+// ==================================
+// The link is up or down on the driver's say-so (halSetWifi); begin() only
+// records that an association was requested, like the real stack.
+
+enum { WL_IDLE_STATUS = 0, WL_CONNECTED = 3, WL_DISCONNECTED = 6 };
+#define WIFI_STA 1
+
+typedef int WiFiEvent_t;
+struct WiFiEventInfo_t {};
+enum {
+  ARDUINO_EVENT_WIFI_STA_CONNECTED = 4,
+  ARDUINO_EVENT_WIFI_STA_DISCONNECTED = 5,
+  ARDUINO_EVENT_WIFI_STA_GOT_IP = 7,
+  SYSTEM_EVENT_STA_CONNECTED = ARDUINO_EVENT_WIFI_STA_CONNECTED,
+  SYSTEM_EVENT_STA_DISCONNECTED = ARDUINO_EVENT_WIFI_STA_DISCONNECTED,
+  SYSTEM_EVENT_STA_GOT_IP = ARDUINO_EVENT_WIFI_STA_GOT_IP
+};
+
+class WiFiClass {
+public:
+  typedef std::function<void(WiFiEvent_t, WiFiEventInfo_t)> EventHandler;
+
+  int status() { return up ? WL_CONNECTED : WL_DISCONNECTED; }
+  bool isConnected() { return up; }
+  void begin(const char *ssid, const char *pass) { (void)ssid; (void)pass; beginCount++; }
+  bool disconnect(bool wifiOff = false) { (void)wifiOff; return true; }
+  void persistent(bool v) { (void)v; }
+  void setSleep(bool v) { (void)v; }
+  void setAutoReconnect(bool v) { (void)v; }
+  void mode(int m) { (void)m; }
+  int onEvent(EventHandler fn) { handler = fn; return 1; }
+  const char *localIP() { return "127.0.0.1"; }
+  int RSSI() { return up ? -55 : 0; }
+
+  // Driver side: bring the link up/down and raise the matching events
+  void halSet(bool connected) {
+    if (connected == up) return;
+    up = connected;
+    WiFiEventInfo_t info;
+    if (!handler) return;
+    if (up) {
+      handler(ARDUINO_EVENT_WIFI_STA_CONNECTED, info);
+      handler(ARDUINO_EVENT_WIFI_STA_GOT_IP, info);
+    } else {
+      handler(ARDUINO_EVENT_WIFI_STA_DISCONNECTED, info);
+    }
+  }
+
+  uint32_t beginCount = 0;
+
+private:
+  bool up = false;
+  EventHandler handler;
+};
+
+static WiFiClass WiFi;
+
+inline void halSetWifi(bool connected) { WiFi.halSet(connected); }
+
+// ==================================
+// === Host HAL: WiFiClient =========
+// ==================================
+// By default the socket is a pipe to the in-process loopback broker
+// (halMqttBroker.h). halUseRealSockets(true) makes it a real TCP client
+// instead, e.g. against a local mosquitto. Either way the connection drops
+// when the WiFi link goes down, like the real stack.
+
+static bool halRealSockets = false;
+inline void halUseRealSockets(bool on) { halRealSockets = on; }
+
+class Client {};
+
+class WiFiClient : public Client {
+public:
+  int connect(const char *host, uint16_t port, int32_t timeoutMs) {
+    stop();
+    if (!WiFi.isConnected()) return 0;
+    if (!halRealSockets) {
+      if (!halBrokerUp) return 0;
+      halBroker.accept();
+      open = true;
+      return 1;
+    }
+    return openSocket(host, port, timeoutMs);
+  }
+
+  size_t write(const uint8_t *buf, size_t len) {
+    if (!connected()) return 0;
+    if (!halRealSockets) {
+      halInBroker++;
+      halBroker.receive(buf, len);
+      halInBroker--;
+      return len;
+    }
+    size_t done = 0;
+    while (done < len) {
+      ssize_t n = send(fd, buf + done, len - done, MSG_NOSIGNAL);
+      if (n > 0) { done += n; continue; }
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) { usleep(1000); continue; }
+      stop();
+      break;
+    }
+    return done;
+  }
+
+  int available() {
+    if (!connected()) return 0;
+    if (!halRealSockets) return (int)halBroker.toClient.size();
+    int n = 0;
+    if (ioctl(fd, FIONREAD, &n) < 0) return 0;
+    if (n == 0) {
+      // Readable with nothing queued means the peer closed
+      char c;
+      ssize_t r = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+      if (r == 0 || (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) stop();
+    }
+    return n;
+  }
+
+  int read() {
+    if (!connected()) return -1;
+    if (!halRealSockets) {
+      if (halBroker.toClient.empty()) return -1;
+      uint8_t c = (uint8_t)halBroker.toClient[0];
+      halBroker.toClient.erase(0, 1);
+      return c;
+    }
+    uint8_t c;
+    return recv(fd, &c, 1, MSG_DONTWAIT) == 1 ? c : -1;
+  }
+
+  uint8_t connected() {
+    if (open && (!WiFi.isConnected() || (!halRealSockets && (!halBrokerUp || halBroker.closed)))) stop();
+    return open;
+  }
+
+  void stop() {
+    if (fd >= 0) close(fd);
+    fd = -1;
+    open = false;
+  }
+
+private:
+  bool open = false;
+  int fd = -1;
+
+  int openSocket(const char *host, uint16_t port, int32_t timeoutMs) {
+    char service[8];
+    snprintf(service, sizeof(service), "%u", (unsigned)port);
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, service, &hints, &res) != 0) return 0;
+    fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    struct timeval tv = {(time_t)(timeoutMs / 1000), (suseconds_t)(timeoutMs % 1000) * 1000};
+    if (fd >= 0) setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    bool ok = fd >= 0 && ::connect(fd, res->ai_addr, res->ai_addrlen) == 0;
+    freeaddrinfo(res);
+    if (!ok) { stop(); return 0; }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    open = true;
+    return 1;
+  }
+};
+
+#endif
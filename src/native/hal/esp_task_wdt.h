@@ -0,0 +1,14 @@
+#ifndef MY_HAL_ESP_TASK_WDT_H
+#define MY_HAL_ESP_TASK_WDT_H
+
+// ==================================
+// === Host HAL: Task Watchdog ======
+// ==================================
+typedef int esp_err_t;
+#define ESP_OK 0
+
+inline esp_err_t esp_task_wdt_init(uint32_t timeoutS, bool panic) { (void)timeoutS; (void)panic; return ESP_OK; }
+inline esp_err_t esp_task_wdt_add(void *task) { (void)task; return ESP_OK; }
+inline esp_err_t esp_task_wdt_reset() { return ESP_OK; }
+
+#endif
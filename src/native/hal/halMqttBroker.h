@@ -0,0 +1,130 @@
+#ifndef MY_HAL_MQTTBROKER_H
+#define MY_HAL_MQTTBROKER_H
+
+#include <Arduino.h>
+#include <string>
+#include <vector>
+
+// ==================================
+// === Host HAL: loopback broker ====
+// ==================================
+// Just enough of an MQTT 3.1.1 broker for the replay, living behind the
+// host WiFiClient: CONNECT gets CONNACK, QoS 1 PUBLISH gets PUBACK,
+// SUBSCRIBE gets SUBACK (QoS 0), PINGREQ gets PINGRESP, and a PUBLISH on a
+// subscribed topic (exact match) is echoed back to the client at QoS 0.
+// Responses are queued at once, so they are there on the next read.
+// halBrokerUp = false refuses connections and drops the current one.
+// The broker stands in for the network and allocates freely; halInBroker
+// is set while it runs so tests counting the firmware's own heap use can
+// leave it out.
+
+static bool halBrokerUp = true;
+static int halInBroker = 0;
+
+class HalMqttBroker {
+public:
+  // New TCP connection: nothing carries over from the last one
+  void accept() {
+    fromClient.clear();
+    toClient.clear();
+    subscriptions.clear();
+    connectCount++;
+  }
+
+  void receive(const uint8_t *buf, size_t len) {
+    fromClient.append((const char *)buf, len);
+    for (;;) {
+      size_t hdr, remaining;
+      if (!frame(hdr, remaining)) return;
+      std::string body = fromClient.substr(hdr, remaining);
+      uint8_t type = (uint8_t)fromClient[0];
+      fromClient.erase(0, hdr + remaining);
+      handle(type, (const uint8_t *)body.data(), body.size());
+    }
+  }
+
+  std::string toClient;
+  bool closed = false;          // client sent DISCONNECT
+  uint32_t connectCount = 0;
+  uint32_t publishCount = 0;    // PUBLISH packets received, incl. DUP resends
+
+private:
+  std::string fromClient;
+  std::vector<std::string> subscriptions;
+
+  // Complete packet at the front: header length and remaining length
+  bool frame(size_t &hdr, size_t &remaining) {
+    remaining = 0;
+    for (size_t i = 1, shift = 0; i < fromClient.size() && i <= 4; i++, shift += 7) {
+      uint8_t b = (uint8_t)fromClient[i];
+      remaining |= (size_t)(b & 0x7F) << shift;
+      if (b & 0x80) continue;
+      hdr = i + 1;
+      return fromClient.size() >= hdr + remaining;
+    }
+    return false;
+  }
+
+  void send(uint8_t type, const std::string &body) {
+    toClient += (char)type;
+    size_t n = body.size();
+    do {
+      uint8_t b = n & 0x7F;
+      n >>= 7;
+      toClient += (char)(n ? b | 0x80 : b);
+    } while (n);
+    toClient += body;
+  }
+
+  static std::string str(const uint8_t *p) { return std::string((const char *)p + 2, (p[0] << 8) | p[1]); }
+
+  void handle(uint8_t type, const uint8_t *body, size_t len) {
+    switch (type >> 4) {
+      case 1:   // CONNECT
+        send(0x20, std::string("\0\0", 2));
+        break;
+      case 3: { // PUBLISH
+        publishCount++;
+        uint8_t qos = (type >> 1) & 3;
+        std::string topic = str(body);
+        size_t at = 2 + topic.size();
+        if (qos) {
+          send(0x40, std::string((const char *)body + at, 2));
+          at += 2;
+        }
+        for (size_t i = 0; i < subscriptions.size(); i++) {
+          if (subscriptions[i] != topic) continue;
+          std::string out;
+          out += (char)(topic.size() >> 8);
+          out += (char)(topic.size() & 0xFF);
+          out += topic;
+          out.append((const char *)body + at, len - at);
+          send(0x30, out);
+          break;
+        }
+        break;
+      }
+      case 8: { // SUBSCRIBE
+        std::string ack((const char *)body, 2);
+        for (size_t at = 2; at + 2 < len; ) {
+          std::string topic = str(body + at);
+          at += 2 + topic.size() + 1;
+          subscriptions.push_back(topic);
+          ack += '\0';
+        }
+        send(0x90, ack);
+        break;
+      }
+      case 12:  // PINGREQ
+        send(0xD0, "");
+        break;
+      case 14:  // DISCONNECT
+        closed = true;
+        break;
+    }
+  }
+};
+
+static HalMqttBroker halBroker;
+
+#endif
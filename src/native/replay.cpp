@@ -0,0 +1,560 @@
+// ==================================
+// === Flow Trace Replay (native) ===
+// ==================================
+// Runs the firmware's safety loop and comms path on the host against the
+// HAL shim in src/native/hal, with a virtual clock, so weeks of usage replay
+// in seconds. Pulses come from a trace file or a synthetic household day.
+//
+//   pio run -e native && .pio/build/native/program --days 30 --leak 0.1 --leak-day 10
+//
+// Trace files are CSV lines "seconds,pulses" (seconds from the start of
+// the replay, ascending; '#' starts a comment). Pulses on a tick while the
+// valve is closed are counted as blocked, like a real shutoff valve.
+//
+// The replay drives flow channel 0 (channelConfig.h).
+//
+// At the end the totals are checked for conservation (fed pulses vs
+// volumeAll and vs the sum of hourly reports) and against any --expect-*
+// values; the exit code is non-zero on a mismatch. The flash history
+// (flowHistory.h) is read back tick by tick against what the safety side
+// posted, and the last day is fetched once with get_history.
+//
+// MQTT runs over the firmware's own link (mqttLink.h) to the HAL loopback
+// broker. With --broker host[:port] it talks to a real broker instead
+// (e.g. mosquitto -p 1883 -v); after each tick the replay then waits, in
+// real time, until the outbox has drained. Warning ACKs and the "user's"
+// open_valve commands are published by the replay itself and reach the
+// firmware through the broker either way.
+//
+// --restart-min M simulates a watchdog reset every M minutes: channel 0 is
+// constructed and begun again with the RTC shadow (rtcShadow.h) and NVS as
+// they were, and the warning queue is dropped and restored. The comms
+// side and the broker connection carry on, and the conservation checks
+// must still hold.
+//
+// Every run checks the valve deadline: with the line open in home/away
+// mode, a run (tracked by the replay from the pulses it feeds) must not
+// last longer than waterRunMaxSec plus one tick. --stall-comms-min M stops
+// the comms half of the loop for M minutes out of every 2M, like a comms
+// task stuck in a network call: the safety half keeps ticking, the queue
+// to comms fills up and drops, and the deadline must still be met. Hourly
+// reports and the shutoff warning wait on the safety side until the queue
+// takes them, so the hourly sum must still hold; the history checks are
+// skipped, since the full queue drops history ticks.
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <new>
+
+// Each run gets a fresh payload log directory (filled in by mkdtemp)
+static char replayLogDir[] = "/tmp/flowreplay-XXXXXX";
+#define PAYLOAD_LOG_DIR replayLogDir
+
+#include <wifiComs.h>
+#include "flowMon.h"
+#include "espMqtt.h"
+#include <vector>
+
+// === Options ===
+struct ReplayOptions {
+  const char *tracePath = NULL;
+  uint32_t days = 30;
+  float leakGpm = 0;
+  uint32_t leakDay = 0;
+  int mode = 1;                  // statusMonitor: 0 manual, 1 home, 2 away
+  uint32_t reopenMin = 60;       // "user" reopens a shut valve after this long, 0 = never
+  uint32_t restartMin = 0;       // warm restart of the safety side this often, 0 = never
+  uint32_t stallMin = 0;         // comms stalled M of every 2M minutes, 0 = never
+  uint32_t seed = 1;
+  time_t startEpoch = 1735718400; // 2025-01-01 00:00 PST
+  bool verbose = false;
+  float expectGal = -1;
+  int expectShutoffs = -1;
+  int expectLeakAlerts = -1;
+  const char *broker = NULL;     // host[:port]; NULL = loopback broker
+};
+
+// === Pulse Sources ===
+// Both answer "how many pulses in [t0, t1)" in replay seconds.
+class TraceInput {
+public:
+  bool load(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return false;
+    char line[128];
+    while (fgets(line, sizeof(line), f)) {
+      if (line[0] == '#') continue;
+      double t;
+      unsigned long n;
+      if (sscanf(line, "%lf,%lu", &t, &n) == 2) rows.push_back(Row{t, (uint32_t)n});
+    }
+    fclose(f);
+    return true;
+  }
+
+  uint32_t pulses(double t0, double t1) {
+    (void)t0;
+    uint32_t n = 0;
+    while (next < rows.size() && rows[next].t < t1) n += rows[next++].pulses;
+    return n;
+  }
+
+  double lengthSec() const { return rows.empty() ? 0 : rows.back().t + 1; }
+
+private:
+  struct Row { double t; uint32_t pulses; };
+  std::vector<Row> rows;
+  size_t next = 0;
+};
+
+// A repeatable household day: showers, toilets, kitchen, dishwasher and
+// laundry every third day, plus an optional constant leak.
+class SyntheticInput {
+public:
+  SyntheticInput(const ReplayOptions &opt) : opt(opt), rng(opt.seed ? opt.seed : 1) {}
+
+  uint32_t pulses(double t0, double t1) {
+    uint32_t day0 = (uint32_t)(t0 / 86400);
+    if (day0 != day) buildDay(day0);
+
+    double gal = 0;
+    for (size_t i = 0; i < draws.size(); i++) {
+      double a = std::max(t0, draws[i].start), b = std::min(t1, draws[i].start + draws[i].dur);
+      if (b > a) gal += (b - a) * draws[i].gpm / 60.0;
+    }
+    if (opt.leakGpm > 0 && day0 >= opt.leakDay) gal += (t1 - t0) * opt.leakGpm / 60.0;
+
+    carry += gal * Sampling::pulsesPerGal;
+    uint32_t n = (uint32_t)carry;
+    carry -= n;
+    return n;
+  }
+
+private:
+  struct Draw { double start, dur, gpm; };
+  const ReplayOptions &opt;
+  uint32_t rng;
+  uint32_t day = UINT32_MAX;
+  double carry = 0;
+  std::vector<Draw> draws;
+
+  uint32_t rand32() { rng ^= rng << 13; rng ^= rng >> 17; rng ^= rng << 5; return rng; }
+  double jitterMin(double maxMin) { return (rand32() % (uint32_t)(maxMin * 60 + 1)); }
+
+  void add(double dayStart, double hour, double durSec, double gpm, double jitter = 20) {
+    draws.push_back(Draw{dayStart + hour * 3600 + jitterMin(jitter), durSec, gpm});
+  }
+
+  void buildDay(uint32_t d) {
+    day = d;
+    draws.clear();
+    double s = d * 86400.0;
+    add(s, 6.5, 480, 2.0);                       // shower, 8 min
+    add(s, 7.0, 120, 1.5);                       // kitchen
+    add(s, 18.5, 300, 1.5);                      // dinner
+    for (int i = 0; i < 4; i++) add(s, 20.0 + i * 0.25, 60, 1.5, 2);   // dishwasher fills
+    for (int i = 0; i < 8; i++) add(s, 6.0 + (rand32() % 1020) / 60.0, 60, 1.6, 0);  // toilets
+    if (d % 3 == 0)
+      for (int i = 0; i < 3; i++) add(s, 10.0 + i * 0.4, 300, 3.0, 2); // laundry fills
+  }
+};
+
+// === Replay State ===
+struct ReplayStats {
+  uint64_t ticks = 0;
+  uint64_t fedPulses = 0, blockedPulses = 0;
+  uint32_t hourReports = 0, simpleReports = 0, acks = 0;
+  uint32_t shutoffs = 0, leakAlerts = 0, warnings = 0;
+  uint32_t restarts = 0;
+  uint32_t valveCloses = 0, missedDeadlines = 0;
+  uint32_t maxShutoffRunSec = 0;   // longest run at the tick the valve closed
+  uint64_t stalledTicks = 0;
+  double hourGal = 0;
+  float maxHourGal = 0;
+};
+
+ReplayStats stats;
+ReplayOptions opt;
+std::vector<HistoryTickMsg> historyTicks;   // channel 0, as posted to the comms task
+FlowChannel &channel = flowChannels[0];
+// Publishes the consumer has answered: wID + when it went out
+struct AckedWarning {
+  char id[WARN_ID_LEN];
+  uint32_t sentAtMs;
+};
+static AckedWarning ackedWarnings[WARN_QUEUE_LEN];
+static uint8_t ackedNext = 0;
+
+double replaySec() { return (double)halNowUs / 1e6; }
+
+void printSimTime(const char *what, const char *detail) {
+  char ts[TIME_STR_LEN];
+  formatEpoch((uint32_t)halTime(NULL), ts, sizeof(ts));
+  printf("  [%s] %-24s %s\n", ts, what, detail);
+}
+
+bool alreadyAcked(const PendingWarning &e) {
+  for (uint8_t i = 0; i < WARN_QUEUE_LEN; i++)
+    if (ackedWarnings[i].sentAtMs == e.sentAtMs && strcmp(ackedWarnings[i].id, e.id) == 0) return true;
+  return false;
+}
+
+// The "consumer" acks every warning publish it sees; the ACK comes back
+// through the broker
+void ackNewWarnings() {
+  for (uint8_t i = 0; i < warningQueue.size(); i++) {
+    const PendingWarning &e = warningQueue.at(i);
+    if (!e.sent || alreadyAcked(e)) continue;
+    char ack[160];
+    snprintf(ack, sizeof(ack), "{\"wID\":\"%s\",\"status\":\"ok\",\"receiver\":\"replay\"}", e.id);
+    if (!mqttLink.publish(mqtt_warning_ack_topic, ack, false, 1)) return;
+    AckedWarning &a = ackedWarnings[ackedNext];
+    ackedNext = (ackedNext + 1) % WARN_QUEUE_LEN;
+    copyField(a.id, sizeof(a.id), e.id);
+    a.sentAtMs = e.sentAtMs;
+  }
+}
+
+// Real broker only: let acks and echoes arrive before virtual time moves on
+void settleBroker() {
+  if (!opt.broker) return;
+  for (int waited = 0; waited < 2000; waited++) {
+    mqttLink.loop();
+    if (!mqttLink.awaitingBroker()) return;
+    usleep(1000);
+  }
+}
+
+void tally(const CommsMsg &m) {
+  switch (m.type) {
+    case COMMS_BIG_DATA:
+      if (m.channel != channel.channel()) break;
+      stats.hourReports++;
+      stats.hourGal += m.hour.volumeHour;
+      if (m.hour.volumeHour > stats.maxHourGal) stats.maxHourGal = m.hour.volumeHour;
+      break;
+    case COMMS_SIMPLE_DATA:
+      stats.simpleReports++;
+      break;
+    case COMMS_WARNING:
+      stats.warnings++;
+      if (strcmp(m.warning.title, "Domestic Shutoff") == 0) stats.shutoffs++;
+      else stats.leakAlerts++;
+      printSimTime(m.warning.title, m.warning.message);
+      break;
+    case COMMS_ACK:
+      stats.acks++;
+      break;
+    case COMMS_HISTORY_TICK:
+      if (m.channel == channel.channel() && m.tick.epoch) historyTicks.push_back(m.tick);
+      break;
+    case COMMS_STAGE_STATS:
+      break;
+  }
+}
+
+bool commsStalled() {
+  return opt.stallMin && (uint64_t)(replaySec() / 60) / opt.stallMin % 2 == 1;
+}
+
+// One pass of loop() plus commsTick(), with the queue tapped for tallies
+void replayLoop() {
+  renderNetLed();
+  handleValveCommands();
+  tickValveSequence();
+  flowCalcs();
+
+  if (commsStalled()) {
+    stats.stalledTicks++;
+    return;
+  }
+  connectivityTick();
+  mqttLink.loop();
+  CommsMsg m;
+  while (commsQueue.pop(m)) {
+    tally(m);
+    handleCommsMsg(m);
+  }
+  processWarningAckTick();
+  ackNewWarnings();
+  drainBacklogTick();
+  historyStreamTick();
+  reconnectIfNeeded();
+  settleBroker();
+}
+
+// Reads the whole store back the way get_history does and compares it
+// with the posted ticks; returns the number of ticks that differ
+uint32_t verifyHistory(uint32_t *readBack) {
+  ChannelHistory &h = flowHistory[0];
+  h.flush();
+  const uint32_t tickSec = Sampling::tickSec;
+  size_t j = 0;
+  while (j < historyTicks.size() && historyTicks[j].epoch + tickSec / 2 < h.oldestEpoch()) j++;
+
+  uint32_t bad = 0, from = h.oldestEpoch(), t0 = 0;
+  uint16_t out[HISTORY_MAX_SAMPLES];
+  *readBack = 0;
+  for (uint16_t n; from && (n = h.read(from, UINT32_MAX, out, HISTORY_MAX_SAMPLES, &t0)) > 0; ) {
+    for (uint16_t i = 0; i < n; i++, j++) {
+      uint32_t t = t0 + i * tickSec;
+      if (j >= historyTicks.size() || out[i] != historyTicks[j].pulses ||
+          labs((long)t - (long)historyTicks[j].epoch) > (long)(tickSec / 2)) bad++;
+    }
+    *readBack += n;
+    from = t0 + n * tickSec;
+  }
+  return bad + (uint32_t)(historyTicks.size() - std::min(j, historyTicks.size()));
+}
+
+// get_history for the last day through the broker, as the server would send it
+uint32_t fetchLastDay(uint32_t *expected) {
+  uint32_t to = getEpoch(), from = to - 86400;
+  *expected = 0;
+  for (size_t i = 0; i < historyTicks.size(); i++)
+    if (historyTicks[i].epoch >= from && historyTicks[i].epoch < to) (*expected)++;
+
+  char cmd[96];
+  snprintf(cmd, sizeof(cmd), "{\"cmd\":\"get_history\",\"from\":%lu,\"id\":\"replay\"}", (unsigned long)from);
+  mqttLink.publish(channelTopics[0].command.c_str(), cmd, false, 1);
+  for (int i = 0; i < 10000; i++) {
+    replayLoop();
+    if (historySeq && !historyActive && !historyInFlight) break;
+    if (opt.broker) usleep(100);   // the command's echo is still on its way
+  }
+  return historySamplesSent;
+}
+
+bool parseArgs(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    const char *a = argv[i];
+    const char *v = i + 1 < argc ? argv[i + 1] : NULL;
+    if (!strcmp(a, "--verbose")) { opt.verbose = true; continue; }
+    if (!v) return false;
+    if (!strcmp(a, "--trace")) opt.tracePath = v;
+    else if (!strcmp(a, "--days")) opt.days = strtoul(v, NULL, 10);
+    else if (!strcmp(a, "--leak")) opt.leakGpm = strtof(v, NULL);
+    else if (!strcmp(a, "--leak-day")) opt.leakDay = strtoul(v, NULL, 10);
+    else if (!strcmp(a, "--mode")) opt.mode = atoi(v);
+    else if (!strcmp(a, "--reopen-min")) opt.reopenMin = strtoul(v, NULL, 10);
+    else if (!strcmp(a, "--restart-min")) opt.restartMin = strtoul(v, NULL, 10);
+    else if (!strcmp(a, "--stall-comms-min")) opt.stallMin = strtoul(v, NULL, 10);
+    else if (!strcmp(a, "--seed")) opt.seed = strtoul(v, NULL, 10);
+    else if (!strcmp(a, "--start")) opt.startEpoch = (time_t)strtoll(v, NULL, 10);
+    else if (!strcmp(a, "--expect-gal")) opt.expectGal = strtof(v, NULL);
+    else if (!strcmp(a, "--expect-shutoffs")) opt.expectShutoffs = atoi(v);
+    else if (!strcmp(a, "--expect-leak-alerts")) opt.expectLeakAlerts = atoi(v);
+    else if (!strcmp(a, "--broker")) opt.broker = v;
+    else return false;
+    i++;
+  }
+  return true;
+}
+
+// A task watchdog reset between two ticks, as seen by the safety side
+void warmRestart() {
+  halResetReason = ESP_RST_TASK_WDT;
+  unsetenv("TZ");   // the environment does not survive a reset; setup() sets it again
+  tzset();
+  setenv("TZ", timeZone, 1);
+  tzset();
+  channel.~FlowChannel();
+  new (&channel) FlowChannel(0);
+  channel.begin();
+
+  warningQueue.clear();
+  restorePendingWarnings();
+  stats.restarts++;
+}
+
+bool check(bool ok, const char *what) {
+  if (!ok) printf("FAIL: %s\n", what);
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  if (!parseArgs(argc, argv)) {
+    fprintf(stderr, "usage: %s [--trace file.csv | --days N] [--leak GPM --leak-day D] [--mode 0|1|2]\n"
+                    "          [--reopen-min M] [--restart-min M] [--stall-comms-min M] [--seed S] [--start EPOCH] [--broker HOST[:PORT]] [--verbose]\n"
+                    "          [--expect-gal G] [--expect-shutoffs N] [--expect-leak-alerts N]\n", argv[0]);
+    return 2;
+  }
+  halSerialEcho = opt.verbose;
+
+  TraceInput trace;
+  SyntheticInput synthetic(opt);
+  double lengthSec = opt.days * 86400.0;
+  if (opt.tracePath) {
+    if (!trace.load(opt.tracePath)) { fprintf(stderr, "cannot read %s\n", opt.tracePath); return 2; }
+    lengthSec = trace.lengthSec();
+  }
+
+  if (!mkdtemp(replayLogDir)) { perror("mkdtemp"); return 2; }
+
+  // === Boot, as setup() does ===
+  halSetEpoch(opt.startEpoch);
+  setenv("TZ", timeZone, 1);
+  tzset();
+  startNeoPixel();
+  valveRelaySetup();
+  flowMeterSetup();
+  markBoot(bootTiming.safetyMs);
+  flowHistorySetup();
+  connectToWiFi();
+  mqttSetup();
+  static char brokerHost[64];
+  if (opt.broker) {
+    copyField(brokerHost, sizeof(brokerHost), opt.broker);
+    char *colon = strrchr(brokerHost, ':');
+    uint16_t port = 1883;
+    if (colon) { *colon = '\0'; port = (uint16_t)atoi(colon + 1); }
+    mqttLink.setServer(brokerHost, port);
+    halUseRealSockets(true);
+  }
+  halSetWifi(true);
+  connectivityTick();   // link up + timezone/NTP before the first flow tick
+  reconnectIfNeeded();  // first MQTT attempt is not throttled
+  mqttLink.loop();
+  settleBroker();
+  channel.setValveMode(opt.mode);
+  float startGal = channel.volumeTotal();
+
+  printf("Replaying %.1f days (%s), mode %d\n", lengthSec / 86400.0,
+         opt.tracePath ? opt.tracePath : "synthetic", opt.mode);
+
+  // === Main Loop ===
+  // One iteration per flow tick: the device loop spins continuously, so
+  // flowCalcs() fires at Sampling::tickMs + ~1 ms.
+  clock_t cpuStart = clock();
+  uint64_t closedAtUs = 0;
+  bool wasClosed = channel.isValveClosed();
+  // The replay's own view of the current run, by the firmware's rule: a
+  // run ends after waterRunMinSec without pulses, or when the valve opens
+  uint32_t runSec = 0, quietSec = 0;
+  while (replaySec() < lengthSec) {
+    double t0 = replaySec();
+    halAdvanceMs(Sampling::tickMs + 1);
+    double t1 = replaySec();
+
+    uint32_t n = opt.tracePath ? trace.pulses(t0, t1) : synthetic.pulses(t0, t1);
+    if (digitalRead(flowChannelConfigs[0].valvePin) == HIGH) {
+      stats.blockedPulses += n;
+    } else {
+      channel.pulseInput.addPulses(n);
+      stats.fedPulses += n;
+    }
+
+    replayLoop();
+    stats.ticks++;
+    if (opt.restartMin && stats.ticks % (opt.restartMin * 60 / Sampling::tickSec) == 0) warmRestart();
+
+    bool closed = channel.isValveClosed();
+    if (!closed && n > 0) {
+      runSec += Sampling::tickSec;
+      quietSec = 0;
+    } else {
+      if (quietSec >= waterRunMinSec) runSec = 0;
+      quietSec += Sampling::tickSec;
+    }
+    if (closed && !wasClosed) {
+      closedAtUs = halNowUs;
+      stats.valveCloses++;
+      if (runSec > stats.maxShutoffRunSec) stats.maxShutoffRunSec = runSec;
+    }
+    if (!closed && wasClosed) runSec = quietSec = 0;
+    int mode = channel.mode();
+    if (!closed && mode != 0 && runSec > (uint32_t)waterRunMaxSec[mode] + Sampling::tickSec) {
+      stats.missedDeadlines++;
+      if (stats.missedDeadlines <= 5) printSimTime("Missed valve deadline", commsStalled() ? "(comms stalled)" : "");
+    }
+    wasClosed = closed;
+    if (closed && opt.reopenMin && halNowUs - closedAtUs >= opt.reopenMin * 60000000ULL) {
+      char cmd[32];
+      snprintf(cmd, sizeof(cmd), "{\"cmd\":\"open_valve\"}");
+      mqttLink.publish(channelTopics[0].command.c_str(), cmd, false, 1);
+      closedAtUs = halNowUs;   // one request per interval
+    }
+  }
+  // A run that ends in a stall: let comms catch up for a few idle ticks so
+  // reports still waiting on the safety side go out
+  bool stalled = opt.stallMin != 0;
+  if (stalled) {
+    opt.stallMin = 0;
+    for (int i = 0; i < 3; i++) {
+      halAdvanceMs(Sampling::tickMs + 1);
+      replayLoop();
+    }
+  }
+  // Write out what the last tick queued and collect its acks
+  for (int i = 0; i < 2000 && mqttLink.awaitingBroker(); i++) {
+    mqttLink.loop();
+    if (opt.broker) usleep(1000);
+  }
+  double cpuSec = (double)(clock() - cpuStart) / CLOCKS_PER_SEC;
+
+  uint32_t historyRead = 0, historyExpected = 0;
+  uint32_t historyBad = verifyHistory(&historyRead);
+  uint32_t historyFetched = fetchLastDay(&historyExpected);
+
+  // === Report ===
+  double fedGal = stats.fedPulses / Sampling::pulsesPerGal;
+  double deltaGal = channel.volumeTotal() - startGal;
+  double hourSum = stats.hourGal + channel.volumeThisHour();
+  double tol = std::max(0.05, fedGal * 0.002);
+
+  printf("\nTicks: %llu in %.2f s CPU (%.0fx real time)\n", (unsigned long long)stats.ticks, cpuSec,
+         cpuSec > 0 ? replaySec() / cpuSec : 0.0);
+  printf("Fed: %.1f gal (%llu pulses), blocked by closed valve: %.1f gal\n", fedGal,
+         (unsigned long long)stats.fedPulses, stats.blockedPulses / Sampling::pulsesPerGal);
+  printf("volumeAll: +%.1f gal, hourly reports: %u (sum %.1f gal incl. open hour, max %.1f gal/h)\n",
+         deltaGal, stats.hourReports, hourSum, stats.maxHourGal);
+  printf("Shutoffs: %u, leak alerts: %u, warnings: %u, simple reports: %u (suppressed %lu, heartbeats %lu), acks: %u\n",
+         stats.shutoffs, stats.leakAlerts, stats.warnings, stats.simpleReports,
+         (unsigned long)channel.simpleReports().suppressed(), (unsigned long)channel.simpleReports().heartbeats(), stats.acks);
+  printf("MQTT publishes: %lu (PUBACKed %lu, refused %lu, stale %lu), state journal writes: %lu, NVS puts: %u\n",
+         (unsigned long)mqttLink.sent(), (unsigned long)mqttLink.delivered(), (unsigned long)mqttLink.rejected(),
+         (unsigned long)mqttLink.droppedStale(), (unsigned long)channel.journalWrites(), halNvsWrites);
+  const ChannelHistory &hist = flowHistory[0];
+  printf("History: %lu ticks read back (%.1f days) in %.1f KB, %lu chunk writes; get_history last day: %lu ticks in %u messages\n",
+         (unsigned long)historyRead, historyRead * Sampling::tickSec / 86400.0, hist.bytesUsed() / 1024.0,
+         (unsigned long)hist.chunksWritten(), (unsigned long)historyFetched, historySeq);
+
+  if (opt.restartMin) printf("Warm restarts: %u\n", stats.restarts);
+  printf("Warnings: %u still awaiting ACK, %lu refused by a full queue\n",
+         warningQueue.size(), (unsigned long)warningQueue.dropped());
+  printf("Valve: %u closes, longest run at shutoff %lu s (limit %d s), missed deadlines: %u, comms stalled %.1f h\n",
+         stats.valveCloses, (unsigned long)stats.maxShutoffRunSec, waterRunMaxSec[channel.mode()],
+         stats.missedDeadlines, stats.stalledTicks * Sampling::tickSec / 3600.0);
+  printf("Boot: safety %lu ms, first sample %lu ms, mqtt %lu ms, first publish %lu ms\n",
+         (unsigned long)bootTiming.safetyMs, (unsigned long)bootTiming.firstSampleMs,
+         (unsigned long)bootTiming.mqttMs, (unsigned long)bootTiming.firstPublishMs);
+
+  bool ok = true;
+  ok &= check(bootTiming.reported, "boot diagnostics were not published");
+  ok &= check(fabs(deltaGal - fedGal) <= tol, "volumeAll does not match fed pulses");
+  ok &= check(stats.missedDeadlines == 0, "valve shutoff missed its deadline");
+  ok &= check(mqttLink.rejected() == 0, "MQTT outbox refused publishes");
+  ok &= check(warningQueue.size() == 0, "warnings left unacknowledged");
+  ok &= check(fabs(hourSum - fedGal) <= tol, "hourly reports do not add up to fed volume");
+  if (!stalled) {
+    ok &= check(historyBad == 0 && historyRead > 0, "flash history does not match the posted ticks");
+    ok &= check(historyFetched == historyExpected, "get_history did not return the last day");
+  }
+  if (opt.expectGal >= 0) ok &= check(fabs(fedGal - opt.expectGal) <= std::max(0.05, opt.expectGal * 0.005), "--expect-gal");
+  if (opt.expectShutoffs >= 0) ok &= check((int)stats.shutoffs == opt.expectShutoffs, "--expect-shutoffs");
+  if (opt.expectLeakAlerts >= 0) ok &= check((int)stats.leakAlerts == opt.expectLeakAlerts, "--expect-leak-alerts");
+  printf("%s\n", ok ? "OK" : "MISMATCH");
+
+  for (uint8_t slot = 0; slot < PAYLOAD_LOG_SLOTS; slot++) {
+    char path[64];
+    snprintf(path, sizeof(path), "%s/plog%u.bin", replayLogDir, (unsigned)slot);
+    unlink(path);
+  }
+  for (uint8_t page = 0; page < FLOW_HISTORY_PAGES; page++) {
+    char path[64];
+    snprintf(path, sizeof(path), "%s/fh0_%u.bin", replayLogDir, (unsigned)page);
+    unlink(path);
+  }
+  rmdir(replayLogDir);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,103 @@
+#ifndef MY_NVSJOURNAL_H
+#define MY_NVSJOURNAL_H
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include "crc32.h"
+
+// ==================================
+// === Journaled NVS Record =========
+// ==================================
+// Keeps one POD struct as a single CRC-checked blob in NVS. Writes alternate
+// between two keys ("s0"/"s1") with an increasing sequence number, so a
+// power cut mid-write leaves the previous record intact; load() picks the
+// newest slot that passes magic/version/size/CRC. save() skips the flash
+// write when the data is byte-identical to the last good record, and every
+// real write bumps a lifetime counter stored in the record itself.
+//
+// T must be packed (no padding) so the unchanged check is a plain memcmp.
+template <typename T, uint8_t Version>
+class NvsJournal {
+public:
+  NvsJournal(const char *ns) : ns(ns) {}
+
+  // Newest valid record into out; false if neither slot is valid
+  bool load(T &out) {
+    Record a, b;
+    bool okA = readSlot(0, a);
+    bool okB = readSlot(1, b);
+    if (!okA && !okB) return false;
+
+    const Record &r = (okA && (!okB || (int32_t)(a.seq - b.seq) > 0)) ? a : b;
+    last = r;
+    haveLast = true;
+    out = r.data;
+    return true;
+  }
+
+  bool save(const T &data) {
+    if (haveLast && memcmp(&last.data, &data, sizeof(T)) == 0) {
+      skippedCount++;
+      return true;
+    }
+
+    Record r;
+    r.magic = MAGIC;
+    r.version = Version;
+    r.reserved = 0;
+    r.size = sizeof(T);
+    r.seq = haveLast ? last.seq + 1 : 1;
+    r.writes = (haveLast ? last.writes : 0) + 1;
+    r.data = data;
+    r.crc = recordCrc(r);
+
+    // Odd/even sequence numbers alternate slots; the other slot is untouched
+    if (!prefs.begin(ns, false)) return false;
+    size_t n = prefs.putBytes(slotKey(r.seq), &r, sizeof(r));
+    prefs.end();
+    if (n != sizeof(r)) return false;
+
+    last = r;
+    haveLast = true;
+    return true;
+  }
+
+  uint32_t writes() const { return haveLast ? last.writes : 0; }   // lifetime flash writes
+  uint32_t skipped() const { return skippedCount; }                // unchanged saves since boot
+
+private:
+  static const uint16_t MAGIC = 0x4A4E;   // "NJ"
+
+  struct __attribute__((packed)) Record {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t reserved;
+    uint16_t size;
+    uint32_t seq;
+    uint32_t writes;
+    T data;
+    uint32_t crc;     // over everything above
+  };
+
+  const char *ns;
+  Preferences prefs;
+  Record last;
+  bool haveLast = false;
+  uint32_t skippedCount = 0;
+
+  static const char *slotKey(uint32_t seq) { return (seq & 1) ? "s1" : "s0"; }
+
+  static uint32_t recordCrc(const Record &r) { return crc32(&r, sizeof(r) - sizeof(r.crc)); }
+
+  bool readSlot(uint8_t slot, Record &r) {
+    if (!prefs.begin(ns, true)) return false;
+    const char *key = slot ? "s1" : "s0";
+    bool ok = prefs.getBytesLength(key) == sizeof(r) &&
+              prefs.getBytes(key, &r, sizeof(r)) == sizeof(r);
+    prefs.end();
+    return ok && r.magic == MAGIC && r.version == Version && r.size == sizeof(T) &&
+           r.crc == recordCrc(r);
+  }
+};
+
+#endif
@@ -0,0 +1,307 @@
+#ifndef MY_PAYLOADLOG_H
+#define MY_PAYLOADLOG_H
+
+#include <Arduino.h>
+#include <stdio.h>
+#include "crc32.h"
+
+// ==================================
+// === Append-only Payload Log ======
+// ==================================
+// Offline backlog kept as PAYLOAD_LOG_SLOTS segment files used as a ring.
+// Every record is framed with a header + CRC and carries a global record
+// sequence number. Sends are acknowledged by appending a small ACK record,
+// never by rewriting data, and acks are batched into one ACK per commit().
+// At boot the segments are scanned to recover head, tail and the pending
+// count; a torn tail record ends that segment and appends move on.
+//
+// Plain stdio is used so the same code runs on the ESP32 (LittleFS mounted
+// at /littlefs through the VFS) and on Linux against a normal directory.
+
+#ifndef PAYLOAD_LOG_DIR
+  #if defined(ARDUINO_ARCH_ESP32)
+    #define PAYLOAD_LOG_DIR "/littlefs"
+  #else
+    #define PAYLOAD_LOG_DIR "."
+  #endif
+#endif
+
+#define PAYLOAD_LOG_SLOTS      8
+#define PAYLOAD_LOG_SLOT_BYTES 8192UL     // 64 KB total, ~150 hourly reports
+#define PAYLOAD_LOG_MAX_RECORD 512
+
+class PayloadLog {
+public:
+  PayloadLog(const char *dir) : dir(dir) {}
+
+  // Scan all segments and rebuild the in-RAM index
+  void begin() {
+    nextRseq = 1;
+    ackThrough = 0;
+    pendingCount = 0;
+    droppedCount = 0;
+    ackDirty = false;
+    active = 0;
+    activeTorn = false;
+    uint32_t maxRseq = 0;
+
+    for (uint8_t i = 0; i < PAYLOAD_LOG_SLOTS; i++) {
+      scanSlot(i);
+      if (slots[i].maxRseq > maxRseq) { maxRseq = slots[i].maxRseq; active = i; }
+      if (slots[i].maxAck > ackThrough) ackThrough = slots[i].maxAck;
+    }
+    nextRseq = maxRseq + 1;
+    activeTorn = slots[active].torn;
+
+    for (uint8_t i = 0; i < PAYLOAD_LOG_SLOTS; i++) countPending(i);
+    rewindCursor();
+  }
+
+  // Append one payload; committed to flash before returning
+  bool append(const char *payload, size_t len) {
+    if (len == 0 || len > PAYLOAD_LOG_MAX_RECORD) return false;
+    if (!writeRecord(TYPE_DATA, (const uint8_t *)payload, (uint16_t)len)) return false;
+    pendingCount++;
+    return true;
+  }
+
+  // Oldest unsent payload, NUL-terminated into out (size it
+  // PAYLOAD_LOG_MAX_RECORD + 1); false when empty
+  bool peek(char *out, size_t outLen, size_t *lenOut) {
+    beginBatch();
+    return nextInBatch(out, outLen, lenOut);
+  }
+
+  // Mark the record returned by the last peek() as sent (RAM only until commit)
+  void pop() { commitBatch(); }
+
+  // Batch read: consecutive unsent records without acking them. nextInBatch()
+  // returns false when the log is exhausted or the next record (plus NUL)
+  // does not fit in outLen; the record then stays first in the next batch.
+  void beginBatch() {
+    batchSlot = curSlot;
+    batchOffset = curOffset;
+    batchRseq = 0;
+    batchCount = 0;
+  }
+
+  bool nextInBatch(char *out, size_t outLen, size_t *lenOut) {
+    Header h;
+    while (batchCount < pendingCount && readAt(batchSlot, batchOffset, h, out, outLen)) {
+      batchOffset += sizeof(h) + h.len;
+      if (h.type == TYPE_DATA && h.rseq > ackThrough) {
+        batchRseq = h.rseq;
+        batchCount++;
+        if (lenOut) *lenOut = h.len;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Mark every record read in the current batch as sent (RAM only until commit).
+  // Appends may run between beginBatch() and this; a rotate() that drops
+  // records in the meantime cancels the batch.
+  void commitBatch() {
+    if (batchCount == 0) return;
+    ackThrough = batchRseq;
+    pendingCount -= batchCount;
+    ackDirty = true;
+    curSlot = batchSlot;
+    curOffset = batchOffset;
+    batchCount = 0;
+  }
+
+  // Persist the batched acks with a single ACK record
+  void commit() {
+    if (!ackDirty) return;
+    uint8_t body[4];
+    memcpy(body, &ackThrough, sizeof(body));
+    if (writeRecord(TYPE_ACK, body, sizeof(body))) ackDirty = false;
+  }
+
+  uint32_t pending() const { return pendingCount; }
+  uint32_t dropped() const { return droppedCount; }
+  uint32_t capacityBytes() const { return PAYLOAD_LOG_SLOTS * PAYLOAD_LOG_SLOT_BYTES; }
+
+private:
+  static const uint16_t MAGIC = 0x4C50;  // "PL"
+  static const uint8_t TYPE_DATA = 1;
+  static const uint8_t TYPE_ACK = 2;
+
+  struct __attribute__((packed)) Header {
+    uint16_t magic;
+    uint8_t type;
+    uint8_t flags;
+    uint16_t len;
+    uint16_t reserved;
+    uint32_t rseq;
+    uint32_t crc;     // over header (crc = 0) + body
+  };
+
+  struct SlotInfo {
+    uint32_t bytes;    // valid bytes
+    uint32_t maxRseq;
+    uint32_t maxAck;
+    bool torn;
+  };
+
+  const char *dir;
+  SlotInfo slots[PAYLOAD_LOG_SLOTS];
+  uint8_t active;
+  bool activeTorn;
+  uint32_t nextRseq, ackThrough, pendingCount, droppedCount;
+  bool ackDirty;
+
+  // Read cursor: next record to examine, and the uncommitted batch cursor
+  uint8_t curSlot, batchSlot;
+  uint32_t curOffset, batchOffset;
+  uint32_t batchRseq;
+  uint16_t batchCount;
+
+  void slotPath(uint8_t slot, char *buf, size_t len) const {
+    snprintf(buf, len, "%s/plog%u.bin", dir, (unsigned)slot);
+  }
+
+  static uint32_t recordCrc(Header h, const uint8_t *body) {
+    h.crc = 0;
+    return crc32Update(crc32(&h, sizeof(h)), body, h.len);
+  }
+
+  void scanSlot(uint8_t slot) {
+    SlotInfo &s = slots[slot];
+    s.bytes = s.maxRseq = s.maxAck = 0;
+    s.torn = false;
+
+    char path[48];
+    slotPath(slot, path, sizeof(path));
+    FILE *f = fopen(path, "rb");
+    if (!f) return;
+
+    uint8_t body[PAYLOAD_LOG_MAX_RECORD];
+    Header h;
+    for (;;) {
+      size_t n = fread(&h, 1, sizeof(h), f);
+      if (n == 0) break;
+      if (n != sizeof(h) || h.magic != MAGIC || h.len > PAYLOAD_LOG_MAX_RECORD ||
+          fread(body, 1, h.len, f) != h.len || recordCrc(h, body) != h.crc) {
+        s.torn = true;
+        break;
+      }
+      s.maxRseq = h.rseq;
+      if (h.type == TYPE_ACK) {
+        uint32_t a;
+        memcpy(&a, body, sizeof(a));
+        if (a > s.maxAck) s.maxAck = a;
+      }
+      s.bytes += sizeof(h) + h.len;
+    }
+    fclose(f);
+  }
+
+  void countPending(uint8_t slot) {
+    if (slots[slot].maxRseq <= ackThrough) return;
+    char path[48];
+    slotPath(slot, path, sizeof(path));
+    FILE *f = fopen(path, "rb");
+    if (!f) return;
+    Header h;
+    uint32_t off = 0;
+    while (off < slots[slot].bytes && fread(&h, 1, sizeof(h), f) == sizeof(h)) {
+      if (h.type == TYPE_DATA && h.rseq > ackThrough) pendingCount++;
+      off += sizeof(h) + h.len;
+      fseek(f, off, SEEK_SET);
+    }
+    fclose(f);
+  }
+
+  // Oldest segment is the one after the active one in ring order
+  void rewindCursor() {
+    curSlot = (active + 1) % PAYLOAD_LOG_SLOTS;
+    curOffset = 0;
+    beginBatch();
+  }
+
+  // Walks forward across segments until a record is found or the head is
+  // reached; slot/offset are left pointing at the record that was read
+  bool readAt(uint8_t &slot, uint32_t &offset, Header &h, char *out, size_t outLen) {
+    for (uint8_t hops = 0; hops <= PAYLOAD_LOG_SLOTS; hops++) {
+      if (offset < slots[slot].bytes) {
+        char path[48];
+        slotPath(slot, path, sizeof(path));
+        FILE *f = fopen(path, "rb");
+        if (!f) return false;
+        fseek(f, offset, SEEK_SET);
+        bool ok = fread(&h, 1, sizeof(h), f) == sizeof(h) && (size_t)h.len + 1 <= outLen &&
+                  fread(out, 1, h.len, f) == h.len;
+        out[ok ? h.len : 0] = '\0';
+        fclose(f);
+        return ok;
+      }
+      if (slot == active) return false;
+      slot = (slot + 1) % PAYLOAD_LOG_SLOTS;
+      offset = 0;
+    }
+    return false;
+  }
+
+  // Move appends to the next segment, dropping any unsent records it held
+  void rotate() {
+    uint8_t next = (active + 1) % PAYLOAD_LOG_SLOTS;
+    SlotInfo &s = slots[next];
+    if (s.maxRseq > ackThrough) {
+      uint32_t before = pendingCount;
+      pendingCount = 0;
+      ackThrough = s.maxRseq;
+      ackDirty = true;
+      for (uint8_t i = 0; i < PAYLOAD_LOG_SLOTS; i++) if (i != next) countPending(i);
+      droppedCount += before - pendingCount;
+      batchCount = 0;   // an in-flight batch may have lost records; it is resent, not committed
+    }
+    if (curSlot == next) {
+      curSlot = (next + 1) % PAYLOAD_LOG_SLOTS;
+      curOffset = 0;
+    }
+
+    char path[48];
+    slotPath(next, path, sizeof(path));
+    FILE *f = fopen(path, "wb");   // truncate
+    if (f) fclose(f);
+    s.bytes = s.maxRseq = s.maxAck = 0;
+    s.torn = false;
+    active = next;
+    activeTorn = false;
+  }
+
+  uint32_t writeRecord(uint8_t type, const uint8_t *body, uint16_t len) {
+    if (activeTorn || slots[active].bytes + sizeof(Header) + len > PAYLOAD_LOG_SLOT_BYTES) rotate();
+
+    Header h;
+    h.magic = MAGIC;
+    h.type = type;
+    h.flags = 0;
+    h.len = len;
+    h.reserved = 0;
+    h.rseq = nextRseq;
+    h.crc = recordCrc(h, body);
+
+    char path[48];
+    slotPath(active, path, sizeof(path));
+    FILE *f = fopen(path, "ab");
+    if (!f) return 0;
+    bool ok = fwrite(&h, 1, sizeof(h), f) == sizeof(h) && fwrite(body, 1, len, f) == len;
+    ok = (fclose(f) == 0) && ok;
+    if (!ok) {
+      activeTorn = true;   // never append after a partial record
+      return 0;
+    }
+
+    SlotInfo &s = slots[active];
+    s.maxRseq = h.rseq;
+    if (type == TYPE_ACK) s.maxAck = ackThrough;
+    s.bytes += sizeof(h) + len;
+    return nextRseq++;
+  }
+};
+
+#endif
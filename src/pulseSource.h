@@ -0,0 +1,221 @@
+#ifndef MY_PULSESOURCE_H
+#define MY_PULSESOURCE_H
+
+#include <Arduino.h>
+
+// ==========================
+// === Backend Selection ====
+// ==========================
+// Override with e.g. build_flags = -DPULSE_SOURCE=PULSE_SOURCE_PCNT
+#define PULSE_SOURCE_ISR   0   // GPIO interrupt per edge + software debounce
+#define PULSE_SOURCE_PCNT  1   // ESP32 PCNT peripheral, hardware glitch filter, no interrupts
+#define PULSE_SOURCE_SIM   2   // simulated edges for host builds
+
+#ifndef PULSE_SOURCE
+  #if defined(ARDUINO_ARCH_ESP32)
+    #define PULSE_SOURCE PULSE_SOURCE_ISR
+  #else
+    #define PULSE_SOURCE PULSE_SOURCE_SIM
+  #endif
+#endif
+
+// ==========================
+// === PulseSource API ======
+// ==========================
+// Edge-filter counters since the previous takeStats() (all 0 if not tracked)
+struct PulseStats {
+  uint32_t rejectedEdges;   // edges dropped by the debounce
+  uint32_t minPeriodUs;     // shortest accepted inter-pulse period, 0 = none
+  uint32_t debounceUs;      // current debounce window
+};
+
+class PulseSource {
+public:
+  virtual ~PulseSource() {}
+  virtual void begin() = 0;
+  // Pulses counted since the previous call (read-and-clear)
+  virtual uint32_t takeCount() = 0;
+  // Filter counters since the previous call (read-and-clear)
+  virtual PulseStats takeStats() { PulseStats s = {0, 0, 0}; return s; }
+};
+
+// ==========================
+// === Adaptive Debounce ====
+// ==========================
+// The lockout follows half the observed edge period (EWMA, 1/8 weight),
+// clamped between half the period of maxMeterHz and maxDebounceUs.
+// Edges closer than that floor are bounce and never train the average,
+// so a fast meter opens the window instead of being silently clamped.
+class PulseEdgeFilter {
+public:
+  PulseEdgeFilter(uint32_t maxMeterHz, uint32_t maxDebounceUs)
+    : floorUs(500000UL / (maxMeterHz ? maxMeterHz : 1)),
+      ceilUs(maxDebounceUs > floorUs ? maxDebounceUs : floorUs) { reset(); }
+
+  void reset() {
+    lastEdgeUs = lastAcceptUs = 0;
+    avgPeriodUs = 2 * ceilUs;
+    debounceUs = ceilUs;
+    rejected = 0;
+    minPeriodUs = UINT32_MAX;
+  }
+
+  bool IRAM_ATTR accept(uint32_t nowUs) {
+    uint32_t sinceEdge = nowUs - lastEdgeUs;
+    lastEdgeUs = nowUs;
+    if (sinceEdge > floorUs) {
+      if (sinceEdge > 2 * ceilUs) sinceEdge = 2 * ceilUs;
+      avgPeriodUs = avgPeriodUs + (((int32_t)sinceEdge - (int32_t)avgPeriodUs) >> 3);
+      uint32_t d = avgPeriodUs / 2;
+      debounceUs = d < floorUs ? floorUs : (d > ceilUs ? ceilUs : d);
+    }
+
+    uint32_t since = nowUs - lastAcceptUs;
+    if (since <= debounceUs) { rejected++; return false; }
+    if (since < minPeriodUs && since <= 2 * ceilUs) minPeriodUs = since;
+    lastAcceptUs = nowUs;
+    return true;
+  }
+
+  // Caller guards against concurrent accept() (ISR)
+  PulseStats take() {
+    PulseStats s = {rejected, minPeriodUs == UINT32_MAX ? 0 : minPeriodUs, debounceUs};
+    rejected = 0;
+    minPeriodUs = UINT32_MAX;
+    return s;
+  }
+
+private:
+  uint32_t floorUs, ceilUs;
+  volatile uint32_t lastEdgeUs, lastAcceptUs, avgPeriodUs, debounceUs;
+  volatile uint32_t rejected, minPeriodUs;
+};
+
+// ==========================
+// === ISR Backend ==========
+// ==========================
+class IsrPulseSource : public PulseSource {
+public:
+  IsrPulseSource(uint8_t pin, uint32_t maxMeterHz, uint32_t maxDebounceUs)
+    : pin(pin), filter(maxMeterHz, maxDebounceUs) {}
+
+  void begin() override {
+    pinMode(pin, INPUT_PULLUP);
+    attachInterruptArg(digitalPinToInterrupt(pin), onEdge, this, RISING);
+  }
+
+  uint32_t takeCount() override {
+    noInterrupts();
+    uint32_t n = count;
+    count = 0;
+    interrupts();
+    return n;
+  }
+
+  PulseStats takeStats() override {
+    noInterrupts();
+    PulseStats s = filter.take();
+    interrupts();
+    return s;
+  }
+
+private:
+  static void IRAM_ATTR onEdge(void *arg) {
+    IsrPulseSource *self = (IsrPulseSource *)arg;
+    if (self->filter.accept(micros())) self->count++;
+  }
+
+  uint8_t pin;
+  PulseEdgeFilter filter;
+  volatile uint32_t count = 0;
+};
+
+// ==========================
+// === PCNT Backend =========
+// ==========================
+#if defined(ARDUINO_ARCH_ESP32)
+#include "driver/pcnt.h"
+
+// Counts rising edges in hardware. The counter free-runs and wraps at
+// PCNT_WRAP, so takeCount() must be called at least once per PCNT_WRAP
+// pulses (every 10 s covers meters up to ~3.2 kHz).
+class PcntPulseSource : public PulseSource {
+public:
+  static const int16_t PCNT_WRAP = 32767;
+
+  // filterApbCycles: glitch filter width in 80 MHz APB cycles (max 1023 ~ 12.8 us)
+  PcntPulseSource(uint8_t pin, uint16_t filterApbCycles, pcnt_unit_t unit = PCNT_UNIT_0)
+    : pin(pin), filterApbCycles(filterApbCycles), unit(unit) {}
+
+  void begin() override {
+    pinMode(pin, INPUT_PULLUP);
+
+    pcnt_config_t cfg = {};
+    cfg.pulse_gpio_num = pin;
+    cfg.ctrl_gpio_num  = PCNT_PIN_NOT_USED;
+    cfg.channel        = PCNT_CHANNEL_0;
+    cfg.unit           = unit;
+    cfg.pos_mode       = PCNT_COUNT_INC;
+    cfg.neg_mode       = PCNT_COUNT_DIS;
+    cfg.lctrl_mode     = PCNT_MODE_KEEP;
+    cfg.hctrl_mode     = PCNT_MODE_KEEP;
+    cfg.counter_h_lim  = PCNT_WRAP;
+    cfg.counter_l_lim  = -PCNT_WRAP;
+    pcnt_unit_config(&cfg);
+
+    pcnt_set_filter_value(unit, filterApbCycles > 1023 ? 1023 : filterApbCycles);
+    pcnt_filter_enable(unit);
+
+    pcnt_counter_pause(unit);
+    pcnt_counter_clear(unit);
+    pcnt_counter_resume(unit);
+    lastRaw = 0;
+  }
+
+  // Never clears the counter, so no edge is lost between read and clear
+  uint32_t takeCount() override {
+    int16_t raw = 0;
+    if (pcnt_get_counter_value(unit, &raw) != ESP_OK) return 0;
+    uint32_t delta = (uint32_t)((raw - lastRaw + PCNT_WRAP) % PCNT_WRAP);
+    lastRaw = raw;
+    return delta;
+  }
+
+private:
+  uint8_t pin;
+  uint16_t filterApbCycles;
+  pcnt_unit_t unit;
+  int16_t lastRaw = 0;
+};
+#endif
+
+// ==========================
+// === Simulated Backend ====
+// ==========================
+// Host-side source: feed edge timestamps (debounced like the ISR) or raw counts.
+class SimPulseSource : public PulseSource {
+public:
+  SimPulseSource(uint32_t maxMeterHz, uint32_t maxDebounceUs) : filter(maxMeterHz, maxDebounceUs) {}
+
+  void begin() override { count = 0; filter.reset(); }
+
+  void edge(uint32_t nowUs) {
+    if (filter.accept(nowUs)) count++;
+  }
+
+  void addPulses(uint32_t n) { count += n; }
+
+  uint32_t takeCount() override {
+    uint32_t n = count;
+    count = 0;
+    return n;
+  }
+
+  PulseStats takeStats() override { return filter.take(); }
+
+private:
+  PulseEdgeFilter filter;
+  volatile uint32_t count = 0;
+};
+
+#endif
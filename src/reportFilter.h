@@ -0,0 +1,98 @@
+#ifndef MY_REPORTFILTER_H
+#define MY_REPORTFILTER_H
+
+#include <Arduino.h>
+#include <math.h>
+#include "taskQueues.h"
+
+// ==================================
+// === Report by Exception ==========
+// ==================================
+// Decides when a channel's simpleFlowData snapshot is worth publishing.
+//  - transitions go out at once: valve open/closed, mode, a warning, the
+//    leak level, flow starting or stopping (a rate crossing zero) and the
+//    run timer resetting at the end of a run.
+//  - flow10s and flowAvg only count as changed once they move past their
+//    deadband from the last value sent: more than `absolute` gpm AND more
+//    than `relative` of that value. runTime counts once it has advanced
+//    runTimeStepSec.
+//  - with nothing to report, a heartbeat goes out after heartbeatMs.
+// Anything else that differs from the last sent snapshot is suppressed and
+// counted. Called from the safety side only.
+
+struct Deadband {
+  float absolute;   // gpm
+  float relative;   // fraction of the last sent value
+};
+
+struct ReportConfig {
+  Deadband flow10s;
+  Deadband flowAvg;
+  unsigned long runTimeStepSec;
+  unsigned long heartbeatMs;    // longest silence
+};
+
+enum ReportReason : uint8_t { REPORT_NONE, REPORT_TRANSITION, REPORT_CHANGE, REPORT_HEARTBEAT };
+
+class ReportFilter {
+public:
+  ReportFilter(const ReportConfig &cfg) : cfg(cfg) {}
+
+  // Why snap should be published now, or REPORT_NONE (counted as suppressed
+  // when it differs from the last snapshot sent)
+  ReportReason evaluate(const SimpleFlowSnapshot &snap, unsigned long nowMs) {
+    if (!haveLast || isTransition(snap)) return REPORT_TRANSITION;
+    if (outside(cfg.flow10s, snap.flow10s, last.flow10s) ||
+        outside(cfg.flowAvg, snap.flowAvg, last.flowAvg) ||
+        snap.runTimeSec >= last.runTimeSec + cfg.runTimeStepSec) return REPORT_CHANGE;
+    if (nowMs - lastSentMs >= cfg.heartbeatMs) return REPORT_HEARTBEAT;
+
+    if (snap.flow10s != last.flow10s || snap.flowAvg != last.flowAvg || snap.runTimeSec != last.runTimeSec) {
+      suppressedTotal++;
+      suppressedHour++;
+    }
+    return REPORT_NONE;
+  }
+
+  // The snapshot evaluate() approved was handed to the comms task
+  void sent(const SimpleFlowSnapshot &snap, unsigned long nowMs, ReportReason why) {
+    last = snap;
+    haveLast = true;
+    lastSentMs = nowMs;
+    sentTotal++;
+    sentHour++;
+    if (why == REPORT_HEARTBEAT) heartbeatTotal++;
+  }
+
+  // Hourly report counters
+  void resetHour() { sentHour = suppressedHour = 0; }
+  uint16_t sentThisHour() const { return sentHour; }
+  uint16_t suppressedThisHour() const { return suppressedHour; }
+
+  uint32_t sent() const { return sentTotal; }
+  uint32_t suppressed() const { return suppressedTotal; }
+  uint32_t heartbeats() const { return heartbeatTotal; }
+
+private:
+  const ReportConfig &cfg;
+  SimpleFlowSnapshot last;
+  bool haveLast = false;
+  unsigned long lastSentMs = 0;
+  uint32_t sentTotal = 0, suppressedTotal = 0, heartbeatTotal = 0;
+  uint16_t sentHour = 0, suppressedHour = 0;
+
+  bool isTransition(const SimpleFlowSnapshot &snap) const {
+    return snap.valveClosed != last.valveClosed || snap.valveMode != last.valveMode ||
+           snap.warning != 0 || snap.leakLevel != last.leakLevel ||
+           (snap.flow10s == 0) != (last.flow10s == 0) ||
+           (snap.flowAvg == 0) != (last.flowAvg == 0) ||
+           (snap.runTimeSec == 0 && last.runTimeSec != 0);
+  }
+
+  static bool outside(const Deadband &band, float value, float lastValue) {
+    float d = fabsf(value - lastValue);
+    return d > band.absolute && d > band.relative * fabsf(lastValue);
+  }
+};
+
+#endif
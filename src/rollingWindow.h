@@ -0,0 +1,47 @@
+#ifndef MY_ROLLINGWINDOW_H
+#define MY_ROLLINGWINDOW_H
+
+#include <Arduino.h>
+
+// ==================================
+// === Rolling Window Aggregator ====
+// ==================================
+// Sliding window over the last `Length` samples. push() is O(1): a running
+// sum gives the average, and the sample falling out of the window is
+// subtracted from the ring slot it owned, so wrap-around needs no special
+// case. Use an integer T (e.g. pulse counts) so the running sum never drifts.
+template <typename T, uint16_t Length, typename SumT = T>
+class RollingWindow {
+  static_assert(Length > 0, "RollingWindow length must be > 0");
+
+public:
+  RollingWindow() { reset(); }
+
+  void reset() {
+    pushed = 0;
+    total = 0;
+  }
+
+  void push(T value) {
+    uint16_t slot = pushed % Length;
+    if (pushed >= Length) total -= samples[slot];
+    samples[slot] = value;
+    total += value;
+    pushed++;
+  }
+
+  uint16_t size() const       { return Length; }
+  uint16_t count() const      { return pushed < Length ? (uint16_t)pushed : Length; }
+  bool full() const           { return pushed >= Length; }
+  uint32_t pushedCount() const{ return pushed; }
+
+  SumT sum() const            { return total; }
+  float avg() const           { return count() ? (float)total / count() : 0.0f; }
+
+private:
+  T samples[Length];
+  uint32_t pushed;
+  SumT total;
+};
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef MY_RTCSHADOW_H
+#define MY_RTCSHADOW_H
+
+#include <Arduino.h>
+#include "crc32.h"
+
+// ==================================
+// === RTC Shadow Record ============
+// ==================================
+// Keeps one POD struct in RTC slow memory (RTC_NOINIT_ATTR), which the
+// startup code leaves alone: it survives a software restart, a panic and
+// the watchdogs, but holds garbage after power-on. Same framing as
+// NvsJournal: two slots written alternately with an increasing sequence
+// number and a CRC, so a reset in the middle of save() leaves the previous
+// slot intact and load() takes the newest slot that checks out. A save is a
+// copy plus a CRC over the record, cheap enough to run every flow tick.
+//
+// load() only trusts the slots after a reset that keeps RTC memory
+// (rtcShadowKept()); otherwise callers fall back to their NVS copy.
+//
+// T must be plain data with no constructor: a constructor would run on the
+// RTC_NOINIT copy at startup and wipe what the last run left there.
+
+// Reset causes that leave RTC slow memory as it was
+inline bool rtcShadowKept() {
+  switch (esp_reset_reason()) {
+    case ESP_RST_SW:
+    case ESP_RST_PANIC:
+    case ESP_RST_INT_WDT:
+    case ESP_RST_TASK_WDT:
+    case ESP_RST_WDT:
+    case ESP_RST_DEEPSLEEP:
+      return true;
+    default:
+      return false;   // power-on, brownout, EN pin: RTC memory not retained
+  }
+}
+
+template <typename T, uint8_t Version>
+class RtcShadow {
+public:
+  struct __attribute__((packed)) Record {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t reserved;
+    uint16_t size;
+    uint32_t seq;
+    T data;
+    uint32_t crc;     // over everything above
+  };
+
+  // Backing store; define it RTC_NOINIT_ATTR
+  struct Slots {
+    Record slot[2];
+  };
+
+  RtcShadow(Slots &mem) : mem(mem) {}
+
+  // Newest valid slot into out; false after a cold boot or if neither
+  // slot checks out. The next save() continues the sequence.
+  bool load(T &out) {
+    if (!rtcShadowKept()) return false;
+    bool okA = valid(mem.slot[0]);
+    bool okB = valid(mem.slot[1]);
+    if (!okA && !okB) return false;
+
+    const Record &r = (okA && (!okB || (int32_t)(mem.slot[0].seq - mem.slot[1].seq) > 0))
+                      ? mem.slot[0] : mem.slot[1];
+    seq = r.seq;
+    out = r.data;
+    return true;
+  }
+
+  void save(const T &data) {
+    seq++;
+    Record &r = mem.slot[seq & 1];   // the other slot keeps the previous copy
+    r.magic = MAGIC;
+    r.version = Version;
+    r.reserved = 0;
+    r.size = sizeof(T);
+    r.seq = seq;
+    r.data = data;
+    r.crc = recordCrc(r);
+  }
+
+private:
+  static const uint16_t MAGIC = 0x5253;   // "RS"
+
+  Slots &mem;
+  uint32_t seq = 0;
+
+  static uint32_t recordCrc(const Record &r) { return crc32(&r, sizeof(r) - sizeof(r.crc)); }
+
+  static bool valid(const Record &r) {
+    return r.magic == MAGIC && r.version == Version && r.size == sizeof(T) && r.crc == recordCrc(r);
+  }
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef MY_SAMPLINGCONFIG_H
+#define MY_SAMPLINGCONFIG_H
+
+#include <Arduino.h>
+
+// ==================================
+// === Sampling Configuration =======
+// ==================================
+// A deployment describes its tick and meter as a struct of static constexpr
+// values. SamplingPlan<Config> derives every buffer size and conversion
+// factor from it at compile time, and refuses configurations that would
+// silently truncate (e.g. a 10 s window with a 30 s tick) instead of
+// building firmware with zero-length windows.
+//
+// To add a profile, copy DomesticSampling and select it per PlatformIO env
+// with build_flags = -DFLOW_SAMPLING=MySampling.
+
+struct DomesticSampling {
+    static constexpr uint32_t tickMs = 10000;     // flow tick / sample period
+    static constexpr uint32_t sendMs = 10000;     // simpleFlowData change check
+    static constexpr float pulsesPerGal = 10.0f;  // meter calibration
+    static constexpr uint16_t flowAvgTicks = 3;   // ticks in the flowAvg ("flow30s") average
+};
+
+#ifndef FLOW_SAMPLING
+#define FLOW_SAMPLING DomesticSampling
+#endif
+
+template <typename Config>
+struct SamplingPlan {
+    static_assert(Config::tickMs >= 1000 && Config::tickMs % 1000 == 0,
+                  "tickMs must be a whole number of seconds");
+    static_assert(Config::pulsesPerGal > 0, "pulsesPerGal must be positive");
+    static_assert(Config::flowAvgTicks > 0, "flowAvgTicks must be at least 1");
+
+    static constexpr uint32_t tickMs = Config::tickMs;
+    static constexpr uint32_t sendMs = Config::sendMs;
+    static constexpr uint32_t tickSec = Config::tickMs / 1000;
+    static constexpr float pulsesPerGal = Config::pulsesPerGal;
+
+    // Every window must be a whole number of ticks
+    static_assert(3600 % tickSec == 0, "tick must divide the hour");
+    static_assert(10 % tickSec == 0, "tick must divide the 10 s max-flow window");
+    static_assert(60 % tickSec == 0 && 600 % tickSec == 0 && 1800 % tickSec == 0,
+                  "tick must divide the 1/10/30 min max-flow windows");
+
+    // Buffer sizes, in ticks
+    static constexpr uint16_t hourTicks = 3600 / tickSec;
+    static constexpr uint16_t win10SecTicks = 10 / tickSec;
+    static constexpr uint16_t win1MinTicks = 60 / tickSec;
+    static constexpr uint16_t win10MinTicks = 600 / tickSec;
+    static constexpr uint16_t win30MinTicks = 1800 / tickSec;
+    static constexpr uint16_t flowAvgTicks = Config::flowAvgTicks;
+    static_assert(hourTicks <= 0xFFFF / 2, "hour ring too large");
+
+    // Conversion factors; the hot path only multiplies
+    static constexpr float galPerPulse = 1.0f / pulsesPerGal;
+    static constexpr float galPerMinFactor = 60.0f / tickSec;          // gal per tick -> gpm
+    static constexpr float gpmPerPulse = galPerMinFactor / pulsesPerGal; // one pulse per tick, in gpm
+};
+
+#endif
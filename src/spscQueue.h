@@ -0,0 +1,50 @@
+#ifndef MY_SPSCQUEUE_H
+#define MY_SPSCQUEUE_H
+
+#include <Arduino.h>
+#include <atomic>
+
+// ==========================
+// === SPSC Ring Queue ======
+// ==========================
+// Lock-free single-producer / single-consumer queue. Exactly one task may
+// push and exactly one task may pop. Indices are free-running 32-bit
+// counters (plain aligned loads/stores on Xtensa) published with
+// release/acquire ordering, so no mutex or critical section is needed.
+template <typename T, uint32_t N>
+class SpscQueue {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "SpscQueue size must be a power of two");
+
+public:
+  // Producer side; returns false (and counts a drop) when full
+  bool push(const T &item) {
+    uint32_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) >= N) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    items[h % N] = item;
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side; returns false when empty
+  bool pop(T &out) {
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire)) return false;
+    out = items[t % N];
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  uint32_t size() const { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); }
+  uint32_t droppedCount() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+  T items[N];
+  std::atomic<uint32_t> head{0};
+  std::atomic<uint32_t> tail{0};
+  std::atomic<uint32_t> dropped{0};
+};
+
+#endif
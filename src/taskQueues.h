@@ -0,0 +1,186 @@
+#ifndef MY_TASKQUEUES_H
+#define MY_TASKQUEUES_H
+
+#include <Arduino.h>
+#include "spscQueue.h"
+#include "loopProfiler.h"
+
+// ==================================
+// === Safety <-> Comms Messages ====
+// ==================================
+// The safety side (loop() on the app core) owns sampling, valve logic and
+// buttons, and is the only one driving the NeoPixels. The comms task owns
+// WiFi/MQTT and the NVS backlog. They share no mutable state except these
+// two SPSC queues and a few single-word status values that only one side
+// writes (bootTiming, netLed). Every message carries the flow channel
+// (channelConfig.h) it belongs to.
+
+// Snapshot published on simpleFlowData
+struct SimpleFlowSnapshot {
+    float flow10s, flowAvg, volumeAll;
+    unsigned long runTimeSec;
+    unsigned long rejEdges;
+    uint32_t nvsWrites;     // lifetime state-journal flash writes
+    uint32_t epoch;         // tick the values were measured at; 0 = clock never synced
+    uint8_t leakLevel;      // 0 none, 1 warn, 2 critical
+    int valveMode;
+    int warning;
+    bool valveClosed;
+};
+
+// Per-tick flow histogram bins (see flowHistogram.h): bin 0 = no flow,
+// bin k = [2^(k-1), 2^k) pulses per tick, last bin open-ended
+#define FLOW_HIST_BINS 12
+
+// Hourly report published on flowData
+struct HourFlowReport {
+    float max10s, max1m, max10m;
+    float volumeHour, volumeAll;
+    uint32_t max10sEpoch, max1mEpoch, max10mEpoch;
+    uint32_t startEpoch;
+    unsigned long rejEdges, minPerUs;
+    float histBaseGpm;                    // flow of one pulse per tick
+    uint16_t hist[FLOW_HIST_BINS];
+    uint16_t simpleSent, simpleSuppressed;  // simpleFlowData this hour (reportFilter.h)
+    int valveMode;
+    bool valveClosed;
+    char timeStamp[20];
+};
+
+// Delivery order of warnings on the comms side (warningQueue.h); a full
+// queue makes room by dropping the lowest. Memory alarms come from the
+// comms task itself and rank below anything about the water.
+enum WarnPriority : uint8_t { WARN_PRIO_MEMORY, WARN_PRIO_NORMAL, WARN_PRIO_VALVE };
+
+struct WarningMsg {
+    char level[8];
+    char title[32];
+    char message[96];
+    uint8_t priority;   // WarnPriority
+};
+
+struct AckMsg {
+    char cmd[16];
+    char status[24];
+};
+
+// Safety-loop timing for one stage, relayed to the diagnostics topic
+struct StageStatsMsg {
+    uint8_t stage;      // SafetyStage
+    bool last;          // final stage of this report
+    uint32_t periodMs;
+    StageStats stats;
+};
+
+// One tick's pulse count for the flash history (flowHistory.h)
+struct HistoryTickMsg {
+    uint32_t epoch;     // start of the tick's interval, 0 = clock never synced
+    uint16_t pulses;
+};
+
+// === Safety -> Comms ===
+enum CommsMsgType : uint8_t { COMMS_SIMPLE_DATA, COMMS_BIG_DATA, COMMS_WARNING, COMMS_ACK, COMMS_STAGE_STATS,
+                              COMMS_HISTORY_TICK };
+
+struct CommsMsg {
+    CommsMsgType type;
+    uint8_t channel;
+    union {
+        SimpleFlowSnapshot simple;
+        HourFlowReport hour;
+        WarningMsg warning;
+        AckMsg ack;
+        StageStatsMsg stage;
+        HistoryTickMsg tick;
+    };
+};
+
+// === Comms -> Safety ===
+enum ValveCmdType : uint8_t { VALVE_CMD_CLOSE, VALVE_CMD_OPEN, VALVE_CMD_CYCLE, VALVE_CMD_TIMED_CLOSE, VALVE_CMD_MODE };
+
+struct ValveCmdMsg {
+    ValveCmdType type;
+    uint8_t channel;
+    uint32_t arg;   // seconds for timed close, mode for VALVE_CMD_MODE
+};
+
+#define COMMS_QUEUE_LEN    16
+#define VALVE_CMD_QUEUE_LEN 8
+
+SpscQueue<CommsMsg, COMMS_QUEUE_LEN> commsQueue;        // producer: safety, consumer: comms
+SpscQueue<ValveCmdMsg, VALVE_CMD_QUEUE_LEN> valveCmdQueue; // producer: comms, consumer: safety
+
+// === Safety-side post helpers ===
+static void copyField(char *dst, size_t len, const char *src) {
+    snprintf(dst, len, "%s", src ? src : "");
+}
+
+bool postAck(uint8_t channel, const char *cmd, const char *status) {
+    CommsMsg m;
+    m.type = COMMS_ACK;
+    m.channel = channel;
+    copyField(m.ack.cmd, sizeof(m.ack.cmd), cmd);
+    copyField(m.ack.status, sizeof(m.ack.status), status);
+    return commsQueue.push(m);
+}
+
+WarningMsg makeWarning(const char *wLevel, const char *wMessage, const char *wTitle,
+                       WarnPriority priority = WARN_PRIO_NORMAL) {
+    WarningMsg w;
+    copyField(w.level, sizeof(w.level), wLevel);
+    copyField(w.message, sizeof(w.message), wMessage);
+    copyField(w.title, sizeof(w.title), wTitle);
+    w.priority = priority;
+    return w;
+}
+
+bool postWarning(uint8_t channel, const WarningMsg &w) {
+    CommsMsg m;
+    m.type = COMMS_WARNING;
+    m.channel = channel;
+    m.warning = w;
+    return commsQueue.push(m);
+}
+
+bool postWarning(uint8_t channel, const char *wLevel, const char *wMessage, const char *wTitle,
+                 WarnPriority priority = WARN_PRIO_NORMAL) {
+    return postWarning(channel, makeWarning(wLevel, wMessage, wTitle, priority));
+}
+
+bool postSimpleData(uint8_t channel, const SimpleFlowSnapshot &snap) {
+    CommsMsg m;
+    m.type = COMMS_SIMPLE_DATA;
+    m.channel = channel;
+    m.simple = snap;
+    return commsQueue.push(m);
+}
+
+bool postBigData(uint8_t channel, const HourFlowReport &report) {
+    CommsMsg m;
+    m.type = COMMS_BIG_DATA;
+    m.channel = channel;
+    m.hour = report;
+    return commsQueue.push(m);
+}
+
+bool postHistoryTick(uint8_t channel, uint32_t epoch, uint16_t pulses) {
+    CommsMsg m;
+    m.type = COMMS_HISTORY_TICK;
+    m.channel = channel;
+    m.tick.epoch = epoch;
+    m.tick.pulses = pulses;
+    return commsQueue.push(m);
+}
+
+bool postStageStats(uint8_t stage, bool last, uint32_t periodMs, const StageStats &stats) {
+    CommsMsg m;
+    m.type = COMMS_STAGE_STATS;
+    m.channel = 0;
+    m.stage.stage = stage;
+    m.stage.last = last;
+    m.stage.periodMs = periodMs;
+    m.stage.stats = stats;
+    return commsQueue.push(m);
+}
+
+#endif
@@ -0,0 +1,142 @@
+#ifndef MY_WARNINGQUEUE_H
+#define MY_WARNINGQUEUE_H
+
+#include <Arduino.h>
+#include "taskQueues.h"
+
+// ==================================
+// === Pending Warning Queue ========
+// ==================================
+// Warnings waiting for the consumer's ACK (matched by wID), owned by the
+// comms task. An entry is due as soon as it is queued and again each time
+// its ACK timeout runs out, the timeout doubling per unanswered publish up
+// to WARN_ACK_TIMEOUT_MAX_MS; it leaves the queue only when acknowledged.
+// A publish that fails (link down, outbox full) leaves the entry due, so
+// nothing is lost to a disconnect.
+//
+// Entries are kept by priority (WarnPriority), oldest first within one
+// priority, and go out in that order. When the queue is full a new warning
+// evicts the newest entry of a lower priority, or is refused if there is
+// none: a valve shutoff is never pushed out by anything else.
+//
+// The state is plain data so it can be mirrored in RTC memory (rtcShadow.h).
+
+#define WARN_QUEUE_LEN  6
+#define WARN_ID_LEN     64
+#define WARN_BOARD      0xFF    // channel of board-level warnings
+
+const unsigned long WARN_ACK_TIMEOUT_MS = 15000UL;
+const unsigned long WARN_ACK_TIMEOUT_MAX_MS = 240000UL;
+
+struct PendingWarning {
+    char id[WARN_ID_LEN];
+    char timeStamp[20];
+    WarningMsg msg;
+    uint8_t channel;        // flow channel, or WARN_BOARD
+    uint8_t priority;       // WarnPriority
+    uint8_t retries;        // publishes without an ACK so far
+    uint8_t sent;           // 0 = due now, whatever sentAtMs says
+    uint32_t sentAtMs;
+};
+
+struct WarningQueueState {
+    PendingWarning entry[WARN_QUEUE_LEN];
+    uint8_t count;
+};
+
+class WarningQueue {
+public:
+    WarningQueue() { clear(); }
+
+    void clear() { memset(&q, 0, sizeof(q)); }
+
+    // Queue w behind everything of the same or higher priority; false if
+    // the queue is full of entries at w's priority or above
+    bool push(const PendingWarning &w) {
+        if (q.count == WARN_QUEUE_LEN) {
+            uint8_t victim = lowest();
+            if (q.entry[victim].priority >= w.priority) {
+                droppedCount++;
+                return false;
+            }
+            remove(victim);
+            droppedCount++;
+        }
+        uint8_t at = q.count;
+        while (at > 0 && q.entry[at - 1].priority < w.priority) {
+            q.entry[at] = q.entry[at - 1];
+            at--;
+        }
+        q.entry[at] = w;
+        q.entry[at].retries = 0;
+        q.entry[at].sent = 0;
+        q.count++;
+        return true;
+    }
+
+    uint8_t size() const { return q.count; }
+    const PendingWarning &at(uint8_t i) const { return q.entry[i]; }
+
+    bool isDue(uint8_t i, unsigned long nowMs) const {
+        const PendingWarning &e = q.entry[i];
+        return !e.sent || nowMs - e.sentAtMs >= ackTimeout(e.retries);
+    }
+
+    // Entry i was handed to the link; the first publish is not a retry
+    void markSent(uint8_t i, unsigned long nowMs) {
+        PendingWarning &e = q.entry[i];
+        if (e.sent && e.retries < 255) e.retries++;
+        e.sent = 1;
+        e.sentAtMs = nowMs;
+    }
+
+    // Remove the entry with this wID; false if none matches
+    bool ack(const char *id) {
+        for (uint8_t i = 0; i < q.count; i++) {
+            if (strcmp(q.entry[i].id, id) != 0) continue;
+            remove(i);
+            return true;
+        }
+        return false;
+    }
+
+    // After a restart: millis() started over, so everything is due again
+    void markAllDue() {
+        for (uint8_t i = 0; i < q.count; i++) q.entry[i].sent = 0;
+    }
+
+    const WarningQueueState &state() const { return q; }
+
+    // False (and left empty) if st is not a queue this code could have written
+    bool restore(const WarningQueueState &st) {
+        clear();
+        if (st.count > WARN_QUEUE_LEN) return false;
+        q = st;
+        for (uint8_t i = 0; i < q.count; i++) q.entry[i].id[WARN_ID_LEN - 1] = '\0';
+        markAllDue();
+        return true;
+    }
+
+    uint32_t dropped() const { return droppedCount; }
+
+    static unsigned long ackTimeout(uint8_t retries) {
+        unsigned long t = WARN_ACK_TIMEOUT_MS;
+        while (retries-- > 0 && t < WARN_ACK_TIMEOUT_MAX_MS) t *= 2;
+        return t < WARN_ACK_TIMEOUT_MAX_MS ? t : WARN_ACK_TIMEOUT_MAX_MS;
+    }
+
+private:
+    WarningQueueState q;
+    uint32_t droppedCount = 0;
+
+    // Newest entry of the lowest priority: the last one
+    uint8_t lowest() const { return q.count - 1; }
+
+    void remove(uint8_t i) {
+        for (uint8_t k = i; k + 1 < q.count; k++) q.entry[k] = q.entry[k + 1];
+        q.count--;
+        memset(&q.entry[q.count], 0, sizeof(q.entry[q.count]));
+    }
+};
+
+#endif
@@ -5,6 +5,7 @@
 #include <Adafruit_NeoPixel.h>
 #include "time.h"
 #include "mySecrets.h"
+#include "bootTiming.h"
 
 
 
@@ -12,7 +13,6 @@
 // ======================
 // === Forward Decl ====
 // ======================
-void initTime(unsigned long timeoutMillis = 10000);
 void reconnectIfNeeded(); // from espMqtt
 
 // ======================
@@ -56,6 +56,34 @@ void showPixelColorEx(int ledNum, uint8_t r, uint8_t g, uint8_t b) {
   strip.show();
 }
 
+// === Network Status LED ===
+// The NeoPixels belong to the safety side (loop()); the comms task only
+// sets netLed, a single byte, and renderNetLed() shows it from loop(). The
+// onboard pixel and external pixel 2 follow it.
+enum NetLed : uint8_t { NET_LED_BOOT, NET_LED_UP, NET_LED_FAILED, NET_LED_RETRY };
+volatile uint8_t netLed = NET_LED_BOOT;   // written by comms only
+
+void renderNetLed() {
+  static uint8_t shown = NET_LED_BOOT;
+  uint8_t state = netLed;
+  if (state == shown) return;
+  shown = state;
+  switch (state) {
+    case NET_LED_UP:
+      showPixelColorOnboard(0, 255, 0);    // Green
+      showPixelColorEx(2, 0, 255, 0);
+      break;
+    case NET_LED_FAILED:
+      showPixelColorOnboard(255, 0, 0);    // Red
+      showPixelColorEx(2, 255, 0, 0);
+      break;
+    case NET_LED_RETRY:
+      showPixelColorOnboard(255, 255, 0);  // Yellow
+      showPixelColorEx(2, 255, 255, 0);
+      break;
+  }
+}
+
 void startNeoPixel() {
   Serial.print("Starting NeoPixels...");
   pixelOnboard.begin();
@@ -89,6 +117,31 @@ inline bool isWifiReady() {
 // ==========================
 // === WiFi Connection ======
 // ==========================
+// Nothing here waits on the network: connectToWiFi() only starts the
+// association and connectivityTick() (called every loop) polls the link,
+// drives reconnects and NTP sync. The event handler only sets flags.
+enum WifiLinkState { WIFI_LINK_DOWN, WIFI_LINK_CONNECTING, WIFI_LINK_UP };
+WifiLinkState wifiLinkState = WIFI_LINK_DOWN;
+unsigned long wifiConnectStartMs = 0;
+
+// Longest single networking stall seen by the loop (ms)
+unsigned long netStallMaxMs = 0;
+
+inline void recordNetStall(unsigned long startMs) {
+  unsigned long d = millis() - startMs;
+  if (d > netStallMaxMs) netStallMaxMs = d;
+}
+
+void startTimeSync();
+void tickTimeSync();
+
+void wifiBegin() {
+  WiFi.begin(SECRET_SSID, SECRET_PASS);
+  wifiLinkState = WIFI_LINK_CONNECTING;
+  wifiConnectStartMs = millis();
+  wifiCheckMs = wifiConnectStartMs;
+}
+
 void connectToWiFi() {
   // Safer reconnect behavior on ESP32
   WiFi.persistent(false);
@@ -96,104 +149,73 @@ void connectToWiFi() {
   WiFi.setAutoReconnect(true);
   WiFi.mode(WIFI_STA);
 
-  // Event hooks (works on current cores; compiles on older too)
-  WiFi.onEvent([](WiFiEvent_t event, WiFiEventInfo_t info){
+  // Event hooks only set flags (they run on the WiFi event task)
+  WiFi.onEvent([](WiFiEvent_t event, WiFiEventInfo_t){
     if (event == ARDUINO_EVENT_WIFI_STA_CONNECTED || event == SYSTEM_EVENT_STA_CONNECTED) {
       wifiStaConnected = true;
-      Serial.println("WiFi STA connected.");
     }
     if (event == ARDUINO_EVENT_WIFI_STA_GOT_IP || event == SYSTEM_EVENT_STA_GOT_IP) {
       wifiGotIP = true;
-      Serial.print("WiFi got IP: "); Serial.println(WiFi.localIP());
-      // Sync time & (re)connect MQTT once we truly have network
-      initTime();
-      reconnectIfNeeded();
     }
     if (event == ARDUINO_EVENT_WIFI_STA_DISCONNECTED || event == SYSTEM_EVENT_STA_DISCONNECTED) {
       wifiStaConnected = false;
       wifiGotIP = false;
       isNtpTimeConnected = false;
-      Serial.println("WiFi STA disconnected.");
-      // Optional: force-drop MQTT so it won’t look "connected" while WiFi is down
-      // (mqttClient is defined in espMqtt.h)
-      // extern PubSubClient mqttClient;
-      // if (mqttClient.connected()) mqttClient.disconnect();
     }
   });
 
-  WiFi.begin(SECRET_SSID, SECRET_PASS);
-
-  Serial.println("Connecting to WiFi.");
-  unsigned long startAttempt = millis();
-  while (!isWifiReady() && millis() - startAttempt < wifiConnectTimeoutMS) {
-    delay(500);
-    Serial.print(".");
-  }
-  Serial.println();
-
-  if (isWifiReady()) {
-    showPixelColorOnboard(0, 255, 0);
-    showPixelColorEx(2, 0, 255, 0);
-    Serial.println("WiFi Connected!");
-    Serial.print("IP: "); Serial.println(WiFi.localIP());
-    Serial.print("MAC: "); Serial.println(WiFi.macAddress());
-    Serial.print("Channel: "); Serial.println(WiFi.channel());
-    Serial.print("RSSI: "); Serial.println(WiFi.RSSI());
-    // ensure NTP at boot too (in case event fired before we attached)
-    initTime();
-  } else {
-    Serial.println("WiFi connection failed.");
-    showPixelColorOnboard(255, 0, 0);
-    showPixelColorEx(2, 255, 0, 0);
-  }
+  Serial.println("Connecting to WiFi (background).");
+  wifiBegin();
 }
 
+void onWiFiUp() {
+  wifiLinkState = WIFI_LINK_UP;
+  markBoot(bootTiming.wifiMs);
+  netLed = NET_LED_UP;
+  Serial.println("WiFi Connected!");
+  Serial.print("IP: "); Serial.println(WiFi.localIP());
+  Serial.print("RSSI: "); Serial.println(WiFi.RSSI());
+  startTimeSync();
+  reconnectIfNeeded();
+}
 
 void checkWiFiReconnect() {
-  if (isWifiConnected()) return;
-
-  if (millis() - wifiCheckMs < wifiReconnectIntervalMS) {
-    Serial.println("WiFi not connected. Waiting...");
-    isNtpTimeConnected = false;
+  if (isWifiConnected()) {
+    if (wifiLinkState != WIFI_LINK_UP) onWiFiUp();
     return;
   }
 
-  wifiCheckMs = millis();
-  Serial.println("WiFi disconnected! Attempting to reconnect...");
-  showPixelColorOnboard(255, 255, 0);  // Yellow
-  showPixelColorEx(2, 255, 255, 0);  // Yellow
-
-  WiFi.disconnect(true);
-  delay(1000);
-  WiFi.begin(SECRET_SSID, SECRET_PASS);
-
-  unsigned long startAttempt = millis();
-  while (!isWifiConnected() && millis() - startAttempt < wifiConnectTimeoutMS) {
-    delay(500);
-    Serial.print(".");
+  if (wifiLinkState == WIFI_LINK_UP) {
+    Serial.println("WiFi disconnected!");
+    wifiLinkState = WIFI_LINK_DOWN;
+    isNtpTimeConnected = false;
   }
-  Serial.println();
 
-  if (isWifiConnected()) {
-    Serial.println("WiFi reconnected.");
-    showPixelColorOnboard(0, 255, 0);   // Green
-    showPixelColorEx(2, 0, 255, 0);
-    initTime();                         // Sync time again
-    reconnectIfNeeded();               // Reconnect MQTT
-  } else {
-    Serial.println("Reconnection failed.");
-    isNtpTimeConnected = false;
-    showPixelColorOnboard(255, 0, 0);   // Red
-    showPixelColorEx(2, 255, 0, 0);
+  if (wifiLinkState == WIFI_LINK_CONNECTING) {
+    if (millis() - wifiConnectStartMs < wifiConnectTimeoutMS) return;
+    Serial.println("WiFi connection failed.");
+    wifiLinkState = WIFI_LINK_DOWN;
+    netLed = NET_LED_FAILED;
+    return;
   }
+
+  if (millis() - wifiCheckMs < wifiReconnectIntervalMS) return;
+
+  Serial.println("WiFi disconnected! Attempting to reconnect...");
+  netLed = NET_LED_RETRY;
+  WiFi.disconnect();
+  wifiBegin();
 }
 
 // =========================
 // === Time Management =====
 // =========================
+enum TimeSyncState { TIME_SYNC_IDLE, TIME_SYNC_WAITING };
+TimeSyncState timeSyncState = TIME_SYNC_IDLE;
+unsigned long timeSyncStartMs = 0;
+const unsigned long timeSyncTimeoutMS = 10000;
 
-
-void initTime(unsigned long timeoutMillis) {
+void startTimeSync() {
   if (!isWifiConnected()) {
     Serial.println("NTP skipped: No WiFi.");
     isNtpTimeConnected = false;
@@ -201,23 +223,33 @@ void initTime(unsigned long timeoutMillis) {
   }
 
   configTzTime(timeZone, ntpServer);
-  Serial.println("Waiting for NTP sync...");
+  Serial.println("Waiting for NTP sync (background)...");
+  timeSyncState = TIME_SYNC_WAITING;
+  timeSyncStartMs = millis();
+}
 
-  struct tm timeinfo;
-  unsigned long start = millis();
+// Polls the SNTP result without waiting (getLocalTime timeout of 0 ms)
+void tickTimeSync() {
+  if (timeSyncState != TIME_SYNC_WAITING) return;
 
-  while (!getLocalTime(&timeinfo)) {
-    if (millis() - start > timeoutMillis) {
-      Serial.println("NTP sync failed: timeout.");
-      isNtpTimeConnected = false;
-      return;
-    }
-    delay(500);
-    Serial.print(".");
+  struct tm timeinfo;
+  if (getLocalTime(&timeinfo, 0)) {
+    Serial.println("Time synchronized!");
+    isNtpTimeConnected = true;
+    markBoot(bootTiming.timeMs);
+    timeSyncState = TIME_SYNC_IDLE;
+  } else if (millis() - timeSyncStartMs > timeSyncTimeoutMS) {
+    Serial.println("NTP sync failed: timeout.");
+    isNtpTimeConnected = false;
+    timeSyncState = TIME_SYNC_IDLE;
   }
+}
 
-  Serial.println("\nTime synchronized!");
-  isNtpTimeConnected = true;
+void connectivityTick() {
+  unsigned long startMs = millis();
+  checkWiFiReconnect();
+  tickTimeSync();
+  recordNetStall(startMs);
 }
 
 void updateTime() {
@@ -228,7 +260,7 @@ void updateTime() {
   }
 
   struct tm timeinfo;
-  if (!getLocalTime(&timeinfo)) {
+  if (!getLocalTime(&timeinfo, 0)) {
     Serial.println("Failed to get time.");
     isNtpTimeConnected = false;
   }
@@ -237,36 +269,93 @@ void updateTime() {
 // ==============================
 // === Time Utility Functions ===
 // ==============================
+// Callers capture one TimeSnapshot per tick and read every field from it, so
+// the broken-down conversion runs once and all calculations in that tick see
+// the same instant. Strings go into caller-supplied buffers.
+enum TimeField {
+  TIME_YEAR, TIME_MONTH, TIME_DAY, TIME_HOUR, TIME_MINUTE, TIME_SECOND, TIME_MINUTES_TODAY
+};
+
+enum TimeFormat {
+  TIME_FMT_DATE_TIME,       // "%Y-%m-%d %H:%M:%S"
+  TIME_FMT_DATE,            // "%Y-%m-%d"
+  TIME_FMT_TIME,            // "%H:%M:%S"
+  TIME_FMT_DATE_TIME_MIN    // "%Y-%m-%dT%H:%M" (report timestamps)
+};
+
+#define TIME_STR_LEN 20                        // fits every TimeFormat and the placeholder
+#define TIME_UNSYNCED_STR "0000-00-00 00:00:00"
+
+struct TimeSnapshot {
+  bool valid;         // false until NTP has set the clock once
+  uint32_t epoch;     // 0 when !valid
+  struct tm tm;
+};
+
+// Epoch seconds, or 0 while the clock has never been synced
+uint32_t getEpoch() {
+  time_t now;
+  time(&now);
+  return now < 1600000000 ? 0 : (uint32_t)now;
+}
 
-int getTimeInt(String key) {
-  if (!isWifiConnected() || !isNtpTimeConnected) return -1;
-  struct tm timeinfo;
-  if (!getLocalTime(&timeinfo)) return -1;
-
-  if (key == "Year") return timeinfo.tm_year + 1900;
-  if (key == "Month") return timeinfo.tm_mon + 1;
-  if (key == "Day") return timeinfo.tm_mday;
-  if (key == "Hour") return timeinfo.tm_hour;
-  if (key == "Minute") return timeinfo.tm_min;
-  if (key == "Second") return timeinfo.tm_sec;
-  if (key == "MinutesToday") return timeinfo.tm_hour * 60 + timeinfo.tm_min;
+bool captureTime(TimeSnapshot &t) {
+  time_t now;
+  time(&now);
+  // The RTC keeps running through WiFi drops, so only a never-synced clock is invalid
+  t.valid = now >= 1600000000;
+  t.epoch = t.valid ? (uint32_t)now : 0;
+  if (t.valid) localtime_r(&now, &t.tm);
+  else memset(&t.tm, 0, sizeof(t.tm));
+  return t.valid;
+}
 
+// -1 while the snapshot is not valid
+int timeField(const TimeSnapshot &t, TimeField field) {
+  if (!t.valid) return -1;
+  switch (field) {
+    case TIME_YEAR:          return t.tm.tm_year + 1900;
+    case TIME_MONTH:         return t.tm.tm_mon + 1;
+    case TIME_DAY:           return t.tm.tm_mday;
+    case TIME_HOUR:          return t.tm.tm_hour;
+    case TIME_MINUTE:        return t.tm.tm_min;
+    case TIME_SECOND:        return t.tm.tm_sec;
+    case TIME_MINUTES_TODAY: return t.tm.tm_hour * 60 + t.tm.tm_min;
+  }
   return -1;
 }
 
-String getTimeString(String key) {
-  if (!isWifiConnected() || !isNtpTimeConnected) return "0000-00-00 00:00:00";
-  struct tm timeinfo;
-  if (!getLocalTime(&timeinfo)) return "0000-00-00 00:00:00";
+// Writes TIME_UNSYNCED_STR and returns false while the snapshot is not valid
+bool formatTime(const TimeSnapshot &t, TimeFormat fmt, char *buffer, size_t len) {
+  if (!t.valid) {
+    snprintf(buffer, len, "%s", TIME_UNSYNCED_STR);
+    return false;
+  }
+  const char *pattern = "%Y-%m-%dT%H:%M";
+  switch (fmt) {
+    case TIME_FMT_DATE_TIME:     pattern = "%Y-%m-%d %H:%M:%S"; break;
+    case TIME_FMT_DATE:          pattern = "%Y-%m-%d"; break;
+    case TIME_FMT_TIME:          pattern = "%H:%M:%S"; break;
+    case TIME_FMT_DATE_TIME_MIN: break;
+  }
+  strftime(buffer, len, pattern, &t.tm);
+  return true;
+}
 
-  char buffer[26];
-  if (key == "DateTime")     strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &timeinfo);
-  else if (key == "Date")    strftime(buffer, sizeof(buffer), "%Y-%m-%d", &timeinfo);
-  else if (key == "Time")    strftime(buffer, sizeof(buffer), "%H:%M:%S", &timeinfo);
-  else if (key == "DateTimeMin") strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M", &timeinfo);
-  else return "0000-00-00 00:00:00";
+// Format a stored epoch as "DateTimeMin" for reports; 0 formats as ""
+void formatEpoch(uint32_t epoch, char *buffer, size_t len) {
+  if (epoch == 0) { buffer[0] = '\0'; return; }
+  time_t t = epoch;
+  struct tm timeinfo;
+  localtime_r(&t, &timeinfo);
+  strftime(buffer, len, "%Y-%m-%dT%H:%M", &timeinfo);
+}
 
-  return String(buffer);
+// One-off "DateTimeMin" for now (comms side, outside the safety tick)
+bool formatTimeNow(char *buffer, size_t len) {
+  TimeSnapshot t;
+  captureTime(t);
+  return formatTime(t, TIME_FMT_DATE_TIME_MIN, buffer, len);
 }
 
 
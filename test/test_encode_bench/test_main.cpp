@@ -0,0 +1,102 @@
+// ==================================
+// === Telemetry encoding bench =====
+// ==================================
+// Host only:  pio test -e native -f test_encode_bench
+// Encodes a typical hourly report and simpleFlowData snapshot as JSON and as
+// MessagePack (the TELEMETRY_ENCODING choices in espMqtt.h) and reports the
+// payload size and encode time of each. Only the encodes themselves are
+// checked; the figures are for reading, and only mean something when the
+// test is built against the real ArduinoJson. Sizes carry over to the
+// ESP32 as-is; the times only compare the two encoders with each other.
+
+#include <unity.h>
+#include <chrono>
+#include <wifiComs.h>
+#include "flowMon.h"
+#include "espMqtt.h"
+
+static HourFlowReport hour;
+static SimpleFlowSnapshot snap;
+
+void setUp(void) {
+  memset(&hour, 0, sizeof(hour));
+  hour.max10s = 4.82f;
+  hour.max1m = 3.91f;
+  hour.max10m = 1.27f;
+  hour.volumeHour = 23.6f;
+  hour.volumeAll = 48211.4f;
+  hour.max10sEpoch = 1735718470;
+  hour.max1mEpoch = 1735718460;
+  hour.max10mEpoch = 1735718400;
+  hour.startEpoch = 1735718400;
+  hour.rejEdges = 2;
+  hour.minPerUs = 11840;
+  hour.histBaseGpm = 0.0375f;
+  const uint16_t hist[FLOW_HIST_BINS] = {318, 4, 3, 6, 9, 11, 8, 1, 0, 0, 0, 0};
+  memcpy(hour.hist, hist, sizeof(hist));
+  hour.simpleSent = 14;
+  hour.simpleSuppressed = 346;
+  hour.valveMode = 1;
+  strcpy(hour.timeStamp, "2025-01-01 08:00:00");
+
+  memset(&snap, 0, sizeof(snap));
+  snap.flow10s = 2.25f;
+  snap.flowAvg = 1.98f;
+  snap.volumeAll = 48211.4f;
+  snap.runTimeSec = 140;
+  snap.rejEdges = 2;
+  snap.nvsWrites = 5120;
+  snap.valveMode = 1;
+}
+
+void tearDown(void) {}
+
+template <typename F>
+static double nsPerCall(F encode, uint32_t calls) {
+  std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < calls; i++) encode();
+  std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(t1 - t0).count() / calls;
+}
+
+static void report(const char *what, size_t jsonLen, double jsonNs, size_t packLen, double packNs) {
+  char msg[160];
+  snprintf(msg, sizeof(msg), "%s: JSON %u B in %.0f ns, MessagePack %u B in %.0f ns",
+           what, (unsigned)jsonLen, jsonNs, (unsigned)packLen, packNs);
+  TEST_MESSAGE(msg);
+}
+
+void test_hour_report(void) {
+  const uint32_t calls = 20000;
+  static char json[512];
+  static uint8_t packed[512];
+  size_t jsonLen = 0, packLen = 0;
+  double jsonNs = nsPerCall([&] { jsonLen = encodeHourJson(0, hour, json, sizeof(json)); }, calls);
+  double packNs = nsPerCall([&] { packLen = encodeHourMsgPack(hour, packed, sizeof(packed)); }, calls);
+
+  TEST_ASSERT_TRUE(jsonLen > 0);
+  TEST_ASSERT_TRUE(packLen > 0);
+  TEST_ASSERT_EQUAL_UINT32(0, jsonTxArena.overflows());
+  report("hourly report", jsonLen, jsonNs, packLen, packNs);
+}
+
+void test_simple_snapshot(void) {
+  const uint32_t calls = 50000;
+  static char json[256];
+  static uint8_t packed[256];
+  size_t jsonLen = 0, packLen = 0;
+  double jsonNs = nsPerCall([&] { jsonLen = encodeSimpleJson(snap, json, sizeof(json)); }, calls);
+  double packNs = nsPerCall([&] { packLen = encodeSimpleMsgPack(snap, packed, sizeof(packed)); }, calls);
+
+  TEST_ASSERT_TRUE(jsonLen > 0);
+  TEST_ASSERT_TRUE(packLen > 0);
+  TEST_ASSERT_EQUAL_UINT32(0, jsonTxArena.overflows());
+  report("simpleFlowData", jsonLen, jsonNs, packLen, packNs);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_hour_report);
+  RUN_TEST(test_simple_snapshot);
+  return UNITY_END();
+}
@@ -0,0 +1,236 @@
+// ==================================
+// === FlowHistory tests ============
+// ==================================
+// Host only:  pio test -e native -f test_flow_history
+// Runs the history against a scratch directory (the same stdio code path
+// as LittleFS on the ESP32), with 4 pages so rotation is quick to reach.
+// Counts round-trip through the zigzag/varint encoding, including large
+// jumps and long runs, and survive a reopen; read() starts mid-chunk,
+// stops at a gap in time and honours maxCount/toEpoch; full pages rotate
+// out the oldest ticks; a torn chunk at the tail is dropped on reopen.
+
+#include <unity.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+
+#define FLOW_HISTORY_PAGES 4
+#include "flowHistory.h"
+
+typedef FlowHistory<DomesticSampling> History;
+static const uint32_t TICK = History::Plan::tickSec;
+static const uint32_t T0 = 1735718400;   // 2025-01-01 08:00 UTC
+
+static char histDir[64];
+
+static void pageFile(uint8_t slot, char *path, size_t len) {
+  snprintf(path, len, "%s/fh0_%u.bin", histDir, (unsigned)slot);
+}
+
+// Deterministic meter: idle stretches, steady runs and jumps in both directions
+static uint16_t pulsesAt(uint32_t i) {
+  if ((i / 90) % 3 == 0) return 0;
+  if ((i / 30) % 4 == 1) return 12;
+  return (uint16_t)((i * 7919UL) % 600);
+}
+
+// Every tick from fromEpoch up to toEpoch, across gaps, as (epoch, count)
+static void readAll(History &h, uint32_t fromEpoch, uint32_t toEpoch,
+                    std::vector<uint32_t> &epochs, std::vector<uint16_t> &counts) {
+  uint16_t out[50];
+  uint32_t first = 0;
+  for (;;) {
+    uint16_t n = h.read(fromEpoch, toEpoch, out, 50, &first);
+    if (n == 0) return;
+    for (uint16_t i = 0; i < n; i++) {
+      epochs.push_back(first + i * TICK);
+      counts.push_back(out[i]);
+    }
+    fromEpoch = first + n * TICK;
+  }
+}
+
+void setUp(void) {
+  snprintf(histDir, sizeof(histDir), "/tmp/fhisttestXXXXXX");
+  TEST_ASSERT_NOT_NULL(mkdtemp(histDir));
+}
+
+void tearDown(void) {
+  char path[80];
+  for (uint8_t i = 0; i < FLOW_HISTORY_PAGES; i++) {
+    pageFile(i, path, sizeof(path));
+    unlink(path);
+  }
+  rmdir(histDir);
+}
+
+void test_counts_round_trip(void) {
+  // Varint widths 1..3 bytes, both delta signs, and a run spanning several chunks
+  static const uint16_t values[] = {0, 1, 0, 63, 64, 8191, 8192, 65535, 0, 65535, 1, 300, 299};
+  History h(histDir, 0);
+  h.begin();
+  uint32_t n = 0;
+  for (uint8_t k = 0; k < sizeof(values) / sizeof(values[0]); k++) h.add(T0 + TICK * n++, values[k]);
+  for (uint16_t k = 0; k < 200; k++) h.add(T0 + TICK * n++, 7);
+  h.flush();
+
+  History again(histDir, 0);
+  again.begin();
+  std::vector<uint32_t> epochs;
+  std::vector<uint16_t> counts;
+  readAll(again, T0, UINT32_MAX, epochs, counts);
+  TEST_ASSERT_EQUAL_UINT32(n, counts.size());
+  for (uint8_t k = 0; k < sizeof(values) / sizeof(values[0]); k++) TEST_ASSERT_EQUAL_UINT16(values[k], counts[k]);
+  for (uint32_t k = sizeof(values) / sizeof(values[0]); k < n; k++) TEST_ASSERT_EQUAL_UINT16(7, counts[k]);
+  TEST_ASSERT_EQUAL_UINT32(T0, epochs[0]);
+  TEST_ASSERT_EQUAL_UINT32(T0 + (n - 1) * TICK, epochs[n - 1]);
+  TEST_ASSERT_EQUAL_UINT32(T0, again.oldestEpoch());
+}
+
+void test_idle_hour_is_small(void) {
+  History h(histDir, 0);
+  h.begin();
+  for (uint32_t i = 0; i < History::Plan::hourTicks; i++) h.add(T0 + i * TICK, 0);
+  h.flush();
+  // One run token per chunk plus its header
+  TEST_ASSERT_LESS_OR_EQUAL(8 + 6 * 17, h.bytesUsed());
+}
+
+void test_read_from_mid_chunk(void) {
+  History h(histDir, 0);
+  h.begin();
+  for (uint32_t i = 0; i < 100; i++) h.add(T0 + i * TICK, pulsesAt(i + 100));
+  h.flush();
+
+  uint16_t out[10];
+  uint32_t first = 0;
+  TEST_ASSERT_EQUAL_UINT16(10, h.read(T0 + 25 * TICK, UINT32_MAX, out, 10, &first));
+  TEST_ASSERT_EQUAL_UINT32(T0 + 25 * TICK, first);
+  for (uint8_t i = 0; i < 10; i++) TEST_ASSERT_EQUAL_UINT16(pulsesAt(125 + i), out[i]);
+
+  // Off-grid: the tick within half a tick of fromEpoch is included
+  TEST_ASSERT_EQUAL_UINT16(10, h.read(T0 + 25 * TICK + TICK / 2 - 1, UINT32_MAX, out, 10, &first));
+  TEST_ASSERT_EQUAL_UINT32(T0 + 25 * TICK, first);
+  TEST_ASSERT_EQUAL_UINT16(10, h.read(T0 + 25 * TICK + TICK / 2 + 1, UINT32_MAX, out, 10, &first));
+  TEST_ASSERT_EQUAL_UINT32(T0 + 26 * TICK, first);
+
+  // Into the second chunk (flushTicks per chunk), and bounded by toEpoch
+  TEST_ASSERT_EQUAL_UINT16(5, h.read(T0 + 58 * TICK, T0 + 63 * TICK, out, 10, &first));
+  TEST_ASSERT_EQUAL_UINT32(T0 + 58 * TICK, first);
+  for (uint8_t i = 0; i < 5; i++) TEST_ASSERT_EQUAL_UINT16(pulsesAt(158 + i), out[i]);
+
+  TEST_ASSERT_EQUAL_UINT16(0, h.read(T0 + 100 * TICK, UINT32_MAX, out, 10, &first));
+}
+
+void test_read_stops_at_gap(void) {
+  History h(histDir, 0);
+  h.begin();
+  for (uint32_t i = 0; i < 20; i++) h.add(T0 + i * TICK + (i % 2) * 3, 5);   // timer jitter stays on grid
+  uint32_t resume = T0 + 30 * TICK;                                           // 10 ticks missing
+  for (uint32_t i = 0; i < 20; i++) h.add(resume + i * TICK, 9);
+  h.flush();
+
+  uint16_t out[50];
+  uint32_t first = 0;
+  TEST_ASSERT_EQUAL_UINT16(20, h.read(T0, UINT32_MAX, out, 50, &first));
+  TEST_ASSERT_EQUAL_UINT32(T0, first);
+  TEST_ASSERT_EQUAL_UINT16(5, out[19]);
+
+  // The next read after the run picks up past the gap
+  TEST_ASSERT_EQUAL_UINT16(20, h.read(T0 + 20 * TICK, UINT32_MAX, out, 50, &first));
+  TEST_ASSERT_EQUAL_UINT32(resume, first);
+  TEST_ASSERT_EQUAL_UINT16(9, out[0]);
+}
+
+void test_unsynced_ticks_are_dropped(void) {
+  History h(histDir, 0);
+  h.begin();
+  h.add(0, 40);
+  h.flush();
+  TEST_ASSERT_EQUAL_UINT32(0, h.chunksWritten());
+  TEST_ASSERT_EQUAL_UINT32(0, h.oldestEpoch());
+}
+
+void test_pages_rotate_out_oldest(void) {
+  const uint32_t total = 30000;   // ~2.5x what 4 pages hold for this data
+  {
+    History h(histDir, 0);
+    h.begin();
+    for (uint32_t i = 0; i < total; i++) h.add(T0 + i * TICK, pulsesAt(i));
+    h.flush();
+    TEST_ASSERT_EQUAL_UINT32(0, h.chunksFailed());
+    TEST_ASSERT_LESS_OR_EQUAL(h.capacityBytes(), h.bytesUsed());
+  }
+
+  History h(histDir, 0);
+  h.begin();
+  uint32_t oldest = h.oldestEpoch();
+  TEST_ASSERT_GREATER_THAN(T0, oldest);
+  TEST_ASSERT_EQUAL_UINT32(0, (oldest - T0) % TICK);
+
+  std::vector<uint32_t> epochs;
+  std::vector<uint16_t> counts;
+  readAll(h, T0, UINT32_MAX, epochs, counts);
+  TEST_ASSERT_EQUAL_UINT32(oldest, epochs.front());
+  TEST_ASSERT_EQUAL_UINT32(T0 + (total - 1) * TICK, epochs.back());
+  TEST_ASSERT_EQUAL_UINT32((T0 + total * TICK - oldest) / TICK, counts.size());
+  for (size_t k = 0; k < counts.size(); k++)
+    TEST_ASSERT_EQUAL_UINT16(pulsesAt((epochs[k] - T0) / TICK), counts[k]);
+
+  // Appending after the reopen continues the ring, it does not restart it
+  for (uint32_t i = total; i < total + 100; i++) h.add(T0 + i * TICK, pulsesAt(i));
+  h.flush();
+  History third(histDir, 0);
+  third.begin();
+  uint16_t out[100];
+  uint32_t first = 0;
+  TEST_ASSERT_EQUAL_UINT16(100, third.read(T0 + total * TICK, UINT32_MAX, out, 100, &first));
+  TEST_ASSERT_EQUAL_UINT16(pulsesAt(total + 99), out[99]);
+  TEST_ASSERT_TRUE(third.oldestEpoch() >= oldest);
+}
+
+void test_torn_tail_is_dropped(void) {
+  {
+    History h(histDir, 0);
+    h.begin();
+    for (uint32_t i = 0; i < 120; i++) h.add(T0 + i * TICK, pulsesAt(i + 100));
+    h.flush();   // two full chunks
+  }
+  char path[80];
+  pageFile(0, path, sizeof(path));
+  long size = 0;
+  FILE *f = fopen(path, "rb");
+  TEST_ASSERT_NOT_NULL(f);
+  fseek(f, 0, SEEK_END);
+  size = ftell(f);
+  fclose(f);
+  TEST_ASSERT_EQUAL_INT(0, truncate(path, size - 3));   // power cut during the second write
+
+  History h(histDir, 0);
+  h.begin();
+  std::vector<uint32_t> epochs;
+  std::vector<uint16_t> counts;
+  readAll(h, T0, UINT32_MAX, epochs, counts);
+  TEST_ASSERT_EQUAL_UINT32(History::flushTicks, counts.size());
+
+  // New ticks go to a fresh page, never after the partial chunk
+  for (uint32_t i = 120; i < 130; i++) h.add(T0 + i * TICK, 33);
+  h.flush();
+  epochs.clear();
+  counts.clear();
+  readAll(h, T0 + 120 * TICK, UINT32_MAX, epochs, counts);
+  TEST_ASSERT_EQUAL_UINT32(10, counts.size());
+  TEST_ASSERT_EQUAL_UINT16(33, counts[9]);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_counts_round_trip);
+  RUN_TEST(test_idle_hour_is_small);
+  RUN_TEST(test_read_from_mid_chunk);
+  RUN_TEST(test_read_stops_at_gap);
+  RUN_TEST(test_unsynced_ticks_are_dropped);
+  RUN_TEST(test_pages_rotate_out_oldest);
+  RUN_TEST(test_torn_tail_is_dropped);
+  return UNITY_END();
+}
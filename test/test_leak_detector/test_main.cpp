@@ -0,0 +1,168 @@
+// ==================================
+// === LeakDetector tests ===========
+// ==================================
+// Host only:  pio test -e native -f test_leak_detector
+// Continuous-flow warn/crit thresholds and the quiet-interval reset, the
+// hourly and per-run volume alerts against their baselines, the minSamples
+// gate, and that baselines only learn from hours/runs that did not alert.
+
+#include <unity.h>
+#include "leakDetector.h"
+
+#define TICK_SEC 10
+
+static const LeakConfig config = {
+    60,     // quietSec
+    300,    // continuousWarnSec
+    600,    // continuousCritSec
+    2.0f,   // hourFactor
+    1.0f,   // hourMarginGal
+    2.0f,   // runFactor
+    1.0f,   // runMarginGal
+    120,    // runGapSec
+    3,      // minSamples
+    2       // ewmaShift: 1/4
+};
+
+static LeakDetector leak(config, TICK_SEC);
+
+// n ticks with flow; returns the alerts raised along the way
+static uint8_t flowTicks(uint32_t n, float galPerTick = 0.1f) {
+  uint8_t alerts = LEAK_NONE;
+  for (uint32_t i = 0; i < n; i++) alerts |= leak.tick(1, galPerTick);
+  return alerts;
+}
+
+static uint8_t quietTicks(uint32_t n) {
+  uint8_t alerts = LEAK_NONE;
+  for (uint32_t i = 0; i < n; i++) alerts |= leak.tick(0, 0);
+  return alerts;
+}
+
+// One run of gal gallons in a single tick, ended by the run gap
+static uint8_t run(float gal) {
+  uint8_t alerts = leak.tick(1, gal);
+  return alerts | quietTicks(config.runGapSec / TICK_SEC);
+}
+
+void setUp(void) { leak.reset(); }
+void tearDown(void) {}
+
+void test_continuous_warn_then_crit(void) {
+  TEST_ASSERT_EQUAL_UINT8(LEAK_NONE, flowTicks(config.continuousWarnSec / TICK_SEC - 1));
+  TEST_ASSERT_EQUAL_UINT8(0, leak.level());
+  TEST_ASSERT_EQUAL_UINT8(LEAK_CONTINUOUS_WARN, leak.tick(1, 0.1f));
+  TEST_ASSERT_EQUAL_UINT32(config.continuousWarnSec, leak.continuousFlowSec());
+  TEST_ASSERT_EQUAL_UINT8(1, leak.level());
+
+  uint32_t toCrit = (config.continuousCritSec - config.continuousWarnSec) / TICK_SEC;
+  TEST_ASSERT_EQUAL_UINT8(LEAK_NONE, flowTicks(toCrit - 1));   // warn fires once
+  TEST_ASSERT_EQUAL_UINT8(LEAK_CONTINUOUS_CRIT, leak.tick(1, 0.1f));
+  TEST_ASSERT_EQUAL_UINT8(2, leak.level());
+  TEST_ASSERT_EQUAL_UINT8(LEAK_NONE, flowTicks(20));
+}
+
+void test_short_gaps_do_not_reset(void) {
+  // A drip: one pulse, then just under quietSec without one, repeated
+  uint8_t gapTicks = config.quietSec / TICK_SEC - 1;
+  uint8_t alerts = LEAK_NONE;
+  for (int i = 0; i < 6; i++) {
+    alerts |= leak.tick(1, 0.01f);
+    alerts |= quietTicks(gapTicks);
+  }
+  TEST_ASSERT_EQUAL_UINT32(6 * (1 + gapTicks) * TICK_SEC, leak.continuousFlowSec());
+  TEST_ASSERT_EQUAL_UINT8(LEAK_CONTINUOUS_WARN, alerts);
+}
+
+void test_quiet_interval_resets_and_rearms(void) {
+  TEST_ASSERT_EQUAL_UINT8(LEAK_CONTINUOUS_WARN, flowTicks(config.continuousWarnSec / TICK_SEC));
+  quietTicks(config.quietSec / TICK_SEC - 1);
+  TEST_ASSERT_EQUAL_UINT8(1, leak.level());                    // not quiet long enough yet
+  quietTicks(1);
+  TEST_ASSERT_EQUAL_UINT32(0, leak.continuousFlowSec());
+  TEST_ASSERT_EQUAL_UINT8(0, leak.level());
+
+  // A new event raises the warning again
+  TEST_ASSERT_EQUAL_UINT8(LEAK_CONTINUOUS_WARN, flowTicks(config.continuousWarnSec / TICK_SEC));
+}
+
+void test_hour_alert_and_learning(void) {
+  for (int i = 0; i < config.minSamples; i++) TEST_ASSERT_EQUAL_UINT8(LEAK_NONE, leak.endHour(7, 10.0f));
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 10.0f, leak.hourBaselineGal(7));
+
+  // Threshold 10 * 2 + 1 = 21 gal
+  TEST_ASSERT_EQUAL_UINT8(LEAK_HOUR_VOLUME, leak.endHour(7, 21.5f));
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 10.0f, leak.hourBaselineGal(7));   // alert hour not learned
+  TEST_ASSERT_EQUAL_UINT8(LEAK_NONE, leak.endHour(7, 20.0f));
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 12.5f, leak.hourBaselineGal(7));   // 10 + (20 - 10) / 4
+
+  // Other hours keep their own baseline
+  TEST_ASSERT_EQUAL_UINT8(LEAK_NONE, leak.endHour(8, 500.0f));
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 500.0f, leak.hourBaselineGal(8));
+  TEST_ASSERT_EQUAL_UINT8(LEAK_NONE, leak.endHour(-1, 500.0f));
+  TEST_ASSERT_EQUAL_UINT8(LEAK_NONE, leak.endHour(24, 500.0f));
+}
+
+void test_hour_needs_min_samples(void) {
+  for (int i = 0; i < config.minSamples - 1; i++) leak.endHour(3, 1.0f);
+  TEST_ASSERT_EQUAL_UINT8(LEAK_NONE, leak.endHour(3, 100.0f));   // learned, not alerted
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 1.0f + 0.25f * 99.0f, leak.hourBaselineGal(3));
+  TEST_ASSERT_EQUAL_UINT8(config.minSamples, leak.state().hourSamples[3]);
+}
+
+void test_run_alert_and_learning(void) {
+  for (int i = 0; i < config.minSamples; i++) TEST_ASSERT_EQUAL_UINT8(LEAK_NONE, run(1.0f));
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 1.0f, leak.runBaselineGal());
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 0.0f, leak.runVolumeGal());
+
+  // Threshold 1 * 2 + 1 = 3 gal, raised once per run
+  TEST_ASSERT_EQUAL_UINT8(LEAK_NONE, leak.tick(1, 2.5f));
+  TEST_ASSERT_EQUAL_UINT8(LEAK_RUN_VOLUME, leak.tick(1, 1.0f));
+  TEST_ASSERT_EQUAL_UINT8(1, leak.level());
+  TEST_ASSERT_EQUAL_UINT8(LEAK_NONE, leak.tick(1, 5.0f));
+  quietTicks(config.runGapSec / TICK_SEC);
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 1.0f, leak.runBaselineGal());   // alert run not learned
+  TEST_ASSERT_EQUAL_UINT8(0, leak.level());
+
+  TEST_ASSERT_EQUAL_UINT8(LEAK_NONE, run(2.0f));
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 1.25f, leak.runBaselineGal());
+}
+
+void test_run_needs_min_samples(void) {
+  for (int i = 0; i < config.minSamples - 1; i++) run(1.0f);
+  TEST_ASSERT_EQUAL_UINT8(LEAK_NONE, run(50.0f));
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 1.0f + 0.25f * 49.0f, leak.runBaselineGal());
+  TEST_ASSERT_EQUAL_UINT8(config.minSamples, leak.state().runSamples);
+}
+
+void test_run_continues_across_short_gap(void) {
+  leak.tick(1, 1.0f);
+  quietTicks(config.runGapSec / TICK_SEC - 1);
+  leak.tick(1, 1.0f);
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 2.0f, leak.runVolumeGal());
+  TEST_ASSERT_EQUAL_UINT8(0, leak.state().runSamples);
+}
+
+void test_restore_keeps_baselines(void) {
+  for (int i = 0; i < config.minSamples; i++) { leak.endHour(5, 4.0f); run(1.0f); }
+  LeakState saved = leak.state();
+  leak.reset();
+  TEST_ASSERT_EQUAL_UINT8(LEAK_NONE, leak.endHour(5, 40.0f));
+  leak.restore(saved);
+  TEST_ASSERT_EQUAL_UINT8(LEAK_HOUR_VOLUME, leak.endHour(5, 40.0f));
+  TEST_ASSERT_EQUAL_UINT8(LEAK_RUN_VOLUME, run(10.0f));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_continuous_warn_then_crit);
+  RUN_TEST(test_short_gaps_do_not_reset);
+  RUN_TEST(test_quiet_interval_resets_and_rearms);
+  RUN_TEST(test_hour_alert_and_learning);
+  RUN_TEST(test_hour_needs_min_samples);
+  RUN_TEST(test_run_alert_and_learning);
+  RUN_TEST(test_run_needs_min_samples);
+  RUN_TEST(test_run_continues_across_short_gap);
+  RUN_TEST(test_restore_keeps_baselines);
+  return UNITY_END();
+}
@@ -0,0 +1,119 @@
+// ==================================
+// === LoopProfiler tests ===========
+// ==================================
+// Host only:  pio test -e native -f test_loop_profiler
+// LogHistogram::binOf at every power-of-two edge and the open last bin,
+// StageStats::p99Us picking the bin that holds the 99th-percentile rank
+// (and its cap at maxUs), and a stage timed through the cycle counter.
+
+#include <unity.h>
+#include "loopProfiler.h"
+
+typedef LogHistogram<STAGE_HIST_BINS> StageHist;
+
+static StageStats stats;
+
+static void addN(uint32_t n, uint32_t us) {
+  for (uint32_t i = 0; i < n; i++) stats.add(us);
+}
+
+void setUp(void) { stats.reset(); }
+void tearDown(void) {}
+
+void test_bin_edges(void) {
+  TEST_ASSERT_EQUAL_UINT8(0, StageHist::binOf(0));
+  TEST_ASSERT_EQUAL_UINT8(1, StageHist::binOf(1));
+  for (uint8_t b = 2; b < STAGE_HIST_BINS; b++) {
+    uint32_t low = 1UL << (b - 1);
+    TEST_ASSERT_EQUAL_UINT8(b - 1, StageHist::binOf(low - 1));
+    TEST_ASSERT_EQUAL_UINT8(b, StageHist::binOf(low));
+    TEST_ASSERT_EQUAL_UINT32(low, StageHist::lowerBound(b));
+  }
+  // Last bin is open-ended: 16384 us (bin 15's lower edge) and up
+  TEST_ASSERT_EQUAL_UINT8(STAGE_HIST_BINS - 1, StageHist::binOf(16384));
+  TEST_ASSERT_EQUAL_UINT8(STAGE_HIST_BINS - 1, StageHist::binOf(1UL << 20));
+  TEST_ASSERT_EQUAL_UINT8(STAGE_HIST_BINS - 1, StageHist::binOf(UINT32_MAX));
+  TEST_ASSERT_EQUAL_UINT32(0, StageHist::lowerBound(0));
+}
+
+void test_min_max_count(void) {
+  TEST_ASSERT_EQUAL_UINT32(0, stats.minOrZero());
+  TEST_ASSERT_EQUAL_UINT32(0, stats.p99Us());
+  stats.add(40);
+  stats.add(7);
+  stats.add(900);
+  TEST_ASSERT_EQUAL_UINT32(3, stats.count);
+  TEST_ASSERT_EQUAL_UINT32(7, stats.minOrZero());
+  TEST_ASSERT_EQUAL_UINT32(900, stats.maxUs);
+  TEST_ASSERT_EQUAL_UINT32(1, stats.hist[StageHist::binOf(40)]);
+}
+
+void test_p99_rank(void) {
+  // 100 samples: the 99th is the last of the fast ones
+  addN(99, 3);
+  addN(1, 5000);
+  TEST_ASSERT_EQUAL_UINT32(3, stats.p99Us());          // bin [2, 4) upper edge
+
+  // One more slow sample moves the 99th into the slow bin, capped at maxUs
+  stats.reset();
+  addN(98, 3);
+  addN(2, 5000);
+  TEST_ASSERT_EQUAL_UINT32(5000, stats.p99Us());       // bin edge 8191 > maxUs
+
+  // 1000 samples, 1 % slow
+  stats.reset();
+  addN(990, 100);
+  addN(10, 3000);
+  TEST_ASSERT_EQUAL_UINT32(127, stats.p99Us());
+}
+
+void test_p99_edges(void) {
+  addN(100, 0);
+  TEST_ASSERT_EQUAL_UINT32(0, stats.p99Us());          // all under 1 us
+
+  stats.reset();
+  addN(10, 5);
+  TEST_ASSERT_EQUAL_UINT32(5, stats.p99Us());          // bin edge 7, capped at maxUs
+
+  // Under 100 samples the rank is the last one: p99 is the max's bin
+  stats.reset();
+  addN(50, 3);
+  stats.add(200);
+  TEST_ASSERT_EQUAL_UINT32(200, stats.p99Us());
+
+  // The 99th in the open last bin: maxUs, not a bin edge
+  stats.reset();
+  addN(989, 100);
+  addN(11, 20000);
+  TEST_ASSERT_EQUAL_UINT32(20000, stats.p99Us());
+}
+
+void test_record_uses_cycle_counter(void) {
+  LoopProfiler<2> prof;
+  uint32_t t = prof.stamp();
+  halAdvanceUs(250);
+  prof.record(1, t);
+  t = prof.stamp();
+  halAdvanceUs(12);
+  prof.record(1, t);
+  TEST_ASSERT_EQUAL_UINT32(2, prof.stats(1).count);
+  TEST_ASSERT_EQUAL_UINT32(12, prof.stats(1).minUs);
+  TEST_ASSERT_EQUAL_UINT32(250, prof.stats(1).maxUs);
+  TEST_ASSERT_EQUAL_UINT32(0, prof.stats(0).count);
+
+  halAdvanceMs(5000);
+  TEST_ASSERT_EQUAL_UINT32(5000, prof.periodMs());
+  prof.reset();
+  TEST_ASSERT_EQUAL_UINT32(0, prof.stats(1).count);
+  TEST_ASSERT_EQUAL_UINT32(0, prof.periodMs());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_bin_edges);
+  RUN_TEST(test_min_max_count);
+  RUN_TEST(test_p99_rank);
+  RUN_TEST(test_p99_edges);
+  RUN_TEST(test_record_uses_cycle_counter);
+  return UNITY_END();
+}
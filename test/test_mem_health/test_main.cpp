@@ -0,0 +1,143 @@
+// ==================================
+// === MemHealth tests ==============
+// ==================================
+// Host only:  pio test -e native -f test_mem_health
+// Alarms are raised once and clear only past the recovery margin, the
+// fragmentation figure at its edges (no free heap, a block as large as the
+// free heap), unsampled stacks, and the per-period worst values.
+
+#include <unity.h>
+#include <new>
+#include "memHealth.h"
+
+static const MemConfig config = {
+    20000,   // minFreeHeap bytes
+    8000,    // minBlock bytes
+    80,      // fragWarnPct
+    1000,    // minStackFree bytes
+    10       // recoverPct
+};
+
+static MemHealth *health;
+
+static MemSample sample(uint32_t freeHeap, uint32_t maxBlock, uint32_t loopStack = 4000, uint32_t commsStack = 4000) {
+  MemSample s;
+  s.freeHeap = freeHeap;
+  s.minFreeHeap = freeHeap;
+  s.maxBlock = maxBlock;
+  s.loopStackFree = loopStack;
+  s.commsStackFree = commsStack;
+  return s;
+}
+
+// 40 % fragmented, every limit well clear
+static MemSample healthy() { return sample(100000, 60000); }
+
+void setUp(void) {
+  static uint8_t storage[sizeof(MemHealth)];
+  health = new (storage) MemHealth(config);
+}
+void tearDown(void) {}
+
+void test_healthy_sample_raises_nothing(void) {
+  TEST_ASSERT_EQUAL_UINT8(MEM_NONE, health->update(healthy()));
+  TEST_ASSERT_EQUAL_UINT8(MEM_NONE, health->active());
+  TEST_ASSERT_EQUAL_UINT8(40, health->latest().fragPct());
+}
+
+void test_low_heap_hysteresis(void) {
+  TEST_ASSERT_EQUAL_UINT8(MEM_LOW_HEAP, health->update(sample(19999, 15000)));
+  TEST_ASSERT_EQUAL_UINT8(MEM_NONE, health->update(sample(19000, 15000)));   // raised once
+  TEST_ASSERT_EQUAL_UINT8(MEM_LOW_HEAP, health->active());
+
+  // Back over the limit but inside the 10 % margin (22000): still active
+  TEST_ASSERT_EQUAL_UINT8(MEM_NONE, health->update(sample(21000, 15000)));
+  TEST_ASSERT_EQUAL_UINT8(MEM_LOW_HEAP, health->active());
+  TEST_ASSERT_EQUAL_UINT8(MEM_NONE, health->update(sample(19500, 15000)));   // no flap
+  TEST_ASSERT_EQUAL_UINT8(MEM_NONE, health->update(sample(22000, 15000)));
+  TEST_ASSERT_EQUAL_UINT8(MEM_LOW_HEAP, health->active());
+
+  TEST_ASSERT_EQUAL_UINT8(MEM_NONE, health->update(sample(22001, 15000)));
+  TEST_ASSERT_EQUAL_UINT8(MEM_NONE, health->active());
+  TEST_ASSERT_EQUAL_UINT8(MEM_LOW_HEAP, health->update(sample(19999, 15000)));   // re-armed
+}
+
+void test_small_block_hysteresis(void) {
+  TEST_ASSERT_EQUAL_UINT8(MEM_SMALL_BLOCK, health->update(sample(100000, 7999)) & MEM_SMALL_BLOCK);
+  TEST_ASSERT_EQUAL_UINT8(MEM_NONE, health->update(sample(100000, 8700)) & MEM_SMALL_BLOCK);
+  TEST_ASSERT_TRUE(health->active() & MEM_SMALL_BLOCK);
+  health->update(sample(100000, 8801));
+  TEST_ASSERT_FALSE(health->active() & MEM_SMALL_BLOCK);
+}
+
+void test_frag_pct_edges(void) {
+  TEST_ASSERT_EQUAL_UINT8(0, sample(0, 0).fragPct());           // no free heap at all
+  TEST_ASSERT_EQUAL_UINT8(0, sample(0, 5000).fragPct());
+  TEST_ASSERT_EQUAL_UINT8(0, sample(50000, 50000).fragPct());   // one block is everything
+  TEST_ASSERT_EQUAL_UINT8(0, sample(50000, 60000).fragPct());   // racing samples
+  TEST_ASSERT_EQUAL_UINT8(1, sample(50000, 49999).fragPct());   // rounds toward fragmented
+  TEST_ASSERT_EQUAL_UINT8(80, sample(100000, 20000).fragPct());
+  TEST_ASSERT_EQUAL_UINT8(100, sample(4000000000UL, 1).fragPct());  // no 32-bit overflow
+}
+
+void test_no_free_heap_is_low_heap_not_fragmented(void) {
+  uint8_t fresh = health->update(sample(0, 0));
+  TEST_ASSERT_TRUE(fresh & MEM_LOW_HEAP);
+  TEST_ASSERT_TRUE(fresh & MEM_SMALL_BLOCK);
+  TEST_ASSERT_FALSE(fresh & MEM_FRAGMENTED);
+}
+
+void test_fragmentation_hysteresis(void) {
+  TEST_ASSERT_EQUAL_UINT8(MEM_NONE, health->update(sample(100000, 21000)));   // 79 %
+  TEST_ASSERT_EQUAL_UINT8(MEM_FRAGMENTED, health->update(sample(100000, 20000)));
+  TEST_ASSERT_EQUAL_UINT8(MEM_NONE, health->update(sample(100000, 30000)));   // 70 %: not below 80 - 10
+  TEST_ASSERT_TRUE(health->active() & MEM_FRAGMENTED);
+  TEST_ASSERT_EQUAL_UINT8(MEM_NONE, health->update(sample(100000, 31000)));   // 69 %
+  TEST_ASSERT_FALSE(health->active() & MEM_FRAGMENTED);
+}
+
+void test_stack_alarm_skips_unsampled(void) {
+  TEST_ASSERT_EQUAL_UINT32(0, MemHealth::stackHeadroom(sample(100000, 60000, 0, 0)));
+  TEST_ASSERT_EQUAL_UINT32(700, MemHealth::stackHeadroom(sample(100000, 60000, 0, 700)));
+  TEST_ASSERT_EQUAL_UINT32(700, MemHealth::stackHeadroom(sample(100000, 60000, 700, 0)));
+  TEST_ASSERT_EQUAL_UINT32(600, MemHealth::stackHeadroom(sample(100000, 60000, 600, 900)));
+
+  TEST_ASSERT_EQUAL_UINT8(MEM_NONE, health->update(sample(100000, 60000, 0, 0)));
+  TEST_ASSERT_EQUAL_UINT8(MEM_LOW_STACK, health->update(sample(100000, 60000, 0, 999)));
+  TEST_ASSERT_EQUAL_UINT8(MEM_NONE, health->update(sample(100000, 60000, 1050, 4000)));
+  TEST_ASSERT_TRUE(health->active() & MEM_LOW_STACK);
+  health->update(sample(100000, 60000, 1101, 4000));
+  TEST_ASSERT_FALSE(health->active() & MEM_LOW_STACK);
+}
+
+void test_period_worst(void) {
+  health->update(sample(90000, 50000, 3000, 0));
+  health->update(sample(70000, 60000, 0, 2500));
+  health->update(healthy());
+  const MemSample &w = health->periodWorst();
+  TEST_ASSERT_EQUAL_UINT32(3, health->periodSamples());
+  TEST_ASSERT_EQUAL_UINT32(70000, w.freeHeap);
+  TEST_ASSERT_EQUAL_UINT32(50000, w.maxBlock);
+  TEST_ASSERT_EQUAL_UINT32(3000, w.loopStackFree);    // 0 = not sampled, not a minimum
+  TEST_ASSERT_EQUAL_UINT32(2500, w.commsStackFree);
+  TEST_ASSERT_EQUAL_UINT8(45, health->periodPeakFragPct());   // 90000 / 50000
+
+  health->resetPeriod();
+  TEST_ASSERT_EQUAL_UINT32(0, health->periodSamples());
+  TEST_ASSERT_EQUAL_UINT8(0, health->periodPeakFragPct());
+  health->update(healthy());
+  TEST_ASSERT_EQUAL_UINT32(100000, health->periodWorst().freeHeap);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_healthy_sample_raises_nothing);
+  RUN_TEST(test_low_heap_hysteresis);
+  RUN_TEST(test_small_block_hysteresis);
+  RUN_TEST(test_frag_pct_edges);
+  RUN_TEST(test_no_free_heap_is_low_heap_not_fragmented);
+  RUN_TEST(test_fragmentation_hysteresis);
+  RUN_TEST(test_stack_alarm_skips_unsampled);
+  RUN_TEST(test_period_worst);
+  return UNITY_END();
+}
@@ -0,0 +1,219 @@
+// ==================================
+// === NvsJournal tests =============
+// ==================================
+// Host only:  pio test -e native -f test_nvs_journal
+// Runs the journal on the HAL's in-memory Preferences: writes alternate
+// between the two slots, load() picks the newest valid one (also across a
+// sequence wrap), a torn or CRC-failing slot falls back to the other, the
+// lifetime write counter carries across a reload, and an unchanged save
+// does not touch flash.
+
+#include <unity.h>
+#include "nvsJournal.h"
+
+#define JOURNAL_NS "jtest"
+
+struct __attribute__((packed)) TestState {
+  uint32_t count;
+  float volume;
+  char label[8];
+};
+
+typedef NvsJournal<TestState, 1> TestJournal;
+
+// The on-flash record, for writing slots by hand
+struct __attribute__((packed)) RawRecord {
+  uint16_t magic;
+  uint8_t version;
+  uint8_t reserved;
+  uint16_t size;
+  uint32_t seq;
+  uint32_t writes;
+  TestState data;
+  uint32_t crc;
+};
+
+static TestState state(uint32_t count) {
+  TestState s;
+  memset(&s, 0, sizeof(s));
+  s.count = count;
+  s.volume = 0.5f * count;
+  snprintf(s.label, sizeof(s.label), "s%lu", (unsigned long)count);
+  return s;
+}
+
+static void writeSlot(const char *key, uint32_t seq, uint32_t writes, uint32_t count) {
+  RawRecord r;
+  r.magic = 0x4A4E;
+  r.version = 1;
+  r.reserved = 0;
+  r.size = sizeof(TestState);
+  r.seq = seq;
+  r.writes = writes;
+  r.data = state(count);
+  r.crc = crc32(&r, sizeof(r) - sizeof(r.crc));
+  Preferences prefs;
+  prefs.begin(JOURNAL_NS, false);
+  prefs.putBytes(key, &r, sizeof(r));
+  prefs.end();
+}
+
+static std::vector<uint8_t> &slotBytes(const char *key) { return halNvs[JOURNAL_NS][key]; }
+
+static uint32_t slotSeq(const char *key) {
+  RawRecord r;
+  memcpy(&r, slotBytes(key).data(), sizeof(r));
+  return r.seq;
+}
+
+// A fresh journal, as after a reboot; returns the loaded count or -1
+static long reload(uint32_t *writes = NULL) {
+  TestJournal j(JOURNAL_NS);
+  TestState s;
+  if (!j.load(s)) return -1;
+  if (writes) *writes = j.writes();
+  return (long)s.count;
+}
+
+void setUp(void) { halNvs.clear(); }
+void tearDown(void) {}
+
+void test_empty_namespace_loads_nothing(void) {
+  TEST_ASSERT_EQUAL_INT32(-1, reload());
+  TestJournal j(JOURNAL_NS);
+  TestState s;
+  TEST_ASSERT_FALSE(j.load(s));
+  TEST_ASSERT_EQUAL_UINT32(0, j.writes());
+}
+
+void test_writes_alternate_slots(void) {
+  TestJournal j(JOURNAL_NS);
+  TEST_ASSERT_TRUE(j.save(state(1)));
+  TEST_ASSERT_EQUAL_UINT32(sizeof(RawRecord), slotBytes("s1").size());
+  TEST_ASSERT_EQUAL_UINT32(1, slotSeq("s1"));
+  TEST_ASSERT_FALSE(halNvs[JOURNAL_NS].count("s0"));
+
+  TEST_ASSERT_TRUE(j.save(state(2)));
+  TEST_ASSERT_TRUE(j.save(state(3)));
+  TEST_ASSERT_EQUAL_UINT32(2, slotSeq("s0"));
+  TEST_ASSERT_EQUAL_UINT32(3, slotSeq("s1"));
+
+  uint32_t writes = 0;
+  TEST_ASSERT_EQUAL_INT32(3, reload(&writes));
+  TEST_ASSERT_EQUAL_UINT32(3, writes);
+}
+
+void test_newest_slot_wins_either_way_round(void) {
+  writeSlot("s0", 8, 8, 80);
+  writeSlot("s1", 7, 7, 70);
+  TEST_ASSERT_EQUAL_INT32(80, reload());
+
+  writeSlot("s1", 9, 9, 90);
+  TEST_ASSERT_EQUAL_INT32(90, reload());
+}
+
+void test_sequence_wrap(void) {
+  writeSlot("s1", 0xFFFFFFFFUL, 41, 41);
+  writeSlot("s0", 0, 42, 42);   // wrapped: newer than 0xFFFFFFFF
+  TestJournal j(JOURNAL_NS);
+  TestState s;
+  TEST_ASSERT_TRUE(j.load(s));
+  TEST_ASSERT_EQUAL_UINT32(42, s.count);
+
+  TEST_ASSERT_TRUE(j.save(state(43)));   // seq 1 replaces the pre-wrap slot
+  TEST_ASSERT_EQUAL_UINT32(1, slotSeq("s1"));
+  TEST_ASSERT_EQUAL_UINT32(0, slotSeq("s0"));
+  TEST_ASSERT_EQUAL_INT32(43, reload());
+}
+
+void test_torn_slot_falls_back(void) {
+  TestJournal j(JOURNAL_NS);
+  TEST_ASSERT_TRUE(j.save(state(1)));
+  TEST_ASSERT_TRUE(j.save(state(2)));
+  slotBytes("s0").resize(sizeof(RawRecord) - 5);   // newest write cut short
+  uint32_t writes = 0;
+  TEST_ASSERT_EQUAL_INT32(1, reload(&writes));
+  TEST_ASSERT_EQUAL_UINT32(1, writes);
+
+  slotBytes("s1")[0] ^= 0xFF;                        // and now a bad magic on the other
+  TEST_ASSERT_EQUAL_INT32(-1, reload());
+}
+
+void test_crc_mismatch_falls_back(void) {
+  TestJournal j(JOURNAL_NS);
+  TEST_ASSERT_TRUE(j.save(state(1)));
+  TEST_ASSERT_TRUE(j.save(state(2)));
+  slotBytes("s0")[offsetof(RawRecord, data) + 2] ^= 0x01;   // one bit in the data
+  TEST_ASSERT_EQUAL_INT32(1, reload());
+
+  // The next save continues from the surviving record and rewrites the bad slot
+  TestJournal k(JOURNAL_NS);
+  TestState s;
+  TEST_ASSERT_TRUE(k.load(s));
+  TEST_ASSERT_TRUE(k.save(state(5)));
+  TEST_ASSERT_EQUAL_UINT32(2, slotSeq("s0"));
+  TEST_ASSERT_EQUAL_INT32(5, reload());
+}
+
+void test_other_version_is_ignored(void) {
+  TestJournal j(JOURNAL_NS);
+  TEST_ASSERT_TRUE(j.save(state(1)));
+  NvsJournal<TestState, 2> next(JOURNAL_NS);
+  TestState s;
+  TEST_ASSERT_FALSE(next.load(s));
+}
+
+void test_wear_counter_survives_reload(void) {
+  uint32_t before = halNvsWrites;
+  {
+    TestJournal j(JOURNAL_NS);
+    for (uint32_t i = 1; i <= 5; i++) TEST_ASSERT_TRUE(j.save(state(i)));
+    TEST_ASSERT_EQUAL_UINT32(5, j.writes());
+  }
+  TEST_ASSERT_EQUAL_UINT32(5, halNvsWrites - before);
+
+  TestJournal j(JOURNAL_NS);
+  TestState s;
+  TEST_ASSERT_TRUE(j.load(s));
+  TEST_ASSERT_EQUAL_UINT32(5, j.writes());
+  TEST_ASSERT_TRUE(j.save(state(6)));
+  TEST_ASSERT_EQUAL_UINT32(6, j.writes());
+  TEST_ASSERT_EQUAL_UINT32(6, halNvsWrites - before);
+}
+
+void test_unchanged_save_skips_flash(void) {
+  TestJournal j(JOURNAL_NS);
+  TEST_ASSERT_TRUE(j.save(state(1)));
+  uint32_t before = halNvsWrites;
+  TEST_ASSERT_TRUE(j.save(state(1)));
+  TEST_ASSERT_TRUE(j.save(state(1)));
+  TEST_ASSERT_EQUAL_UINT32(before, halNvsWrites);
+  TEST_ASSERT_EQUAL_UINT32(2, j.skipped());
+  TEST_ASSERT_EQUAL_UINT32(1, j.writes());
+
+  // Also right after a reload: the loaded record is the baseline
+  TestJournal k(JOURNAL_NS);
+  TestState s;
+  TEST_ASSERT_TRUE(k.load(s));
+  TEST_ASSERT_TRUE(k.save(state(1)));
+  TEST_ASSERT_EQUAL_UINT32(before, halNvsWrites);
+  TEST_ASSERT_EQUAL_UINT32(1, k.skipped());
+
+  TEST_ASSERT_TRUE(k.save(state(2)));
+  TEST_ASSERT_EQUAL_UINT32(before + 1, halNvsWrites);
+  TEST_ASSERT_EQUAL_UINT32(2, k.writes());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_empty_namespace_loads_nothing);
+  RUN_TEST(test_writes_alternate_slots);
+  RUN_TEST(test_newest_slot_wins_either_way_round);
+  RUN_TEST(test_sequence_wrap);
+  RUN_TEST(test_torn_slot_falls_back);
+  RUN_TEST(test_crc_mismatch_falls_back);
+  RUN_TEST(test_other_version_is_ignored);
+  RUN_TEST(test_wear_counter_survives_reload);
+  RUN_TEST(test_unchanged_save_skips_flash);
+  return UNITY_END();
+}
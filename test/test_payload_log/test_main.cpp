@@ -0,0 +1,210 @@
+// ==================================
+// === PayloadLog: tests + bench ====
+// ==================================
+// Host only:  pio test -e native -f test_payload_log
+// Runs the log against a scratch directory: appends survive a reopen and
+// come back in order, acked records stay acked, a torn tail record is
+// dropped without losing the records before it, and a full ring drops the
+// oldest unsent records and counts them. The benchmark times append() with
+// a ~300 byte hourly report; the host filesystem is much faster than
+// LittleFS, so only the relative cost of commit() is meaningful.
+
+#include <unity.h>
+#include <chrono>
+#include <stdlib.h>
+#include <unistd.h>
+
+static char logDir[64];
+#define PAYLOAD_LOG_DIR logDir
+#include "payloadLog.h"
+
+static char buf[PAYLOAD_LOG_MAX_RECORD + 1];
+
+static void slotFile(uint8_t slot, char *path, size_t len) {
+  snprintf(path, len, "%s/plog%u.bin", logDir, (unsigned)slot);
+}
+
+static void appendRec(PayloadLog &log, uint32_t n) {
+  char rec[32];
+  int len = snprintf(rec, sizeof(rec), "rec %lu", (unsigned long)n);
+  TEST_ASSERT_TRUE(log.append(rec, len));
+}
+
+// Pops the oldest record and checks it is "rec n"
+static void expectRec(PayloadLog &log, uint32_t n) {
+  char want[32];
+  snprintf(want, sizeof(want), "rec %lu", (unsigned long)n);
+  size_t len = 0;
+  TEST_ASSERT_TRUE(log.peek(buf, sizeof(buf), &len));
+  TEST_ASSERT_EQUAL_STRING(want, buf);
+  TEST_ASSERT_EQUAL_UINT32(strlen(want), len);
+  log.pop();
+}
+
+void setUp(void) {
+  snprintf(logDir, sizeof(logDir), "/tmp/plogtestXXXXXX");
+  TEST_ASSERT_NOT_NULL(mkdtemp(logDir));
+}
+
+void tearDown(void) {
+  char path[80];
+  for (uint8_t i = 0; i < PAYLOAD_LOG_SLOTS; i++) {
+    slotFile(i, path, sizeof(path));
+    unlink(path);
+  }
+  rmdir(logDir);
+}
+
+void test_append_survives_reopen(void) {
+  PayloadLog log(logDir);
+  log.begin();
+  TEST_ASSERT_EQUAL_UINT32(0, log.pending());
+  TEST_ASSERT_FALSE(log.peek(buf, sizeof(buf), NULL));
+  for (uint32_t i = 1; i <= 5; i++) appendRec(log, i);
+  TEST_ASSERT_EQUAL_UINT32(5, log.pending());
+
+  expectRec(log, 1);
+  expectRec(log, 2);
+  log.commit();
+  expectRec(log, 3);   // acked in RAM only: comes back after a reopen
+
+  PayloadLog again(logDir);
+  again.begin();
+  TEST_ASSERT_EQUAL_UINT32(3, again.pending());
+  expectRec(again, 3);
+  expectRec(again, 4);
+  appendRec(again, 6);
+  expectRec(again, 5);
+  expectRec(again, 6);
+  TEST_ASSERT_EQUAL_UINT32(0, again.pending());
+  TEST_ASSERT_FALSE(again.peek(buf, sizeof(buf), NULL));
+}
+
+void test_batch_stops_at_small_buffer(void) {
+  PayloadLog log(logDir);
+  log.begin();
+  appendRec(log, 1);
+  appendRec(log, 100);
+  log.beginBatch();
+  TEST_ASSERT_TRUE(log.nextInBatch(buf, 6, NULL));     // "rec 1" + NUL
+  TEST_ASSERT_FALSE(log.nextInBatch(buf, 6, NULL));    // "rec 100" does not fit
+  log.commitBatch();
+  TEST_ASSERT_EQUAL_UINT32(1, log.pending());
+  expectRec(log, 100);
+}
+
+void test_torn_tail_is_dropped(void) {
+  {
+    PayloadLog log(logDir);
+    log.begin();
+    for (uint32_t i = 1; i <= 3; i++) appendRec(log, i);
+  }
+  // Power cut in the middle of the third record
+  char path[80];
+  slotFile(0, path, sizeof(path));
+  FILE *f = fopen(path, "rb+");
+  TEST_ASSERT_NOT_NULL(f);
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fclose(f);
+  TEST_ASSERT_EQUAL_INT(0, truncate(path, size - 3));
+
+  PayloadLog log(logDir);
+  log.begin();
+  TEST_ASSERT_EQUAL_UINT32(2, log.pending());
+  appendRec(log, 4);   // must not land behind the torn bytes
+
+  PayloadLog again(logDir);
+  again.begin();
+  TEST_ASSERT_EQUAL_UINT32(3, again.pending());
+  expectRec(again, 1);
+  expectRec(again, 2);
+  expectRec(again, 4);
+  TEST_ASSERT_EQUAL_UINT32(0, again.pending());
+}
+
+void test_garbage_tail_is_dropped(void) {
+  {
+    PayloadLog log(logDir);
+    log.begin();
+    appendRec(log, 1);
+  }
+  char path[80];
+  slotFile(0, path, sizeof(path));
+  FILE *f = fopen(path, "ab");
+  TEST_ASSERT_NOT_NULL(f);
+  const char junk[] = "\x50\x4c\x01\x00\xff\xff junk";   // right magic, bad length
+  fwrite(junk, 1, sizeof(junk), f);
+  fclose(f);
+
+  PayloadLog log(logDir);
+  log.begin();
+  TEST_ASSERT_EQUAL_UINT32(1, log.pending());
+  appendRec(log, 2);
+  expectRec(log, 1);
+  expectRec(log, 2);
+}
+
+void test_rotation_drops_oldest(void) {
+  PayloadLog log(logDir);
+  log.begin();
+  // ~2x the ring: the oldest unsent records are overwritten
+  const uint32_t total = 2 * PAYLOAD_LOG_SLOTS * PAYLOAD_LOG_SLOT_BYTES / (16 + 8);
+  for (uint32_t i = 1; i <= total; i++) appendRec(log, i);
+  TEST_ASSERT_TRUE(log.dropped() > 0);
+  TEST_ASSERT_EQUAL_UINT32(total, log.pending() + log.dropped());
+
+  PayloadLog again(logDir);
+  again.begin();
+  TEST_ASSERT_EQUAL_UINT32(log.pending(), again.pending());
+  uint32_t first = total - again.pending() + 1;
+  uint32_t n = again.pending();
+  for (uint32_t i = 0; i < n; i++) expectRec(again, first + i);
+  again.commit();
+  TEST_ASSERT_FALSE(again.peek(buf, sizeof(buf), NULL));
+
+  // Acks in the newest segment outlive another rotation and a reopen
+  appendRec(again, total + 1);
+  PayloadLog third(logDir);
+  third.begin();
+  TEST_ASSERT_EQUAL_UINT32(1, third.pending());
+  expectRec(third, total + 1);
+}
+
+// Benchmark: append() of an hourly-report sized record, with and without
+// a commit() after every pop as the drain does
+void test_bench_append(void) {
+  const uint32_t records = 2000;
+  char rec[300];
+  memset(rec, 'x', sizeof(rec));
+  PayloadLog log(logDir);
+  log.begin();
+
+  std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < records; i++) log.append(rec, sizeof(rec));
+  std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < records; i++) {
+    log.append(rec, sizeof(rec));
+    if (log.peek(buf, sizeof(buf), NULL)) log.pop();
+    log.commit();
+  }
+  std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+
+  double appendUs = std::chrono::duration<double, std::micro>(t1 - t0).count() / records;
+  double drainUs = std::chrono::duration<double, std::micro>(t2 - t1).count() / records;
+  char msg[128];
+  snprintf(msg, sizeof(msg), "per record: append %.1f us, append+peek+pop+commit %.1f us, dropped %lu",
+           appendUs, drainUs, (unsigned long)log.dropped());
+  TEST_MESSAGE(msg);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_append_survives_reopen);
+  RUN_TEST(test_batch_stops_at_small_buffer);
+  RUN_TEST(test_torn_tail_is_dropped);
+  RUN_TEST(test_garbage_tail_is_dropped);
+  RUN_TEST(test_rotation_drops_oldest);
+  RUN_TEST(test_bench_append);
+  return UNITY_END();
+}
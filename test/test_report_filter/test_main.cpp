@@ -0,0 +1,172 @@
+// ==================================
+// === ReportFilter tests ===========
+// ==================================
+// Host only:  pio test -e native -f test_report_filter
+// The first snapshot and every transition go out at once, flow changes only
+// once they leave the deadband (absolute AND relative), runTime in steps,
+// a heartbeat after the longest silence, and what is held back is counted
+// as suppressed.
+
+#include <unity.h>
+#include <new>
+#include "reportFilter.h"
+
+static const ReportConfig config = {
+    {0.2f, 0.10f},   // flow10s: > 0.2 gpm and > 10 %
+    {0.1f, 0.05f},   // flowAvg: > 0.1 gpm and > 5 %
+    60,              // runTimeStepSec
+    600000UL         // heartbeatMs
+};
+
+static ReportFilter *filter;
+static SimpleFlowSnapshot snap;
+static unsigned long nowMs;
+
+// evaluate(), and sent() when it approves, as sendSimpleData() does
+static ReportReason step(unsigned long advanceMs = 10000) {
+  nowMs += advanceMs;
+  ReportReason why = filter->evaluate(snap, nowMs);
+  if (why != REPORT_NONE) filter->sent(snap, nowMs, why);
+  return why;
+}
+
+void setUp(void) {
+  static uint8_t storage[sizeof(ReportFilter)];
+  filter = new (storage) ReportFilter(config);
+  memset(&snap, 0, sizeof(snap));
+  snap.valveMode = 1;
+  nowMs = 1000;
+  TEST_ASSERT_EQUAL_UINT8(REPORT_TRANSITION, step(0));   // nothing sent yet
+}
+void tearDown(void) {}
+
+void test_unchanged_is_silent(void) {
+  for (int i = 0; i < 10; i++) TEST_ASSERT_EQUAL_UINT8(REPORT_NONE, step());
+  TEST_ASSERT_EQUAL_UINT32(1, filter->sent());
+  TEST_ASSERT_EQUAL_UINT32(0, filter->suppressed());   // nothing differed
+}
+
+void test_transitions_go_out_at_once(void) {
+  snap.valveClosed = true;
+  TEST_ASSERT_EQUAL_UINT8(REPORT_TRANSITION, step());
+  snap.valveMode = 2;
+  TEST_ASSERT_EQUAL_UINT8(REPORT_TRANSITION, step());
+  snap.leakLevel = 1;
+  TEST_ASSERT_EQUAL_UINT8(REPORT_TRANSITION, step());
+
+  snap.flow10s = 0.01f;   // flow starting, however small
+  TEST_ASSERT_EQUAL_UINT8(REPORT_TRANSITION, step());
+  snap.flowAvg = 0.01f;
+  TEST_ASSERT_EQUAL_UINT8(REPORT_TRANSITION, step());
+
+  snap.runTimeSec = 30;   // below the step
+  TEST_ASSERT_EQUAL_UINT8(REPORT_NONE, step());
+  snap.runTimeSec = 0;    // the last one sent was 0 too: no run ended
+  TEST_ASSERT_EQUAL_UINT8(REPORT_NONE, step());
+  snap.runTimeSec = 90;
+  TEST_ASSERT_EQUAL_UINT8(REPORT_CHANGE, step());
+  snap.runTimeSec = 0;    // run timer reset
+  TEST_ASSERT_EQUAL_UINT8(REPORT_TRANSITION, step());
+
+  snap.warning = 1;       // every snapshot carrying a warning
+  TEST_ASSERT_EQUAL_UINT8(REPORT_TRANSITION, step());
+  TEST_ASSERT_EQUAL_UINT8(REPORT_TRANSITION, step());
+}
+
+void test_flow_deadband_needs_both_limits(void) {
+  snap.flow10s = 5.0f;
+  snap.flowAvg = 5.0f;
+  TEST_ASSERT_EQUAL_UINT8(REPORT_TRANSITION, step());
+
+  snap.flow10s = 5.4f;    // > 0.2 gpm but < 10 %
+  TEST_ASSERT_EQUAL_UINT8(REPORT_NONE, step());
+  snap.flow10s = 5.6f;    // > both
+  TEST_ASSERT_EQUAL_UINT8(REPORT_CHANGE, step());
+
+  snap.flowAvg = 5.2f;    // 4 %, still inside
+  TEST_ASSERT_EQUAL_UINT8(REPORT_NONE, step());
+  snap.flowAvg = 4.7f;    // 6 % down
+  TEST_ASSERT_EQUAL_UINT8(REPORT_CHANGE, step());
+
+  // At low flow the absolute limit governs
+  snap.flow10s = 0.5f;
+  snap.flowAvg = 0.5f;
+  TEST_ASSERT_EQUAL_UINT8(REPORT_CHANGE, step());
+  snap.flow10s = 0.65f;   // 30 % but only 0.15 gpm
+  TEST_ASSERT_EQUAL_UINT8(REPORT_NONE, step());
+  snap.flow10s = 0.75f;
+  TEST_ASSERT_EQUAL_UINT8(REPORT_CHANGE, step());
+}
+
+void test_deadband_is_from_last_sent(void) {
+  snap.flow10s = 5.0f;
+  TEST_ASSERT_EQUAL_UINT8(REPORT_TRANSITION, step());
+  // Creeping up 0.1 gpm at a time: each step is small, the drift is not
+  for (int i = 1; i <= 4; i++) {
+    snap.flow10s = 5.0f + 0.1f * i;
+    TEST_ASSERT_EQUAL_UINT8(REPORT_NONE, step());
+  }
+  snap.flow10s = 5.6f;
+  TEST_ASSERT_EQUAL_UINT8(REPORT_CHANGE, step());
+}
+
+void test_heartbeat_after_silence(void) {
+  TEST_ASSERT_EQUAL_UINT8(REPORT_NONE, step(config.heartbeatMs - 1));
+  TEST_ASSERT_EQUAL_UINT8(REPORT_HEARTBEAT, step(1));
+  TEST_ASSERT_EQUAL_UINT32(1, filter->heartbeats());
+
+  // Any send restarts the silence
+  TEST_ASSERT_EQUAL_UINT8(REPORT_NONE, step(config.heartbeatMs / 2));
+  snap.valveClosed = true;
+  TEST_ASSERT_EQUAL_UINT8(REPORT_TRANSITION, step());
+  TEST_ASSERT_EQUAL_UINT8(REPORT_NONE, step(config.heartbeatMs - 1));
+  TEST_ASSERT_EQUAL_UINT8(REPORT_HEARTBEAT, step(1));
+  TEST_ASSERT_EQUAL_UINT32(2, filter->heartbeats());
+}
+
+void test_heartbeat_across_millis_wrap(void) {
+  nowMs = 0xFFFFFFFFUL - 1000;
+  snap.valveClosed = true;
+  TEST_ASSERT_EQUAL_UINT8(REPORT_TRANSITION, step(0));
+  TEST_ASSERT_EQUAL_UINT8(REPORT_NONE, step(config.heartbeatMs - 1));
+  TEST_ASSERT_EQUAL_UINT8(REPORT_HEARTBEAT, step(1));
+}
+
+void test_suppressed_counting(void) {
+  snap.flow10s = 5.0f;
+  TEST_ASSERT_EQUAL_UINT8(REPORT_TRANSITION, step());
+  filter->resetHour();
+
+  snap.flow10s = 5.1f;
+  step();                 // differs, held back
+  step();                 // still differs from the last sent
+  snap.flow10s = 5.0f;
+  step();                 // back to what was sent: not counted
+  snap.runTimeSec = 10;
+  step();
+  TEST_ASSERT_EQUAL_UINT32(3, filter->suppressed());
+  TEST_ASSERT_EQUAL_UINT16(3, filter->suppressedThisHour());
+  TEST_ASSERT_EQUAL_UINT16(0, filter->sentThisHour());
+
+  snap.flow10s = 6.0f;
+  TEST_ASSERT_EQUAL_UINT8(REPORT_CHANGE, step());
+  TEST_ASSERT_EQUAL_UINT16(1, filter->sentThisHour());
+  TEST_ASSERT_EQUAL_UINT32(3, filter->sent());
+
+  filter->resetHour();
+  TEST_ASSERT_EQUAL_UINT16(0, filter->sentThisHour());
+  TEST_ASSERT_EQUAL_UINT16(0, filter->suppressedThisHour());
+  TEST_ASSERT_EQUAL_UINT32(3, filter->suppressed());   // lifetime totals stay
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_unchanged_is_silent);
+  RUN_TEST(test_transitions_go_out_at_once);
+  RUN_TEST(test_flow_deadband_needs_both_limits);
+  RUN_TEST(test_deadband_is_from_last_sent);
+  RUN_TEST(test_heartbeat_after_silence);
+  RUN_TEST(test_heartbeat_across_millis_wrap);
+  RUN_TEST(test_suppressed_counting);
+  return UNITY_END();
+}
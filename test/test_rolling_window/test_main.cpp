@@ -0,0 +1,132 @@
+// ==================================
+// === RollingWindow: tests + bench =
+// ==================================
+// Host only:  pio test -e native -f test_rolling_window
+// Checks the running sums against a full rescan, across the ring wrap and
+// through FlowStats' peak windows, then times both approaches per tick:
+// the rescan is what updateMax() used to do (four windows, up to 180
+// samples each), the windows are what FlowStats does now.
+
+#include <unity.h>
+#include <chrono>
+#include "rollingWindow.h"
+#include "flowStats.h"
+
+typedef SamplingPlan<DomesticSampling> Plan;
+static const uint16_t RING = Plan::hourTicks;
+static const uint16_t WINDOWS[4] = {Plan::win10SecTicks, Plan::win1MinTicks,
+                                    Plan::win10MinTicks, Plan::win30MinTicks};
+
+static uint32_t rng = 1;
+static uint16_t nextPulses() {
+  rng ^= rng << 13; rng ^= rng >> 17; rng ^= rng << 5;
+  return (rng % 4) ? rng % 40 : 0;   // a quarter of the ticks have no flow
+}
+
+// Sum of the last n samples ending at slot `last` of the ring
+static uint32_t rescan(const uint16_t *ring, uint16_t last, uint16_t n) {
+  uint32_t sum = 0;
+  for (uint16_t k = 0; k < n; k++) sum += ring[(last + RING - k) % RING];
+  return sum;
+}
+
+void setUp(void) { rng = 1; }
+void tearDown(void) {}
+
+void test_sum_matches_rescan_across_wrap(void) {
+  uint16_t ring[RING] = {0};
+  RollingWindow<uint16_t, 6, uint32_t> w6;
+  RollingWindow<uint16_t, 180, uint32_t> w180;
+  for (uint32_t i = 0; i < 3 * RING + 7; i++) {
+    uint16_t p = nextPulses();
+    ring[i % RING] = p;
+    w6.push(p);
+    w180.push(p);
+    uint16_t last = i % RING;
+    TEST_ASSERT_EQUAL_UINT32(rescan(ring, last, i < 6 ? i + 1 : 6), w6.sum());
+    TEST_ASSERT_EQUAL_UINT32(rescan(ring, last, i < 180 ? i + 1 : 180), w180.sum());
+  }
+  TEST_ASSERT_TRUE(w180.full());
+  TEST_ASSERT_EQUAL_UINT16(180, w180.count());
+}
+
+void test_avg_before_full(void) {
+  RollingWindow<uint16_t, 4, uint32_t> w;
+  TEST_ASSERT_FLOAT_WITHIN(1e-6, 0.0f, w.avg());
+  w.push(3);
+  w.push(5);
+  TEST_ASSERT_FALSE(w.full());
+  TEST_ASSERT_FLOAT_WITHIN(1e-6, 4.0f, w.avg());
+  w.reset();
+  TEST_ASSERT_EQUAL_UINT32(0, w.sum());
+  TEST_ASSERT_EQUAL_UINT16(0, w.count());
+}
+
+// FlowStats' hourly peaks against a rescan of the whole hour, including a
+// 30 min window that straddles the ring wrap
+void test_flowstats_peaks_match_rescan(void) {
+  static FlowStats<DomesticSampling> stats;
+  uint16_t ring[RING] = {0};
+  uint32_t best[4] = {0, 0, 0, 0};
+  for (uint32_t i = 0; i < RING + RING / 2; i++) {
+    uint16_t p = nextPulses();
+    ring[i % RING] = p;
+    stats.add(p, 1735718400 + i * Plan::tickSec);
+    for (uint8_t w = 0; w < 4; w++) {
+      if (i + 1 < WINDOWS[w]) continue;
+      uint32_t s = rescan(ring, i % RING, WINDOWS[w]);
+      if (s > best[w]) best[w] = s;
+    }
+  }
+  TEST_ASSERT_FLOAT_WITHIN(1e-3, best[0] * Plan::gpmPerPulse / WINDOWS[0], stats.peak10Sec().gpm);
+  TEST_ASSERT_FLOAT_WITHIN(1e-3, best[1] * Plan::gpmPerPulse / WINDOWS[1], stats.peak1Min().gpm);
+  TEST_ASSERT_FLOAT_WITHIN(1e-3, best[2] * Plan::gpmPerPulse / WINDOWS[2], stats.peak10Min().gpm);
+  TEST_ASSERT_FLOAT_WITHIN(1e-3, best[3] * Plan::gpmPerPulse / WINDOWS[3], stats.peak30Min().gpm);
+}
+
+// Benchmark: per-tick cost of the four peak windows
+void test_bench_rescan_vs_windows(void) {
+  const uint32_t ticks = 2000000;
+  static float ringF[RING];
+  volatile float sink = 0;
+
+  std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < ticks; i++) {
+    uint16_t slot = i % RING;
+    ringF[slot] = nextPulses();
+    for (uint8_t w = 0; w < 4; w++) {
+      float sum = 0;
+      for (uint16_t k = 0; k < WINDOWS[w]; k++) sum += ringF[(slot + RING - k) % RING];
+      sink = sink + sum;
+    }
+  }
+  std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+
+  RollingWindow<uint16_t, Plan::win10SecTicks, uint32_t> w0;
+  RollingWindow<uint16_t, Plan::win1MinTicks, uint32_t> w1;
+  RollingWindow<uint16_t, Plan::win10MinTicks, uint32_t> w2;
+  RollingWindow<uint16_t, Plan::win30MinTicks, uint32_t> w3;
+  for (uint32_t i = 0; i < ticks; i++) {
+    uint16_t p = nextPulses();
+    w0.push(p); w1.push(p); w2.push(p); w3.push(p);
+    sink = sink + (float)(w0.sum() + w1.sum() + w2.sum() + w3.sum());
+  }
+  std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+
+  double rescanNs = std::chrono::duration<double, std::nano>(t1 - t0).count() / ticks;
+  double windowNs = std::chrono::duration<double, std::nano>(t2 - t1).count() / ticks;
+  char msg[128];
+  snprintf(msg, sizeof(msg), "per tick: rescan %.1f ns, rolling windows %.1f ns (%.0fx)",
+           rescanNs, windowNs, windowNs > 0 ? rescanNs / windowNs : 0.0);
+  TEST_MESSAGE(msg);
+  (void)sink;
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_sum_matches_rescan_across_wrap);
+  RUN_TEST(test_avg_before_full);
+  RUN_TEST(test_flowstats_peaks_match_rescan);
+  RUN_TEST(test_bench_rescan_vs_windows);
+  return UNITY_END();
+}
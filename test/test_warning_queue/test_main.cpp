@@ -0,0 +1,131 @@
+// ==================================
+// === WarningQueue tests ===========
+// ==================================
+// Host only:  pio test -e native -f test_warning_queue
+// Delivery order, eviction when full, the ACK timeout backoff, removal by
+// wID and the restore after a warm restart.
+
+#include <unity.h>
+#include "warningQueue.h"
+
+static WarningQueue queue;
+
+static PendingWarning warning(const char *id, WarnPriority priority) {
+  PendingWarning w;
+  memset(&w, 0, sizeof(w));
+  copyField(w.id, sizeof(w.id), id);
+  copyField(w.msg.title, sizeof(w.msg.title), id);
+  w.priority = priority;
+  return w;
+}
+
+void setUp(void) { queue.clear(); }
+void tearDown(void) {}
+
+void test_priority_then_fifo(void) {
+  TEST_ASSERT_TRUE(queue.push(warning("leak1", WARN_PRIO_NORMAL)));
+  TEST_ASSERT_TRUE(queue.push(warning("valve1", WARN_PRIO_VALVE)));
+  TEST_ASSERT_TRUE(queue.push(warning("leak2", WARN_PRIO_NORMAL)));
+  TEST_ASSERT_TRUE(queue.push(warning("valve2", WARN_PRIO_VALVE)));
+  TEST_ASSERT_EQUAL_UINT8(4, queue.size());
+  TEST_ASSERT_EQUAL_STRING("valve1", queue.at(0).id);
+  TEST_ASSERT_EQUAL_STRING("valve2", queue.at(1).id);
+  TEST_ASSERT_EQUAL_STRING("leak1", queue.at(2).id);
+  TEST_ASSERT_EQUAL_STRING("leak2", queue.at(3).id);
+}
+
+void test_full_queue_keeps_valve_warnings(void) {
+  for (uint8_t i = 0; i < WARN_QUEUE_LEN; i++) {
+    char id[8];
+    snprintf(id, sizeof(id), "leak%u", (unsigned)i);
+    TEST_ASSERT_TRUE(queue.push(warning(id, WARN_PRIO_NORMAL)));
+  }
+  TEST_ASSERT_FALSE(queue.push(warning("leakX", WARN_PRIO_NORMAL)));   // same priority: refused
+  TEST_ASSERT_TRUE(queue.push(warning("valve", WARN_PRIO_VALVE)));     // evicts the newest leak
+  TEST_ASSERT_EQUAL_UINT8(WARN_QUEUE_LEN, queue.size());
+  TEST_ASSERT_EQUAL_STRING("valve", queue.at(0).id);
+  TEST_ASSERT_EQUAL_STRING("leak0", queue.at(1).id);
+  TEST_ASSERT_FALSE(queue.ack("leak5"));
+  TEST_ASSERT_EQUAL_UINT32(2, queue.dropped());
+
+  for (uint8_t i = 1; i < WARN_QUEUE_LEN; i++) TEST_ASSERT_TRUE(queue.push(warning("valveN", WARN_PRIO_VALVE)));
+  TEST_ASSERT_FALSE(queue.push(warning("valveX", WARN_PRIO_VALVE)));
+  TEST_ASSERT_EQUAL_STRING("valve", queue.at(0).id);
+}
+
+void test_memory_alarms_rank_lowest(void) {
+  TEST_ASSERT_TRUE(queue.push(warning("mem1", WARN_PRIO_MEMORY)));
+  for (uint8_t i = 1; i < WARN_QUEUE_LEN; i++) TEST_ASSERT_TRUE(queue.push(warning("leak", WARN_PRIO_NORMAL)));
+  TEST_ASSERT_EQUAL_STRING("mem1", queue.at(WARN_QUEUE_LEN - 1).id);   // sent after the leaks
+
+  TEST_ASSERT_FALSE(queue.push(warning("mem2", WARN_PRIO_MEMORY)));
+  TEST_ASSERT_TRUE(queue.push(warning("valve", WARN_PRIO_VALVE)));    // evicts mem1
+  TEST_ASSERT_EQUAL_STRING("valve", queue.at(0).id);
+  for (uint8_t i = 0; i < queue.size(); i++) TEST_ASSERT_TRUE(queue.at(i).priority != WARN_PRIO_MEMORY);
+}
+
+void test_retry_backoff_until_ack(void) {
+  queue.push(warning("w1", WARN_PRIO_VALVE));
+  unsigned long t = 1000;
+  TEST_ASSERT_TRUE(queue.isDue(0, t));   // never sent: due at once
+  queue.markSent(0, t);
+  TEST_ASSERT_EQUAL_UINT8(0, queue.at(0).retries);
+  TEST_ASSERT_FALSE(queue.isDue(0, t + WARN_ACK_TIMEOUT_MS - 1));
+  TEST_ASSERT_TRUE(queue.isDue(0, t + WARN_ACK_TIMEOUT_MS));
+
+  unsigned long timeout = WARN_ACK_TIMEOUT_MS;
+  for (int i = 1; i <= 8; i++) {
+    t += timeout;
+    queue.markSent(0, t);
+    TEST_ASSERT_EQUAL_UINT8(i, queue.at(0).retries);
+    timeout = WarningQueue::ackTimeout(queue.at(0).retries);
+    TEST_ASSERT_FALSE(queue.isDue(0, t + timeout - 1));
+  }
+  TEST_ASSERT_EQUAL_UINT32(WARN_ACK_TIMEOUT_MAX_MS, timeout);
+  TEST_ASSERT_EQUAL_UINT8(1, queue.size());   // never given up on
+
+  TEST_ASSERT_FALSE(queue.ack("other"));
+  TEST_ASSERT_TRUE(queue.ack("w1"));
+  TEST_ASSERT_EQUAL_UINT8(0, queue.size());
+}
+
+void test_ack_out_of_order(void) {
+  queue.push(warning("a", WARN_PRIO_NORMAL));
+  queue.push(warning("b", WARN_PRIO_NORMAL));
+  queue.push(warning("c", WARN_PRIO_NORMAL));
+  TEST_ASSERT_TRUE(queue.ack("b"));
+  TEST_ASSERT_EQUAL_UINT8(2, queue.size());
+  TEST_ASSERT_EQUAL_STRING("a", queue.at(0).id);
+  TEST_ASSERT_EQUAL_STRING("c", queue.at(1).id);
+}
+
+void test_restore_makes_everything_due(void) {
+  queue.push(warning("a", WARN_PRIO_VALVE));
+  queue.push(warning("b", WARN_PRIO_NORMAL));
+  queue.markSent(0, 5000);
+  queue.markSent(1, 5000);
+  queue.markSent(0, 5000 + WARN_ACK_TIMEOUT_MS);
+  WarningQueueState saved = queue.state();
+
+  WarningQueue after;
+  TEST_ASSERT_TRUE(after.restore(saved));
+  TEST_ASSERT_EQUAL_UINT8(2, after.size());
+  TEST_ASSERT_TRUE(after.isDue(0, 0));
+  TEST_ASSERT_TRUE(after.isDue(1, 0));
+  TEST_ASSERT_EQUAL_UINT8(1, after.at(0).retries);
+
+  saved.count = WARN_QUEUE_LEN + 1;   // not something save() wrote
+  TEST_ASSERT_FALSE(after.restore(saved));
+  TEST_ASSERT_EQUAL_UINT8(0, after.size());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_priority_then_fifo);
+  RUN_TEST(test_full_queue_keeps_valve_warnings);
+  RUN_TEST(test_memory_alarms_rank_lowest);
+  RUN_TEST(test_retry_backoff_until_ack);
+  RUN_TEST(test_ack_out_of_order);
+  RUN_TEST(test_restore_makes_everything_due);
+  return UNITY_END();
+}
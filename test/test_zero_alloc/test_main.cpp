@@ -0,0 +1,186 @@
+// ==================================
+// === Zero-allocation messaging ====
+// ==================================
+// Host only:  pio test -e native -f test_zero_alloc
+// Drives the command and telemetry path through the real firmware code
+// against the loopback broker and counts heap allocations around each
+// message: commands in (mqttCallback), acks, simpleFlowData, hourly
+// reports and a warning with its ACK out. After one warm-up pass (stdio
+// buffers, first use of the link) every message must run on the static
+// buffers and the JSON arenas alone. Allocations inside the loopback broker
+// are not counted (halInBroker); it stands in for the network.
+//
+// Only meaningful against the real ArduinoJson 7: if the warm-up left both
+// arenas untouched, the JSON library in this build does not allocate
+// through JsonArena at all (a stand-in), and the tests are ignored rather
+// than passed or failed on its allocations.
+
+#include <unity.h>
+#include <stdlib.h>
+#include <new>
+#include <wifiComs.h>
+#include "flowMon.h"
+#include "espMqtt.h"
+
+static bool counting = false;
+static uint32_t allocs = 0;
+
+static inline void noteAlloc() {
+  if (counting && !halInBroker) allocs++;
+}
+
+#if defined(__GLIBC__)
+// glibc: operator new and the stdio/strdup family all end up here
+extern "C" void *__libc_malloc(size_t);
+extern "C" void *__libc_calloc(size_t, size_t);
+extern "C" void *__libc_realloc(void *, size_t);
+extern "C" void *malloc(size_t n) { noteAlloc(); return __libc_malloc(n); }
+extern "C" void *calloc(size_t n, size_t size) { noteAlloc(); return __libc_calloc(n, size); }
+extern "C" void *realloc(void *p, size_t n) { noteAlloc(); return __libc_realloc(p, n); }
+#else
+void *operator new(size_t n) {
+  noteAlloc();
+  void *p = malloc(n ? n : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+void *operator new[](size_t n) { return operator new(n); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+#endif
+
+static HourFlowReport hour;
+static SimpleFlowSnapshot snap;
+static bool jsonUsesArena = false;
+
+#define REQUIRE_ARENA() \
+  if (!jsonUsesArena) TEST_IGNORE_MESSAGE("JSON library does not allocate through JsonArena")
+
+// Allocations made by one call of fn
+template <typename F>
+static uint32_t allocsIn(F fn) {
+  allocs = 0;
+  counting = true;
+  fn();
+  counting = false;
+  return allocs;
+}
+
+// Let the link take the broker's PUBACKs so the outbox never fills
+static void settle() {
+  for (int i = 0; i < 4; i++) mqttLink.loop();
+}
+
+static void command(const char *json) {
+  static char topic[96];
+  copyField(topic, sizeof(topic), channelTopics[0].command.c_str());
+  mqttCallback(topic, (byte *)json, strlen(json));
+  ValveCmdMsg vc;
+  while (valveCmdQueue.pop(vc)) {}   // the safety side is not running here
+}
+
+static void warningRoundTrip() {
+  WarningMsg w;
+  copyField(w.level, sizeof(w.level), "1");
+  copyField(w.title, sizeof(w.title), "Domestic Shutoff");
+  copyField(w.message, sizeof(w.message), "Water ran 600 s");
+  w.priority = WARN_PRIO_VALVE;
+  queueWarning(w, 0);
+  processWarningAckTick();
+  char ack[160];
+  int len = snprintf(ack, sizeof(ack), "{\"wID\":\"%s\",\"status\":\"ok\",\"receiver\":\"test\"}",
+                     warningQueue.at(0).id);
+  handleWarningAck((const byte *)ack, len);
+}
+
+// Every path once, outside the count
+static void warmUp() {
+  command("{\"cmd\":\"Status1\"}");
+  command("{\"cmd\":\"bogus\"}");
+  sendAck(0, "open_valve", "completed");
+  sendSimpleData(0, snap);
+  sendBigData(0, hour);
+  warningRoundTrip();
+  settle();
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static void expectNoAllocs(const char *what, uint32_t n) {
+  char msg[96];
+  snprintf(msg, sizeof(msg), "%s: %lu heap allocations", what, (unsigned long)n);
+  TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, n, msg);
+}
+
+void test_commands_do_not_allocate(void) {
+  REQUIRE_ARENA();
+  for (int i = 0; i < 20; i++) {
+    expectNoAllocs("valve command", allocsIn([] { command("{\"cmd\":\"timed_close\",\"sec\":30}"); }));
+    expectNoAllocs("unknown command", allocsIn([] { command("{\"cmd\":\"bogus\"}"); }));
+    settle();
+  }
+}
+
+void test_telemetry_does_not_allocate(void) {
+  REQUIRE_ARENA();
+  for (int i = 0; i < 20; i++) {
+    snap.flow10s = 0.1f * i;
+    snap.volumeAll += 1.0f;
+    hour.volumeHour = 0.5f * i;
+    expectNoAllocs("ack", allocsIn([] { sendAck(0, "open_valve", "completed"); }));
+    expectNoAllocs("simpleFlowData", allocsIn([] { sendSimpleData(0, snap); }));
+    expectNoAllocs("hourly report", allocsIn([] { sendBigData(0, hour); }));
+    expectNoAllocs("link loop", allocsIn([] { settle(); }));
+  }
+}
+
+void test_warning_round_trip_does_not_allocate(void) {
+  REQUIRE_ARENA();
+  for (int i = 0; i < 10; i++) {
+    expectNoAllocs("warning + ACK", allocsIn([] { warningRoundTrip(); }));
+    settle();
+  }
+  TEST_ASSERT_EQUAL_UINT8(0, warningQueue.size());
+}
+
+// Every document above (the largest being the hourly report and a warning
+// with its ACK) fit its arena: one variant pool plus its strings
+void test_arenas_never_overflowed(void) {
+  REQUIRE_ARENA();
+  char msg[96];
+  snprintf(msg, sizeof(msg), "arena high water: rx %u/%u B, tx %u/%u B",
+           (unsigned)jsonRxArena.highWaterMark(), (unsigned)jsonRxArena.capacity(),
+           (unsigned)jsonTxArena.highWaterMark(), (unsigned)jsonTxArena.capacity());
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_EQUAL_UINT32(0, jsonTxArena.overflows());
+  TEST_ASSERT_EQUAL_UINT32(0, jsonRxArena.overflows());
+}
+
+int main() {
+  halSetEpoch(1735718400);
+  connectToWiFi();
+  mqttSetup();
+  halSetWifi(true);
+  connectivityTick();
+  reconnectIfNeeded();
+  settle();
+
+  memset(&hour, 0, sizeof(hour));
+  hour.max10s = 4.8f;
+  hour.volumeAll = 48211.4f;
+  hour.startEpoch = 1735718400;
+  strcpy(hour.timeStamp, "2025-01-01 08:00:00");
+  memset(&snap, 0, sizeof(snap));
+  snap.volumeAll = 48211.4f;
+  snap.valveMode = 1;
+  warmUp();
+  jsonUsesArena = jsonRxArena.highWaterMark() > 0 && jsonTxArena.highWaterMark() > 0;
+
+  UNITY_BEGIN();
+  RUN_TEST(test_commands_do_not_allocate);
+  RUN_TEST(test_telemetry_does_not_allocate);
+  RUN_TEST(test_warning_round_trip_does_not_allocate);
+  RUN_TEST(test_arenas_never_overflowed);
+  return UNITY_END();
+}